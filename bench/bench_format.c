@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Микро-бенчмарк форматирования строки CSV:
+// прежний snprintf по float против форматирования из целых регистров.
+// Сначала проверяет побайтовое совпадение результата, затем меряет скорость.
+
+#include "pzem_monitor.h"
+
+#define CHECK_SAMPLES 2000000
+#define BENCH_SAMPLES 1000000
+#define SAMPLE_POOL 1024
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng_next(void) {
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Прежняя реализация prepare_log_entry (эталон формата)
+static void legacy_log_entry(char *log_entry, size_t size, const pzem_data_t *data, time_t t) {
+    char date_str[32];
+    char time_str[32];
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d", &tm_info);
+    localtime_r(&t, &tm_info);
+    strftime(time_str, sizeof(time_str), "%H:%M:%S", &tm_info);
+    
+    if (data->status == 0) {
+        float v[PZEM_CHANNEL_COUNT];
+        const char *st = data->state;
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            v[i] = pzem_channel_value(&data->sample, i);
+        }
+        snprintf(log_entry, size, 
+                 "%s,%s,%.1f,%c,%.1f,%c,%.1f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.1f,%.1f,%.1f,%d\n",
+                 date_str, time_str,
+                 v[0], st[0], v[1], st[1], v[2], st[2], v[3], st[3], v[4], st[4],
+                 v[5], st[5], v[6], st[6], v[7], st[7], v[8], st[8], v[9], st[9],
+                 v[10], st[10], v[11], st[11], v[12], st[12], v[13], st[13],
+                 v[14], v[15], v[16], data->status);
+    } else {
+        snprintf(log_entry, size, "%s,%s,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,%d\n",
+                 date_str, time_str, data->status);
+    }
+}
+
+// Случайный набор регистров: крайние значения, реальные диапазоны и произвольный шум
+static void random_sample(pzem_data_t *data) {
+    static const char states[] = "NHL";
+    uint32_t mode = rng_next() % 4;
+    
+    memset(data, 0, sizeof(*data));
+    uint16_t *regs = data->sample.regs;
+    for (int i = 0; i < PZEM_REG_COUNT; i++) {
+        uint32_t r = rng_next() >> 8;
+        switch (mode) {
+            case 0: regs[i] = (uint16_t)((r & 1) ? 0xFFFF : 0); break;
+            case 1: regs[i] = (uint16_t)(r % 30000); break;
+            default: regs[i] = (uint16_t)r; break;
+        }
+    }
+    
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        data->state[i] = states[rng_next() % 3];
+    }
+    data->status = (rng_next() % 16 == 0) ? (int)(rng_next() % 3) : 0;
+}
+
+int main(void) {
+    static pzem_data_t pool[SAMPLE_POOL];
+    char expected[LOG_ENTRY_SIZE];
+    char actual[LOG_ENTRY_SIZE];
+    time_t t = time(NULL);
+    
+    // Проверка побайтового совпадения
+    for (long i = 0; i < CHECK_SAMPLES; i++) {
+        pzem_data_t data;
+        random_sample(&data);
+        time_t ts = t + (time_t)(i % 100000);
+        legacy_log_entry(expected, sizeof(expected), &data, ts);
+        format_csv_entry(actual, sizeof(actual), &data, ts);
+        if (strcmp(expected, actual) != 0) {
+            fprintf(stderr, "Mismatch on sample %ld:\n  legacy: %s  fast:   %s", i, expected, actual);
+            return 1;
+        }
+    }
+    printf("Output identical on %d random samples\n", CHECK_SAMPLES);
+    
+    for (int i = 0; i < SAMPLE_POOL; i++) {
+        random_sample(&pool[i]);
+        pool[i].status = 0;
+        pool[i].sample.timestamp_ms = (long long)t * 1000;
+    }
+    
+    // Прежний вариант: время запрашивается при каждой строке
+    volatile size_t sink = 0;
+    long long start = now_ns();
+    for (long i = 0; i < BENCH_SAMPLES; i++) {
+        legacy_log_entry(expected, sizeof(expected), &pool[i % SAMPLE_POOL], time(NULL));
+        sink += (size_t)expected[20];
+    }
+    long long legacy_ns = now_ns() - start;
+    
+    start = now_ns();
+    for (long i = 0; i < BENCH_SAMPLES; i++) {
+        prepare_log_entry(actual, sizeof(actual), &pool[i % SAMPLE_POOL]);
+        sink += (size_t)actual[20];
+    }
+    long long fast_ns = now_ns() - start;
+    (void)sink;
+    
+    printf("snprintf (legacy): %8.1f ns/line\n", (double)legacy_ns / BENCH_SAMPLES);
+    printf("fixed-point:       %8.1f ns/line\n", (double)fast_ns / BENCH_SAMPLES);
+    printf("speedup:           %8.2fx\n", (double)legacy_ns / (double)fast_ns);
+    return 0;
+}
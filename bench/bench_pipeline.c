@@ -0,0 +1,361 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Бенчмарк тракта обработки на записанных логах. Каждое измерение проходит те же этапы,
+// что в потоке опроса и потоке записи: update_threshold_states, values_changed,
+// prepare_log_entry, add_to_log_buffer и flush_log_buffer.
+// Этапы меряются отдельными проходами по всему набору, затем весь тракт целиком.
+// Выделения памяти считаются обертками malloc/calloc/realloc (-Wl,--wrap).
+//
+// bench_pipeline [-c config] [-x scale] [-o dir] log...
+
+#include "pzem_monitor.h"
+#include <getopt.h>
+
+#define DEFAULT_LOG "Graph_html/pzem3_input1_2025-10-24.log"
+
+static unsigned long long alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+typedef struct {
+    pzem_data_t *samples;
+    size_t count;
+    size_t capacity;
+} sample_set_t;
+
+typedef struct {
+    const char *name;
+    long long ns;
+    unsigned long long allocs;
+    size_t items;
+} stage_result_t;
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng_next(void) {
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int sample_set_push(sample_set_t *set, const pzem_data_t *data) {
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 4096;
+        pzem_data_t *samples = realloc(set->samples, capacity * sizeof(pzem_data_t));
+        if (samples == NULL) return -1;
+        set->samples = samples;
+        set->capacity = capacity;
+    }
+    set->samples[set->count++] = *data;
+    return 0;
+}
+
+// Чтение лога с проверкой, что разбор и форматирование дают исходную строку
+static int load_log(const char *path, sample_set_t *set, size_t *lines, size_t *mismatches) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    char line[LOG_ENTRY_SIZE];
+    char formatted[LOG_ENTRY_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        pzem_data_t data;
+        if (parse_csv_entry(line, &data) != 0) continue;
+    
+        prepare_log_entry(formatted, sizeof(formatted), &data);
+        if (strcmp(formatted, line) != 0 && (*mismatches)++ == 0) {
+            fprintf(stderr, "Round trip mismatch in %s:\n  log:    %s  format: %s", path, line, formatted);
+        }
+        if (sample_set_push(set, &data) != 0) {
+            fclose(file);
+            return -1;
+        }
+        (*lines)++;
+    }
+    fclose(file);
+    return 0;
+}
+
+// Синтетическое увеличение: копии записи идут следом по времени, 16-битные каналы
+// получают шум в один младший разряд, чтобы часть измерений менялась как на живой сети
+static int scale_up(sample_set_t *set, int scale) {
+    size_t base = set->count;
+    if (base == 0 || scale <= 1) return 0;
+    
+    long long span = set->samples[base - 1].sample.timestamp_ms - set->samples[0].sample.timestamp_ms + 1000;
+    for (int copy = 1; copy < scale; copy++) {
+        for (size_t i = 0; i < base; i++) {
+            pzem_data_t data = set->samples[i];
+            data.sample.timestamp_ms += span * copy;
+            if (data.status == 0) {
+                for (int ch = 0; ch < PZEM_CHANNEL_COUNT; ch++) {
+                    if (pzem_channels[ch].wide) continue;
+                    uint32_t raw = pzem_channel_raw(&data.sample, ch);
+                    uint32_t noise = rng_next() >> 30;
+                    raw = noise == 1 ? raw + 1 : (noise == 2 && raw > 0) ? raw - 1 : raw;
+                    pzem_channel_set_raw(&data.sample, ch, raw);
+                }
+            }
+            if (sample_set_push(set, &data) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Пороги как в шаблоне конфигурации, если конфиг не задан
+static void default_config(pzem_config_t *config, const char *log_dir) {
+    load_config("/dev/null", config);
+    config->voltage_high_alarm = 245;
+    config->voltage_high_warning = 240;
+    config->voltage_low_warning = 210;
+    config->voltage_low_alarm = 200;
+    config->frequency_high_alarm = 52;
+    config->frequency_high_warning = 51;
+    config->frequency_low_warning = 49;
+    config->frequency_low_alarm = 48;
+    STRCPY_SAFE(config->log_dir, log_dir);
+}
+
+static void stage_begin(stage_result_t *stage, const char *name) {
+    stage->name = name;
+    stage->allocs = alloc_count;
+    stage->ns = now_ns();
+}
+
+static void stage_end(stage_result_t *stage, size_t items) {
+    stage->ns = now_ns() - stage->ns;
+    stage->allocs = alloc_count - stage->allocs;
+    stage->items = items;
+}
+
+static void stage_print(const stage_result_t *stage, size_t samples) {
+    printf("%-26s %10.1f %12.1f %14.3f\n", stage->name,
+           stage->items ? (double)stage->ns / (double)stage->items : 0.0,
+           samples ? (double)stage->ns / (double)samples : 0.0,
+           samples ? (double)stage->allocs / (double)samples : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    const char *config_file = NULL;
+    const char *out_dir = NULL;
+    int scale = 1;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "c:x:o:h")) != -1) {
+        switch (opt) {
+            case 'c': config_file = optarg; break;
+            case 'x': scale = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-c config] [-x scale] [-o dir] [log...]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (scale < 1) scale = 1;
+    
+    // Лог пишется во временный каталог, в конце удаляется
+    char tmp_dir[] = "/tmp/pzem3_bench.XXXXXX";
+    if (out_dir == NULL) {
+        if (mkdtemp(tmp_dir) == NULL) {
+            fprintf(stderr, "Cannot create temporary directory: %s\n", strerror(errno));
+            return 1;
+        }
+        out_dir = tmp_dir;
+    }
+    
+    pzem_config_t config;
+    if (config_file) {
+        if (load_config(config_file, &config) != PZEM_SUCCESS) {
+            fprintf(stderr, "Cannot load config %s\n", config_file);
+            return 1;
+        }
+        STRCPY_SAFE(config.log_dir, out_dir);
+    } else {
+        default_config(&config, out_dir);
+    }
+    config.log_format = PZEM_FORMAT_CSV;
+    build_channel_limits(&config, channel_limits);
+    
+    // Загрузка
+    sample_set_t set = {0};
+    size_t lines = 0;
+    size_t mismatches = 0;
+    int first_log = optind;
+    if (first_log >= argc) {
+        if (load_log(DEFAULT_LOG, &set, &lines, &mismatches) != 0) return 1;
+    }
+    for (int i = first_log; i < argc; i++) {
+        if (load_log(argv[i], &set, &lines, &mismatches) != 0) return 1;
+    }
+    if (set.count == 0) {
+        fprintf(stderr, "No log lines to replay\n");
+        return 1;
+    }
+    if (scale_up(&set, scale) != 0) {
+        fprintf(stderr, "Out of memory scaling up to x%d\n", scale);
+        return 1;
+    }
+    size_t n = set.count;
+    printf("Replay: %zu log lines x%d = %zu samples, round trip %s (%zu mismatches)\n",
+           lines, scale, n, mismatches ? "FAILED" : "identical", mismatches);
+    
+    // Исходные данные для сквозного прохода, этапы ниже меняют состояния
+    pzem_data_t *original = malloc(n * sizeof(pzem_data_t));
+    unsigned char *changed = malloc(n);
+    char *text = malloc(n * LOG_ENTRY_SIZE);
+    uint16_t *text_len = malloc(n * sizeof(uint16_t));
+    if (!original || !changed || !text || !text_len) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memcpy(original, set.samples, n * sizeof(pzem_data_t));
+    
+    log_buffer_t buffer = {0};
+    if (init_log_buffer(&buffer, &config, "bench") != PZEM_SUCCESS) {
+        fprintf(stderr, "Cannot initialize log buffer\n");
+        return 1;
+    }
+    // Все строки в файл одних суток, чтобы его можно было удалить после прогона
+    time_t log_day = time(NULL);
+    
+    stage_result_t stages[6];
+    pzem_data_t *s = set.samples;
+    volatile size_t sink = 0;
+    
+    stage_begin(&stages[0], "update_threshold_states");
+    for (size_t i = 0; i < n; i++) {
+        if (s[i].status == 0) update_threshold_states(&s[i], channel_limits);
+    }
+    stage_end(&stages[0], n);
+    
+    stage_begin(&stages[1], "values_changed");
+    pzem_data_t previous = {.first_read = 1};
+    size_t changed_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        changed[i] = (unsigned char)(values_changed(&s[i], &previous, channel_limits) ||
+                                     threshold_states_changed(&s[i], &previous));
+        if (changed[i]) {
+            previous = s[i];
+            changed_count++;
+        }
+    }
+    stage_end(&stages[1], n);
+    
+    stage_begin(&stages[2], "prepare_log_entry");
+    for (size_t i = 0, j = 0; i < n; i++) {
+        if (!changed[i]) continue;
+        text_len[j] = (uint16_t)prepare_log_entry(text + j * LOG_ENTRY_SIZE, LOG_ENTRY_SIZE, &s[i]);
+        j++;
+    }
+    stage_end(&stages[2], changed_count);
+    
+    // Как в потоке записи: строка в буфер, сброс по заполнению
+    unsigned long long flush_count = atomic_load(&metrics.flush_us.count);
+    unsigned long long flush_us = atomic_load(&metrics.flush_us.sum);
+    stage_begin(&stages[3], "add_to_log_buffer");
+    for (size_t j = 0; j < changed_count; j++) {
+        add_to_log_buffer(&buffer, text + j * LOG_ENTRY_SIZE, text_len[j], log_day);
+        if (should_flush_buffer(&buffer)) {
+            flush_log_buffer(&buffer);
+        }
+    }
+    flush_log_buffer(&buffer);
+    stage_end(&stages[3], changed_count);
+    
+    // Время сброса берется из гистограммы flush_us и вычитается из буферизации
+    flush_count = atomic_load(&metrics.flush_us.count) - flush_count;
+    flush_us = atomic_load(&metrics.flush_us.sum) - flush_us;
+    stages[4] = (stage_result_t){"flush_log_buffer", (long long)flush_us * 1000, 0, flush_count};
+    stages[3].ns -= stages[4].ns;
+    
+    // Весь тракт подряд для каждого измерения
+    stage_begin(&stages[5], "pipeline total");
+    previous = (pzem_data_t){.first_read = 1};
+    char line[LOG_ENTRY_SIZE];
+    for (size_t i = 0; i < n; i++) {
+        pzem_data_t *current = &original[i];
+        if (current->status == 0) update_threshold_states(current, channel_limits);
+        if (values_changed(current, &previous, channel_limits) || threshold_states_changed(current, &previous)) {
+            size_t len = prepare_log_entry(line, sizeof(line), current);
+            add_to_log_buffer(&buffer, line, len, log_day);
+            if (should_flush_buffer(&buffer)) {
+                flush_log_buffer(&buffer);
+            }
+            previous = *current;
+            sink += len;
+        }
+    }
+    flush_log_buffer(&buffer);
+    stage_end(&stages[5], n);
+    (void)sink;
+    
+    printf("Changed: %zu of %zu samples (%.1f%%), %llu flushes of %zu-byte buffer\n\n",
+           changed_count, n, 100.0 * (double)changed_count / (double)n, flush_count, buffer.capacity);
+    printf("%-26s %10s %12s %14s\n", "stage", "ns/item", "ns/sample", "allocs/sample");
+    for (int i = 0; i < 6; i++) {
+        stage_print(&stages[i], n);
+    }
+    printf("\nThroughput: %.0f samples/s\n", (double)n * 1e9 / (double)stages[5].ns);
+    
+    // Уборка временного лога
+    char path[512];
+    get_log_file_path(path, sizeof(path), config.log_dir, "bench", "log", log_day);
+    free_log_buffer(&buffer);
+    if (out_dir == tmp_dir) {
+        unlink(path);
+        rmdir(tmp_dir);
+    }
+    
+    free(original);
+    free(changed);
+    free(text);
+    free(text_len);
+    free(set.samples);
+    return mismatches ? 1 : 0;
+}
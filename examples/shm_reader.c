@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Пример читателя кольца измерений из разделяемой памяти.
+// Подключается к /dev/shm/pzem3_<config> и печатает новые измерения по мере появления.
+// Сборка: make examples, запуск: ./bin/pzem3_shm_reader default
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pzem_shm.h"
+
+static void print_record(const pzem_shm_record_t *rec) {
+    time_t t = (time_t)(rec->timestamp_ms / 1000);
+    struct tm tm_info;
+    char when[32];
+    localtime_r(&t, &tm_info);
+    strftime(when, sizeof(when), "%H:%M:%S", &tm_info);
+    
+    if (rec->status != 0) {
+        printf("%s.%03d addr=%d status=%d\n", when, (int)(rec->timestamp_ms % 1000), 
+               rec->slave_addr, rec->status);
+        return;
+    }
+    printf("%s.%03d addr=%d U=%.1f/%.1f/%.1f I=%.2f/%.2f/%.2f F=%.2f P=%.1f/%.1f/%.1f\n",
+           when, (int)(rec->timestamp_ms % 1000), rec->slave_addr,
+           pzem_shm_reg16(rec, 0) / 10.0, pzem_shm_reg16(rec, 1) / 10.0, pzem_shm_reg16(rec, 2) / 10.0,
+           pzem_shm_reg16(rec, 3) / 100.0, pzem_shm_reg16(rec, 4) / 100.0, pzem_shm_reg16(rec, 5) / 100.0,
+           pzem_shm_reg16(rec, 6) / 100.0,
+           pzem_shm_reg32(rec, 14) / 10.0, pzem_shm_reg32(rec, 16) / 10.0, pzem_shm_reg32(rec, 18) / 10.0);
+}
+
+int main(int argc, char *argv[]) {
+    const char *config = (argc > 1) ? argv[1] : "default";
+    char name[96];
+    snprintf(name, sizeof(name), PZEM_SHM_NAME, config);
+    
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        perror("shm_open");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(pzem_shm_header_t)) {
+        fprintf(stderr, "Shared memory %s is not initialized\n", name);
+        return 1;
+    }
+    const pzem_shm_header_t *hdr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (hdr->magic != PZEM_SHM_MAGIC || hdr->version != PZEM_SHM_VERSION ||
+        hdr->record_size != sizeof(pzem_shm_record_t)) {
+        fprintf(stderr, "Shared memory %s has unknown format\n", name);
+        return 1;
+    }
+    
+    int64_t created = hdr->created_ms;
+    uint64_t next = pzem_shm_write_index(hdr);
+    printf("Reading %s: %u records, %llu written so far\n", name, hdr->capacity, (unsigned long long)next);
+    
+    // Чтение без системных вызовов; пауза только когда новых данных нет
+    for (;;) {
+        if (hdr->created_ms != created) {
+            fprintf(stderr, "Daemon restarted, reopen the segment\n");
+            return 2;
+        }
+    
+        uint64_t head = pzem_shm_write_index(hdr);
+        if (head - next > hdr->capacity) {
+            fprintf(stderr, "Reader too slow, skipped %llu records\n", 
+                    (unsigned long long)(head - next - hdr->capacity));
+            next = head - hdr->capacity;
+        }
+    
+        while (next < head) {
+            pzem_shm_record_t rec;
+            pzem_shm_status_t rc = pzem_shm_read(hdr, next, &rec);
+            if (rc == PZEM_SHM_NOT_YET) break;
+            if (rc == PZEM_SHM_OK) print_record(&rec);
+            next++;
+        }
+        fflush(stdout);
+        usleep(50000);
+    }
+}
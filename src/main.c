@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Точка входа демона: инициализация, цикл опроса по дедлайнам и остановка.
+// Вынесена отдельно, чтобы бенчмарки и инструменты линковались со всеми модулями демона.
+
+#include "pzem_monitor.h"
+
+int main(int argc, char *argv[]) {
+    const char *config_file = (argc > 1) ? argv[1] : "/etc/pzem3/default.conf";
+    
+    if (initialize_system(config_file) != PZEM_SUCCESS) {
+        closelog();
+        return 1;
+    }
+    
+    // Логируем информацию о конфигурации
+    char thresholds[128] = "";
+    if (global_config.voltage_high_alarm > 0) strcat(thresholds, "V");
+    if (global_config.current_high_alarm > 0) strcat(thresholds, "I");
+    if (global_config.frequency_high_alarm > 0) strcat(thresholds, "Z");
+    if (global_config.angleV_high_alarm > 0) strcat(thresholds, "Av");
+    if (global_config.angleI_high_alarm > 0) strcat(thresholds, "Ai");
+    
+    char addrs[PZEM_MAX_DEVICES * 4 + 1] = "";
+    for (int i = 0; i < global_config.slave_count; i++) {
+        size_t len = strlen(addrs);
+        snprintf(addrs + len, sizeof(addrs) - len, "%s%d", i ? "," : "", global_config.slave_addrs[i]);
+    }
+    
+    if (device_type == 'U') {
+        syslog(LOG_INFO, "Config: UART %s@%d, addr=%s, interval=%dms, thresholds=%s", 
+               global_config.tty_port, global_config.baudrate, addrs, 
+               global_config.poll_interval_ms, thresholds);
+    } else {
+        syslog(LOG_INFO, "Config: TCP %s:%d, addr=%s, interval=%dms, thresholds=%s", 
+               global_config.tty_port, global_config.baudrate, addrs, 
+               global_config.poll_interval_ms, thresholds);
+    }
+    
+    if (global_config.reg_group_count > 1) {
+        for (int g = 0; g < global_config.reg_group_count; g++) {
+            const pzem_reg_group_t *group = &global_config.reg_groups[g];
+            syslog(LOG_INFO, "Register group %d-%d every %dms", group->start, 
+                   group->start + group->count - 1, group->every * global_config.poll_interval_ms);
+        }
+    }
+    
+    syslog(LOG_INFO, "Monitoring started for config: %s (%d devices)", config_name, device_count);
+    
+    while (keep_running) {
+        // Ждем дедлайн следующего периода; сигнал будит сразу
+        int missed = scheduler_wait(&scheduler);
+        if (dump_metrics) {
+            dump_metrics = 0;
+            print_metrics(&metrics);
+        }
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config();
+        }
+        if (missed == SCHEDULER_RETRY) {
+            retry_cycle();
+            continue;
+        }
+        if (missed < 0) {
+            continue;
+        }
+        metrics.missed_deadlines += missed;
+        
+        // Пока соединения нет, период только проверяет срок следующей попытки
+        if (link_poll(&bus_link)) {
+            link_cycle_done(&bus_link, poll_cycle());
+        }
+    }
+    
+    syslog(LOG_INFO, "Monitoring stopped for config: %s", config_name);
+    cleanup();
+    log_writer_free(&log_writer);
+    for (int i = 0; i < device_count; i++) {
+        pubsub_close(&devices[i].pubsub);
+        history_free(&devices[i].history);
+    }
+    http_close(&http_server);
+    pzem_shm_close(&shm_ring);
+    scheduler_close(&scheduler);
+    closelog();
+    
+    return 0;
+}
@@ -0,0 +1,353 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Таблица каналов PZEM-6L24, пороги и определение изменений в единицах регистров
+
+#include "pzem_monitor.h"
+
+// Значения порогов, отличающиеся от целого в единицах регистра меньше этого, считаются целыми
+#define RAW_ROUND_EPS 1e-3
+
+const pzem_channel_t pzem_channels[PZEM_CHANNEL_COUNT] = {
+    {"voltage_A",   0,  0, 10,  1, PZEM_GROUP_VOLTAGE},
+    {"voltage_B",   1,  0, 10,  1, PZEM_GROUP_VOLTAGE},
+    {"voltage_C",   2,  0, 10,  1, PZEM_GROUP_VOLTAGE},
+    {"current_A",   3,  0, 100, 2, PZEM_GROUP_CURRENT},
+    {"current_B",   4,  0, 100, 2, PZEM_GROUP_CURRENT},
+    {"current_C",   5,  0, 100, 2, PZEM_GROUP_CURRENT},
+    {"frequency_A", 6,  0, 100, 2, PZEM_GROUP_FREQUENCY},
+    {"frequency_B", 7,  0, 100, 2, PZEM_GROUP_FREQUENCY},
+    {"frequency_C", 8,  0, 100, 2, PZEM_GROUP_FREQUENCY},
+    {"angleV_B",    9,  0, 100, 2, PZEM_GROUP_ANGLEV},
+    {"angleV_C",    10, 0, 100, 2, PZEM_GROUP_ANGLEV},
+    {"angleI_A",    11, 0, 100, 2, PZEM_GROUP_ANGLEI},
+    {"angleI_B",    12, 0, 100, 2, PZEM_GROUP_ANGLEI},
+    {"angleI_C",    13, 0, 100, 2, PZEM_GROUP_ANGLEI},
+    {"power_A",     14, 1, 10,  1, PZEM_GROUP_POWER},
+    {"power_B",     16, 1, 10,  1, PZEM_GROUP_POWER},
+    {"power_C",     18, 1, 10,  1, PZEM_GROUP_POWER}
+};
+
+pzem_channel_limits_t channel_limits[PZEM_CHANNEL_COUNT];
+
+// Значение канала в единицах регистра
+uint32_t pzem_channel_raw(const pzem_sample_t *sample, int channel) {
+    const pzem_channel_t *ch = &pzem_channels[channel];
+    
+    if (ch->wide) {
+        // Мощность: два 16-битных регистра в одно 32-битное значение
+        return ((uint32_t)sample->regs[ch->reg + 1] << 16) | sample->regs[ch->reg];
+    }
+    uint16_t reg = sample->regs[ch->reg];
+    return (uint32_t)(((reg & 0xFF) << 8) | (reg >> 8));
+}
+
+// Обратное преобразование: значение в единицах регистра в регистры измерения
+void pzem_channel_set_raw(pzem_sample_t *sample, int channel, uint32_t raw) {
+    const pzem_channel_t *ch = &pzem_channels[channel];
+    
+    if (ch->wide) {
+        sample->regs[ch->reg] = (uint16_t)(raw & 0xFFFF);
+        sample->regs[ch->reg + 1] = (uint16_t)(raw >> 16);
+    } else {
+        sample->regs[ch->reg] = (uint16_t)(((raw & 0xFF) << 8) | ((raw >> 8) & 0xFF));
+    }
+}
+
+// Значение канала в физических единицах
+float pzem_channel_value(const pzem_sample_t *sample, int channel) {
+    return (float)pzem_channel_raw(sample, channel) / (float)pzem_channels[channel].scale;
+}
+
+// Перевод порога в единицы регистра: round_up - для сравнений ">=" и "<"
+static int32_t threshold_to_raw(float value, int scale, int round_up) {
+    double raw = (double)value * scale;
+    double nearest = nearbyint(raw);
+    
+    if (fabs(raw - nearest) < RAW_ROUND_EPS) {
+        return (int32_t)nearest;
+    }
+    return (int32_t)(round_up ? ceil(raw) : floor(raw));
+}
+
+// Валидация порогов (общая с pzem3-reaggregate)
+pzem_result_t validate_thresholds(const pzem_config_t *config) {
+    const struct {
+        float high_alarm, high_warning, low_warning, low_alarm;
+        const char *name;
+    } thresholds[] = {
+        {config->voltage_high_alarm, config->voltage_high_warning, 
+         config->voltage_low_warning, config->voltage_low_alarm, "voltage"},
+        {config->current_high_alarm, config->current_high_warning,
+         config->current_low_warning, config->current_low_alarm, "current"},
+        {config->frequency_high_alarm, config->frequency_high_warning,
+         config->frequency_low_warning, config->frequency_low_alarm, "frequency"},
+        {config->angleV_high_alarm, config->angleV_high_warning,
+         config->angleV_low_warning, config->angleV_low_alarm, "angleV"},
+        {config->angleI_high_alarm, config->angleI_high_warning,
+         config->angleI_low_warning, config->angleI_low_alarm, "angleI"}
+    };
+    
+    for (size_t i = 0; i < sizeof(thresholds)/sizeof(thresholds[0]); i++) {
+        if (thresholds[i].high_alarm > 0) {
+            if (thresholds[i].high_alarm <= thresholds[i].high_warning ||
+                thresholds[i].high_warning <= thresholds[i].low_warning ||
+                thresholds[i].low_warning <= thresholds[i].low_alarm) {
+                syslog(LOG_ERR, "Invalid %s thresholds order", thresholds[i].name);
+                return PZEM_ERROR_CONFIG;
+            }
+        }
+    }
+    return PZEM_SUCCESS;
+}
+
+// Перевод чувствительности и порогов из конфигурации в единицы регистра
+void build_channel_limits(const pzem_config_t *config, pzem_channel_limits_t *limits) {
+    if (!config || !limits) return;
+    
+    const float sensitivity[] = {
+        config->voltage_sensitivity,
+        config->current_sensitivity,
+        config->frequency_sensitivity,
+        config->angleV_sensitivity,
+        config->angleI_sensitivity,
+        config->power_sensitivity
+    };
+    // high_alarm, high_warning, low_warning, low_alarm
+    const float thresholds[][4] = {
+        {config->voltage_high_alarm, config->voltage_high_warning,
+         config->voltage_low_warning, config->voltage_low_alarm},
+        {config->current_high_alarm, config->current_high_warning,
+         config->current_low_warning, config->current_low_alarm},
+        {config->frequency_high_alarm, config->frequency_high_warning,
+         config->frequency_low_warning, config->frequency_low_alarm},
+        {config->angleV_high_alarm, config->angleV_high_warning,
+         config->angleV_low_warning, config->angleV_low_alarm},
+        {config->angleI_high_alarm, config->angleI_high_warning,
+         config->angleI_low_warning, config->angleI_low_alarm}
+    };
+    
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        const pzem_channel_t *ch = &pzem_channels[i];
+        pzem_channel_limits_t *lim = &limits[i];
+        memset(lim, 0, sizeof(*lim));
+        
+        // |a - b| > s  <=>  |raw_a - raw_b| > floor(s * scale)
+        float sens = sensitivity[ch->group];
+        lim->deadband = sens > 0 ? threshold_to_raw(sens, ch->scale, 0) : 0;
+        
+        if (ch->group == PZEM_GROUP_POWER) continue;
+        
+        const float *t = thresholds[ch->group];
+        lim->enabled = t[0] > 0;
+        if (lim->enabled) {
+            lim->high_alarm = threshold_to_raw(t[0], ch->scale, 1);
+            lim->high_warning = threshold_to_raw(t[1], ch->scale, 0);
+            lim->low_warning = threshold_to_raw(t[2], ch->scale, 1);
+            lim->low_alarm = threshold_to_raw(t[3], ch->scale, 0);
+            
+            // Зона у порогов предупреждения для адаптивного опроса
+            int32_t margin = (int32_t)(((long long)lim->high_warning - lim->low_warning) *
+                                       config->poll_adaptive_margin / 100);
+            lim->near_high = lim->high_warning - margin;
+            lim->near_low = lim->low_warning + margin;
+        }
+    }
+}
+
+// Вспомогательная функция для обработки одного параметра
+void update_threshold_state(int32_t value, char *state, const pzem_channel_limits_t *limits) {
+    if (!state || !limits) return;
+    
+    if (limits->enabled) {
+        if (value >= limits->high_alarm) {
+            *state = 'H';
+        } else if (value <= limits->low_alarm) {
+            *state = 'L';
+        } else if (*state == 'H' && value > limits->high_warning) {
+            *state = 'H';
+        } else if (*state == 'L' && value < limits->low_warning) {
+            *state = 'L';
+        } else {
+            *state = 'N';
+        }
+    } else {
+        *state = 'N';
+    }
+}
+
+void update_threshold_states(pzem_data_t *data, const pzem_channel_limits_t *limits) {
+    if (!data || !limits) return;
+    
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        update_threshold_state((int32_t)pzem_channel_raw(&data->sample, i), &data->state[i], &limits[i]);
+    }
+}
+
+// Функция проверки изменения состояний порогов
+int threshold_states_changed(const pzem_data_t *current, const pzem_data_t *previous) {
+    if (!current || !previous) return 1;
+    
+    return memcmp(current->state, previous->state, sizeof(current->state)) != 0;
+}
+
+// Значение хотя бы одного канала у порогов предупреждения или за ними
+int near_thresholds(const pzem_data_t *data, const pzem_channel_limits_t *limits) {
+    if (!data || !limits || data->status != 0) return 0;
+    
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        if (!limits[i].enabled) continue;
+        int32_t value = (int32_t)pzem_channel_raw(&data->sample, i);
+        if (value >= limits[i].near_high || value <= limits[i].near_low) return 1;
+    }
+    
+    return 0;
+}
+
+// Функция для сравнения значений с учетом чувствительности
+int values_changed(const pzem_data_t *current, const pzem_data_t *previous, const pzem_channel_limits_t *limits) {
+    if (!current || !previous || !limits) return 1;
+    
+    if (previous->first_read || current->status != previous->status) return 1;
+    
+    // Регистры не изменились - дальше можно не смотреть
+    if (memcmp(current->sample.regs, previous->sample.regs, sizeof(current->sample.regs)) == 0) return 0;
+    
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        long long diff = (long long)pzem_channel_raw(&current->sample, i) -
+                         (long long)pzem_channel_raw(&previous->sample, i);
+        if (llabs(diff) > limits[i].deadband) return 1;
+    }
+    
+    return 0;
+}
+
+// Биты всех каналов в pzem_data_t.omit
+#define SDT_ALL_CHANNELS ((1u << PZEM_CHANNEL_COUNT) - 1)
+
+// Новый отрезок канала от записанной точки (t, v)
+static void sdt_channel_start(pzem_sdt_channel_t *c, long long t, int32_t v) {
+    c->t0 = t;
+    c->v0 = v;
+    c->slope_min = -INFINITY;
+    c->slope_max = INFINITY;
+}
+
+// Строка лога из измерения, в ней только каналы из mask
+static void sdt_row(pzem_data_t *row, const pzem_data_t *data, uint32_t mask) {
+    *row = *data;
+    row->omit = SDT_ALL_CHANNELS & ~mask;
+}
+
+// Каналы, чей отрезок кончается незаписанным предыдущим измерением
+static uint32_t sdt_pending(const pzem_sdt_t *sdt) {
+    uint32_t pending = 0;
+    if (!sdt->primed || sdt->last.status != 0) return 0;
+    
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (sdt->ch[i].t0 != sdt->last.sample.timestamp_ms) pending |= 1u << i;
+    }
+    return pending;
+}
+
+// Незаписанные концы отрезков перед сбросом состояния (остановка, переподключение,
+// смена режима лога), иначе теряется до log_max_silence_s данных. Следующее измерение
+// снова запишется целиком и начнет отрезки всех каналов.
+// Возвращает число строк в row (0-1)
+int sdt_flush(pzem_sdt_t *sdt, pzem_data_t *row) {
+    if (!sdt || !row) return 0;
+    
+    uint32_t pending = sdt_pending(sdt);
+    if (pending) sdt_row(row, &sdt->last, pending);
+    sdt->primed = 0;
+    return pending != 0;
+}
+
+// Swinging door по каналам. Отрезок канала от последней записанной точки продолжается, пока
+// прямая до нового значения проходит не дальше deadband от всех измерений между ними.
+// Иначе записывается предыдущее измерение - дальний конец отрезка, для которого это еще верно,
+// поэтому линейная интерполяция между записанными точками отличается от каждого
+// измерения не больше чем на *_sensitivity. Смена статуса или состояния порога
+// закрывает все отрезки и пишет измерение целиком.
+// Возвращает число строк в rows (0-2), по возрастанию времени
+int sdt_update(pzem_sdt_t *sdt, const pzem_data_t *current, const pzem_channel_limits_t *limits,
+               long long max_silence_ms, pzem_data_t rows[2]) {
+    if (!sdt || !current || !limits || !rows) return 0;
+    
+    const pzem_data_t *last = &sdt->last;
+    long long t = current->sample.timestamp_ms;
+    long long t_last = last->sample.timestamp_ms;
+    int count = 0;
+    
+    if (!sdt->primed || current->status != last->status || t <= t_last ||
+        memcmp(current->state, last->state, sizeof(current->state)) != 0) {
+        // Незаписанные концы отрезков - предыдущее измерение
+        uint32_t pending = sdt_pending(sdt);
+        if (pending) sdt_row(&rows[count++], last, pending);
+        sdt_row(&rows[count++], current, SDT_ALL_CHANNELS);
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            sdt_channel_start(&sdt->ch[i], t, (int32_t)pzem_channel_raw(&current->sample, i));
+        }
+        sdt->primed = 1;
+        sdt->last = *current;
+        return count;
+    }
+    
+    // Ошибка чтения с тем же статусом - писать нечего
+    if (current->status != 0) {
+        sdt->last = *current;
+        return 0;
+    }
+    
+    uint32_t at_last = 0;
+    uint32_t at_current = 0;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        pzem_sdt_channel_t *c = &sdt->ch[i];
+        double v = (double)pzem_channel_raw(&current->sample, i);
+        
+        double slope = (v - c->v0) / (double)(t - c->t0);
+        if (slope < c->slope_min || slope > c->slope_max) {
+            // Дверь открылась: отрезок кончается предыдущим измерением
+            at_last |= 1u << i;
+            sdt_channel_start(c, t_last, (int32_t)pzem_channel_raw(&last->sample, i));
+        }
+        
+        double dt = (double)(t - c->t0);
+        double lo = (v - limits[i].deadband - c->v0) / dt;
+        double hi = (v + limits[i].deadband - c->v0) / dt;
+        if (lo > c->slope_min) c->slope_min = lo;
+        if (hi < c->slope_max) c->slope_max = hi;
+        
+        // Канал давно не писался - точка пульса
+        if (max_silence_ms > 0 && t - c->t0 >= max_silence_ms) {
+            at_current |= 1u << i;
+            sdt_channel_start(c, t, (int32_t)v);
+        }
+    }
+    
+    if (at_last) sdt_row(&rows[count++], last, at_last);
+    if (at_current) sdt_row(&rows[count++], current, at_current);
+    sdt->last = *current;
+    return count;
+}
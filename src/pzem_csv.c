@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Разбор строки CSV лога обратно в сырые регистры измерения.
+// Общий для инструментов и бенчмарков: значения читаются как фиксированная точка,
+// без strtod, поэтому повторная запись дает ту же строку.
+
+#include "pzem_monitor.h"
+
+// Число "123.45" в единицах 10^-decimals; лишние знаки дроби отбрасываются
+static const char *parse_fixed(const char *p, int decimals, uint32_t *out) {
+    uint32_t value = 0;
+    const char *start = p;
+    
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (uint32_t)(*p++ - '0');
+    }
+    if (p == start) return NULL;
+    
+    int frac = 0;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') {
+            if (frac < decimals) {
+                value = value * 10 + (uint32_t)(*p - '0');
+                frac++;
+            }
+            p++;
+        }
+    }
+    for (; frac < decimals; frac++) {
+        value *= 10;
+    }
+    
+    *out = value;
+    return p;
+}
+
+static const char *parse_digits(const char *p, int count, int *out) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if (p[i] < '0' || p[i] > '9') return NULL;
+        value = value * 10 + (p[i] - '0');
+    }
+    *out = value;
+    return p + count;
+}
+
+// Метка времени "YYYY-MM-DD,HH:MM:SS" по местному времени.
+// mktime дорогой, поэтому он вызывается один раз на час, остальное - сложением.
+// Кэш свой у каждого потока: pzem3-query разбирает дни параллельно
+static const char *parse_datetime(const char *p, long long *timestamp_ms) {
+    static __thread char cached_hour[14];
+    static __thread time_t cached_base = (time_t)-1;
+    
+    int year, mon, day, hour, min, sec;
+    const char *q = p;
+    if (!(q = parse_digits(q, 4, &year)) || *q++ != '-' ||
+        !(q = parse_digits(q, 2, &mon)) || *q++ != '-' ||
+        !(q = parse_digits(q, 2, &day)) || *q++ != ',' ||
+        !(q = parse_digits(q, 2, &hour)) || *q++ != ':' ||
+        !(q = parse_digits(q, 2, &min)) || *q++ != ':' ||
+        !(q = parse_digits(q, 2, &sec))) {
+        return NULL;
+    }
+    
+    // "YYYY-MM-DD,HH" - ключ кэша
+    if (cached_base == (time_t)-1 || memcmp(cached_hour, p, sizeof(cached_hour) - 1) != 0) {
+        struct tm tm_info = {
+            .tm_year = year - 1900,
+            .tm_mon = mon - 1,
+            .tm_mday = day,
+            .tm_hour = hour,
+            .tm_isdst = -1
+        };
+        cached_base = mktime(&tm_info);
+        memcpy(cached_hour, p, sizeof(cached_hour) - 1);
+    }
+    
+    *timestamp_ms = ((long long)cached_base + min * 60 + sec) * 1000LL;
+    return q;
+}
+
+// Строка лога в измерение. Возвращает 0 или -1, если строка не в формате лога
+int parse_csv_entry(const char *line, pzem_data_t *data) {
+    if (!line || !data) return -1;
+    
+    memset(data, 0, sizeof(*data));
+    const char *p = parse_datetime(line, &data->sample.timestamp_ms);
+    if (p == NULL || *p++ != ',') return -1;
+    
+    // Строка ошибки чтения: значения "-", только статус в конце
+    if (*p == '-') {
+        const char *last = strrchr(p, ',');
+        if (last == NULL) return -1;
+        data->status = atoi(last + 1);
+        memset(data->state, '-', sizeof(data->state));
+        return data->status != 0 ? 0 : -1;
+    }
+    
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        // Пустое значение - канал пропущен в режиме SDT
+        if (*p == ',') {
+            data->omit |= 1u << i;
+            p++;
+        } else {
+            uint32_t raw;
+            p = parse_fixed(p, pzem_channels[i].decimals, &raw);
+            if (p == NULL || *p++ != ',') return -1;
+            pzem_channel_set_raw(&data->sample, i, raw);
+        }
+    
+        if (i < PZEM_STATE_COUNT) {
+            if (*p == '\0' || p[1] != ',') return -1;
+            data->state[i] = *p;
+            p += 2;
+        }
+    }
+    
+    int status;
+    if (*p < '0' || *p > '9') return -1;
+    status = atoi(p);
+    data->status = status;
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Форматирование измерений: CSV, компактный JSON, бинарная запись и строки сводок.
+// Текст собирается напрямую из целых значений регистров, без snprintf по float.
+// Кэш кодирования сериализует каждый формат не больше одного раза на измерение.
+
+#include "pzem_monitor.h"
+
+// Мощность до этого значения (x0.1 Вт) float хранит точно до десятых,
+// выше - повторяем округление float для побайтовой совместимости со старым форматом
+#define POWER_EXACT_LIMIT 2621440u
+
+// Пустая строка при ошибке чтения: 31 поле данных
+static const char error_fields[] = "-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,";
+
+// Запись беззнакового числа, возвращает указатель за последней цифрой
+static char *put_uint(char *p, uint32_t value) {
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static char *put_u64(char *p, uint64_t value) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static uint8_t *put_le16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    return p + 2;
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+    return p + 8;
+}
+
+// Число с фиксированной точкой: value в единицах 10^-decimals
+static char *put_fixed(char *p, uint32_t value, int decimals) {
+    if (decimals == 1) {
+        p = put_uint(p, value / 10);
+        *p++ = '.';
+        *p++ = (char)('0' + value % 10);
+    } else {
+        p = put_uint(p, value / 100);
+        *p++ = '.';
+        *p++ = (char)('0' + (value / 10) % 10);
+        *p++ = (char)('0' + value % 10);
+    }
+    return p;
+}
+
+// Мощность x0.1 с тем же результатом, что и "%.1f" от float
+static char *put_power(char *p, uint32_t value) {
+    if (value < POWER_EXACT_LIMIT) {
+        return put_fixed(p, value, 1);
+    }
+    return p + sprintf(p, "%.1f", (float)value / 10.0f);
+}
+
+// Дата и время "YYYY-MM-DD,HH:MM:SS" с кэшем на текущую секунду (свой у каждого потока)
+static size_t format_datetime(char *out, time_t t) {
+    static __thread time_t cached_time = (time_t)-1;
+    static __thread char cached[24];
+    static __thread size_t cached_len;
+    
+    if (t != cached_time) {
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        cached_len = strftime(cached, sizeof(cached), "%Y-%m-%d,%H:%M:%S", &tm_info);
+        cached_time = t;
+    }
+    memcpy(out, cached, cached_len);
+    return cached_len;
+}
+
+// Строка CSV лога из сырых регистров, возвращает длину без '\0'
+size_t format_csv_entry(char *out, size_t size, const pzem_data_t *data, time_t t) {
+    if (!out || !data || size < LOG_ENTRY_SIZE) return 0;
+    
+    char *p = out;
+    p += format_datetime(p, t);
+    *p++ = ',';
+    
+    if (data->status == 0) {
+        // Каналы с порогами: значение и состояние. Пропущенный SDT канал - пустое значение
+        for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+            if (!(data->omit & (1u << i))) {
+                p = put_fixed(p, pzem_channel_raw(&data->sample, i), pzem_channels[i].decimals);
+            }
+            *p++ = ',';
+            *p++ = data->state[i];
+            *p++ = ',';
+        }
+    
+        for (int i = PZEM_CH_POWER_A; i <= PZEM_CH_POWER_C; i++) {
+            if (!(data->omit & (1u << i))) {
+                p = put_power(p, pzem_channel_raw(&data->sample, i));
+            }
+            *p++ = ',';
+        }
+    } else {
+        memcpy(p, error_fields, sizeof(error_fields) - 1);
+        p += sizeof(error_fields) - 1;
+    }
+    
+    if (data->status >= 0 && data->status < 10) {
+        *p++ = (char)('0' + data->status);
+    } else {
+        p += sprintf(p, "%d", data->status);
+    }
+    *p++ = '\n';
+    *p = '\0';
+    
+    return (size_t)(p - out);
+}
+
+// Значение канала текстом с фиксированным числом знаков, возвращает длину
+size_t format_channel_value(char *out, const pzem_sample_t *sample, int channel) {
+    uint32_t raw = pzem_channel_raw(sample, channel);
+    char *p = pzem_channels[channel].wide ? put_power(out, raw) : put_fixed(out, raw, pzem_channels[channel].decimals);
+    return (size_t)(p - out);
+}
+
+// Компактный JSON одной строкой: значения каналов в порядке CSV
+size_t format_json_entry(char *out, size_t size, const pzem_data_t *data, int slave_addr) {
+    if (!out || !data || size < LOG_ENTRY_SIZE) return 0;
+    
+    char *p = out;
+    memcpy(p, "{\"t\":", 5);
+    p = put_u64(p + 5, (uint64_t)data->sample.timestamp_ms);
+    memcpy(p, ",\"addr\":", 8);
+    p = put_uint(p + 8, (uint32_t)slave_addr);
+    memcpy(p, ",\"status\":", 10);
+    p = put_uint(p + 10, (uint32_t)data->status);
+    
+    if (data->status == 0) {
+        memcpy(p, ",\"v\":[", 6);
+        p += 6;
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            if (i) *p++ = ',';
+            if (data->omit & (1u << i)) {
+                memcpy(p, "null", 4);
+                p += 4;
+            } else {
+                p += format_channel_value(p, &data->sample, i);
+            }
+        }
+        memcpy(p, "],\"st\":\"", 8);
+        p += 8;
+        memcpy(p, data->state, PZEM_STATE_COUNT);
+        p += PZEM_STATE_COUNT;
+        *p++ = '"';
+    }
+    *p++ = '}';
+    *p++ = '\n';
+    *p = '\0';
+    
+    return (size_t)(p - out);
+}
+
+// Бинарная запись фиксированного размера (формат в pzem_wire.h), всегда со всеми каналами
+size_t format_binary_entry(char *out, size_t size, const pzem_data_t *data, int slave_addr) {
+    if (!out || !data || size < PZEM_WIRE_RECORD_SIZE) return 0;
+    
+    uint8_t *p = (uint8_t *)out;
+    p = put_le16(p, PZEM_WIRE_MAGIC);
+    *p++ = PZEM_WIRE_VERSION;
+    *p++ = (uint8_t)slave_addr;
+    p = put_le64(p, (uint64_t)data->sample.timestamp_ms);
+    *p++ = (uint8_t)data->status;
+    memcpy(p, data->state, PZEM_WIRE_STATE_COUNT);
+    p += PZEM_WIRE_STATE_COUNT;
+    *p++ = 0;
+    for (int i = 0; i < PZEM_WIRE_REG_COUNT; i++) {
+        p = put_le16(p, data->sample.regs[i]);
+    }
+    
+    return (size_t)(p - (uint8_t *)out);
+}
+
+// Строка сводки: начало окна, длина окна в секундах, удачных измерений, ошибок,
+// min,avg,max каждого канала (пусто, если удачных не было) и N,H,L секунд каждого порога
+size_t format_rollup_entry(char *out, size_t size, const pzem_rollup_window_t *w, int period_s) {
+    if (!out || !w || size < ROLLUP_ENTRY_SIZE) return 0;
+    
+    char *p = out;
+    p += format_datetime(p, (time_t)(w->start_ms / 1000));
+    *p++ = ',';
+    p = put_uint(p, (uint32_t)period_s);
+    *p++ = ',';
+    p = put_uint(p, w->samples);
+    *p++ = ',';
+    p = put_uint(p, w->errors);
+    
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (w->samples == 0) {
+            memcpy(p, ",,,", 3);
+            p += 3;
+            continue;
+        }
+        uint32_t avg = (uint32_t)((w->sum[i] + w->samples / 2) / w->samples);
+        const uint32_t values[3] = {w->min[i], avg, w->max[i]};
+        for (int k = 0; k < 3; k++) {
+            *p++ = ',';
+            p = pzem_channels[i].wide ? put_power(p, values[k]) : put_fixed(p, values[k], pzem_channels[i].decimals);
+        }
+    }
+    
+    // Время в состояниях с точностью 0.1 с
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        for (int k = 0; k < 3; k++) {
+            *p++ = ',';
+            p = put_fixed(p, (w->state_ms[i][k] + 50) / 100, 1);
+        }
+    }
+    *p++ = '\n';
+    *p = '\0';
+    
+    return (size_t)(p - out);
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Обратно из бинарной записи в измерение. 0 или -1, если это не запись
+int parse_binary_entry(const char *in, size_t len, pzem_data_t *data, int *slave_addr) {
+    if (!in || !data || len < PZEM_WIRE_RECORD_SIZE) return -1;
+    
+    const uint8_t *p = (const uint8_t *)in;
+    if (get_le16(p) != PZEM_WIRE_MAGIC || p[2] != PZEM_WIRE_VERSION) return -1;
+    
+    memset(data, 0, sizeof(*data));
+    if (slave_addr) *slave_addr = p[3];
+    uint64_t t = 0;
+    for (int i = 7; i >= 0; i--) {
+        t = (t << 8) | p[4 + i];
+    }
+    data->sample.timestamp_ms = (long long)t;
+    data->status = p[12];
+    memcpy(data->state, p + 13, PZEM_WIRE_STATE_COUNT);
+    p += 13 + PZEM_WIRE_STATE_COUNT + 1;
+    for (int i = 0; i < PZEM_WIRE_REG_COUNT; i++) {
+        data->sample.regs[i] = get_le16(p + 2 * i);
+    }
+    return 0;
+}
+
+// Разбор имени формата из конфигурации, -1 если неизвестен
+int parse_output_format(const char *value) {
+    if (!value) return -1;
+    if (strncmp(value, "csv", 3) == 0) return PZEM_FORMAT_CSV;
+    if (strncmp(value, "binary", 6) == 0) return PZEM_FORMAT_BINARY;
+    if (strncmp(value, "json", 4) == 0) return PZEM_FORMAT_JSON;
+    if (strncmp(value, "compressed", 10) == 0) return PZEM_FORMAT_COMPRESSED;
+    return -1;
+}
+
+// Расширение лог-файла для формата
+const char *output_format_ext(pzem_format_t format) {
+    switch (format) {
+        case PZEM_FORMAT_BINARY: return "bin";
+        case PZEM_FORMAT_JSON: return "jsonl";
+        case PZEM_FORMAT_COMPRESSED: return "pzb";
+        default: return "log";
+    }
+}
+
+// Новое измерение: прежние закодированные варианты недействительны
+void encode_cache_init(pzem_encode_cache_t *cache, const pzem_data_t *data, int slave_addr) {
+    if (!cache) return;
+    
+    cache->data = data;
+    cache->slave_addr = slave_addr;
+    cache->ready = 0;
+}
+
+// Измерение в нужном формате, кодируется при первом запросе
+const char *encode_cache_get(pzem_encode_cache_t *cache, pzem_format_t format, size_t *len) {
+    // Сжатые блоки собирает поток записи, ему передается бинарная запись
+    if (format == PZEM_FORMAT_COMPRESSED) {
+        format = PZEM_FORMAT_BINARY;
+    }
+    if (!cache || !cache->data || format < 0 || format >= PZEM_FORMAT_COUNT) return NULL;
+    
+    unsigned int bit = 1u << format;
+    if (!(cache->ready & bit)) {
+        char *buf = cache->buf[format];
+        switch (format) {
+            case PZEM_FORMAT_BINARY:
+                cache->len[format] = format_binary_entry(buf, LOG_ENTRY_SIZE, cache->data, cache->slave_addr);
+                break;
+            case PZEM_FORMAT_JSON:
+                cache->len[format] = format_json_entry(buf, LOG_ENTRY_SIZE, cache->data, cache->slave_addr);
+                break;
+            default:
+                cache->len[format] = prepare_log_entry(buf, LOG_ENTRY_SIZE, cache->data);
+                break;
+        }
+        cache->ready |= bit;
+    }
+    
+    if (len) *len = cache->len[format];
+    return cache->buf[format];
+}
+
+// Функция подготовки строки лога с датой и временем чтения
+size_t prepare_log_entry(char *log_entry, size_t size, const pzem_data_t *data) {
+    if (!log_entry || !data || size == 0) return 0;
+    
+    return format_csv_entry(log_entry, size, data, (time_t)(data->sample.timestamp_ms / 1000));
+}
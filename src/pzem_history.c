@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// История измерений в памяти: кольцо записанных в лог измерений каждого устройства.
+// Используется HTTP сервером для выдачи диапазонов без чтения лог-файлов с диска.
+
+#include "pzem_monitor.h"
+
+pzem_result_t history_init(pzem_history_t *hist, int capacity) {
+    if (!hist || capacity < 0) return PZEM_ERROR_INVALID_PARAM;
+    
+    memset(hist, 0, sizeof(*hist));
+    if (capacity == 0) return PZEM_SUCCESS;
+    
+    hist->entries = malloc((size_t)capacity * sizeof(pzem_history_entry_t));
+    if (hist->entries == NULL) {
+        syslog(LOG_ERR, "Memory allocation failed for sample history");
+        return PZEM_ERROR_MEMORY;
+    }
+    hist->capacity = (unsigned int)capacity;
+    return PZEM_SUCCESS;
+}
+
+void history_free(pzem_history_t *hist) {
+    if (!hist) return;
+    
+    free(hist->entries);
+    memset(hist, 0, sizeof(*hist));
+}
+
+// Добавление измерения, самое старое вытесняется
+void history_add(pzem_history_t *hist, const pzem_data_t *data) {
+    if (!hist || !hist->entries || !data) return;
+    
+    pzem_history_entry_t *entry = &hist->entries[hist->head];
+    entry->sample = data->sample;
+    memcpy(entry->state, data->state, sizeof(entry->state));
+    entry->status = (uint8_t)data->status;
+    
+    hist->head = (hist->head + 1) % hist->capacity;
+    if (hist->count < hist->capacity) {
+        hist->count++;
+    }
+}
+
+// Запись по логическому номеру: 0 - самая старая
+const pzem_history_entry_t *history_at(const pzem_history_t *hist, unsigned int index) {
+    if (!hist || index >= hist->count) return NULL;
+    
+    unsigned int first = (hist->head + hist->capacity - hist->count) % hist->capacity;
+    return &hist->entries[(first + index) % hist->capacity];
+}
+
+// Первая запись с временем не меньше timestamp_ms (двоичный поиск)
+unsigned int history_lower_bound(const pzem_history_t *hist, long long timestamp_ms) {
+    if (!hist) return 0;
+    
+    unsigned int lo = 0;
+    unsigned int hi = hist->count;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (history_at(hist, mid)->sample.timestamp_ms < timestamp_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
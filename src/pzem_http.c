@@ -0,0 +1,634 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Встроенный HTTP сервер без внешних зависимостей.
+//   /            - страница графиков (http_page, читается один раз при запуске)
+//   /live        - поток новых измерений (Server-Sent Events, строки CSV)
+//   /range       - измерения из истории в памяти по столбцам, JSON или binary
+//   /metrics     - метрики в текстовом формате Prometheus
+// Работает на цикле событий планировщика, все сокеты неблокирующие:
+// медленный клиент никогда не задерживает опрос.
+
+#define _GNU_SOURCE
+#include "pzem_monitor.h"
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Столбцы ответа /range: время, статус, каналы, состояния порогов
+#define RANGE_COL_TIME (-2)
+#define RANGE_COL_STATUS (-1)
+#define RANGE_COL_STATE PZEM_CHANNEL_COUNT
+#define RANGE_COL_END (PZEM_CHANNEL_COUNT + 1)
+
+#define RANGE_BINARY_MAGIC "PZC1"
+
+http_server_t http_server = {.listen = {.fd = -1}};
+
+static int http_conn_flush(http_conn_t *conn);
+
+// Буфер ответа
+
+static int out_reserve(http_conn_t *conn, size_t extra) {
+    if (conn->out_len + extra <= conn->out_cap) return 0;
+    
+    size_t cap = conn->out_cap ? conn->out_cap : 4096;
+    while (cap < conn->out_len + extra) {
+        cap *= 2;
+    }
+    char *out = realloc(conn->out, cap);
+    if (out == NULL) return -1;
+    conn->out = out;
+    conn->out_cap = cap;
+    return 0;
+}
+
+static int out_append(http_conn_t *conn, const void *data, size_t len) {
+    if (out_reserve(conn, len) != 0) return -1;
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+    return 0;
+}
+
+int http_printf(http_conn_t *conn, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || out_reserve(conn, (size_t)n + 1) != 0) return -1;
+    
+    va_start(ap, fmt);
+    vsnprintf(conn->out + conn->out_len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    conn->out_len += (size_t)n;
+    return 0;
+}
+
+static void out_le16(http_conn_t *conn, uint16_t value) {
+    uint8_t b[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    out_append(conn, b, sizeof(b));
+}
+
+static void out_le32(http_conn_t *conn, uint32_t value) {
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++) b[i] = (uint8_t)(value >> (8 * i));
+    out_append(conn, b, sizeof(b));
+}
+
+static void out_le64(http_conn_t *conn, uint64_t value) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++) b[i] = (uint8_t)(value >> (8 * i));
+    out_append(conn, b, sizeof(b));
+}
+
+static void http_begin_response(http_conn_t *conn, int code, const char *reason, 
+                                const char *content_type, long long content_length) {
+    http_printf(conn, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nCache-Control: no-cache\r\n"
+               "Access-Control-Allow-Origin: *\r\n", code, reason, content_type);
+    if (content_length >= 0) {
+        http_printf(conn, "Content-Length: %lld\r\n", content_length);
+    }
+    http_printf(conn, "Connection: close\r\n\r\n");
+}
+
+static void http_error(http_conn_t *conn, int code, const char *reason) {
+    char body[64];
+    int len = snprintf(body, sizeof(body), "%d %s\n", code, reason);
+    http_begin_response(conn, code, reason, "text/plain", len);
+    out_append(conn, body, (size_t)len);
+}
+
+// Соединения
+
+static void http_conn_close(http_conn_t *conn) {
+    if (conn->watch.fd >= 0) {
+        if (conn->state == HTTP_CONN_STREAMING) {
+            conn->server->streams--;
+        }
+        scheduler_del_watch(conn->server->sched, &conn->watch);
+        close(conn->watch.fd);
+        conn->watch.fd = -1;
+    }
+    free(conn->out);
+    free(conn->range);
+    conn->out = NULL;
+    conn->range = NULL;
+    conn->out_len = conn->out_off = conn->out_cap = 0;
+    conn->produce = NULL;
+}
+
+static void http_conn_update_events(http_conn_t *conn) {
+    uint32_t events = EPOLLIN;
+    if (conn->out_off < conn->out_len) {
+        events |= EPOLLOUT;
+    }
+    if (events != conn->events) {
+        conn->events = events;
+        scheduler_mod_watch(conn->server->sched, &conn->watch, events);
+    }
+}
+
+// Значение параметра запроса, 0 если найден
+static int query_param(const char *query, const char *name, char *out, size_t size) {
+    size_t name_len = strlen(name);
+    const char *p = query;
+    
+    while (p && *p) {
+        if (strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            p += name_len + 1;
+            size_t len = strcspn(p, "&");
+            if (len >= size) len = size - 1;
+            memcpy(out, p, len);
+            out[len] = '\0';
+            return 0;
+        }
+        p = strchr(p, '&');
+        if (p) p++;
+    }
+    return -1;
+}
+
+// Устройство по имени или адресу, по умолчанию первое
+static int find_device(const char *query) {
+    char value[64];
+    if (query_param(query, "dev", value, sizeof(value)) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < device_count; i++) {
+        if (strcmp(devices[i].name, value) == 0 || devices[i].slave_addr == atoi(value)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// /range: столбцы формируются частями, чтобы не держать весь ответ в памяти
+
+static void range_column_name(http_conn_t *conn) {
+    const char *name = conn->range_column == RANGE_COL_TIME ? "t" :
+                       conn->range_column == RANGE_COL_STATUS ? "status" :
+                       conn->range_column == RANGE_COL_STATE ? "state" :
+                       pzem_channels[conn->range_column].name;
+    http_printf(conn, "%s\"%s\":[", conn->range_column == RANGE_COL_TIME ? "" : ",", name);
+}
+
+static void range_json_value(http_conn_t *conn, const pzem_history_entry_t *entry) {
+    char value[32];
+    size_t len;
+    
+    if (conn->range_column == RANGE_COL_TIME) {
+        len = (size_t)snprintf(value, sizeof(value), "%lld", entry->sample.timestamp_ms);
+    } else if (conn->range_column == RANGE_COL_STATUS) {
+        len = (size_t)snprintf(value, sizeof(value), "%d", entry->status);
+    } else if (conn->range_column == RANGE_COL_STATE) {
+        value[0] = '"';
+        memcpy(value + 1, entry->state, PZEM_STATE_COUNT);
+        value[PZEM_STATE_COUNT + 1] = '"';
+        len = PZEM_STATE_COUNT + 2;
+    } else if (entry->status != 0) {
+        memcpy(value, "null", 4);
+        len = 4;
+    } else {
+        len = format_channel_value(value, &entry->sample, conn->range_column);
+    }
+    out_append(conn, value, len);
+}
+
+static void range_binary_value(http_conn_t *conn, const pzem_history_entry_t *entry) {
+    if (conn->range_column == RANGE_COL_TIME) {
+        out_le64(conn, (uint64_t)entry->sample.timestamp_ms);
+    } else if (conn->range_column == RANGE_COL_STATUS) {
+        uint8_t status = entry->status;
+        out_append(conn, &status, 1);
+    } else if (conn->range_column == RANGE_COL_STATE) {
+        out_append(conn, entry->state, PZEM_STATE_COUNT);
+    } else {
+        out_le32(conn, pzem_channel_raw(&entry->sample, conn->range_column));
+    }
+}
+
+static int range_produce(http_conn_t *conn) {
+    int binary = conn->format == PZEM_FORMAT_BINARY;
+    
+    while (conn->out_len < HTTP_CHUNK_SIZE && conn->range_column < RANGE_COL_END) {
+        if (conn->range_pos == 0 && !binary) {
+            range_column_name(conn);
+        }
+    
+        while (conn->range_pos < conn->range_count && conn->out_len < HTTP_CHUNK_SIZE) {
+            const pzem_history_entry_t *entry = &conn->range[conn->range_pos];
+            if (binary) {
+                range_binary_value(conn, entry);
+            } else {
+                if (conn->range_pos) out_append(conn, ",", 1);
+                range_json_value(conn, entry);
+            }
+            conn->range_pos++;
+        }
+    
+        if (conn->range_pos < conn->range_count) break;
+    
+        // Столбец закончен
+        if (!binary) {
+            out_append(conn, "]", 1);
+        } else if (conn->range_column == RANGE_COL_STATUS) {
+            // Выравнивание столбца статусов до 4 байт
+            static const uint8_t pad[3] = {0};
+            out_append(conn, pad, (4 - conn->range_count % 4) % 4);
+        }
+        conn->range_column++;
+        conn->range_pos = 0;
+    }
+    
+    if (conn->range_column >= RANGE_COL_END) {
+        if (!binary) out_append(conn, "}\n", 2);
+        free(conn->range);
+        conn->range = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static void http_handle_range(http_conn_t *conn, const char *query) {
+    int device = find_device(query);
+    if (device < 0) {
+        http_error(conn, 404, "Not Found");
+        return;
+    }
+    
+    char value[32];
+    long long from = 0;
+    long long to = LLONG_MAX;
+    if (query_param(query, "from", value, sizeof(value)) == 0) from = atoll(value);
+    if (query_param(query, "to", value, sizeof(value)) == 0) to = atoll(value);
+    conn->format = PZEM_FORMAT_JSON;
+    if (query_param(query, "format", value, sizeof(value)) == 0 && strcmp(value, "binary") == 0) {
+        conn->format = PZEM_FORMAT_BINARY;
+    }
+    
+    // Копия диапазона: история продолжает пополняться, пока ответ уходит в сокет
+    const pzem_history_t *hist = &devices[device].history;
+    unsigned int begin = history_lower_bound(hist, from);
+    unsigned int end = to == LLONG_MAX ? hist->count : history_lower_bound(hist, to + 1);
+    unsigned int count = end > begin ? end - begin : 0;
+    
+    if (count > 0) {
+        conn->range = malloc((size_t)count * sizeof(pzem_history_entry_t));
+        if (conn->range == NULL) {
+            http_error(conn, 503, "Service Unavailable");
+            return;
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            conn->range[i] = *history_at(hist, begin + i);
+        }
+    }
+    conn->range_count = count;
+    conn->range_pos = 0;
+    conn->range_column = RANGE_COL_TIME;
+    
+    if (conn->format == PZEM_FORMAT_BINARY) {
+        http_begin_response(conn, 200, "OK", "application/octet-stream", -1);
+        out_append(conn, RANGE_BINARY_MAGIC, 4);
+        out_le32(conn, count);
+        out_le32(conn, PZEM_CHANNEL_COUNT);
+        out_le32(conn, PZEM_STATE_COUNT);
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            out_le16(conn, pzem_channels[i].scale);
+        }
+        out_le16(conn, 0);
+    } else {
+        http_begin_response(conn, 200, "OK", "application/json", -1);
+        http_printf(conn, "{\"device\":\"%s\",\"addr\":%d,\"count\":%u,", 
+                   devices[device].name, devices[device].slave_addr, count);
+    }
+    conn->produce = range_produce;
+}
+
+static void http_handle_live(http_conn_t *conn, const char *query) {
+    int device = find_device(query);
+    if (device < 0) {
+        http_error(conn, 404, "Not Found");
+        return;
+    }
+    
+    http_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+               "Access-Control-Allow-Origin: *\r\nConnection: keep-alive\r\n\r\n"
+               ": %s\n\n", devices[device].name);
+    conn->device = device;
+    conn->state = HTTP_CONN_STREAMING;
+    conn->server->streams++;
+}
+
+// Разбор запроса и выбор обработчика
+static void http_dispatch(http_conn_t *conn) {
+    http_server_t *srv = conn->server;
+    char method[8];
+    char target[512];
+    
+    srv->requests++;
+    conn->state = HTTP_CONN_WRITING;
+    
+    if (sscanf(conn->request, "%7s %511s", method, target) != 2) {
+        http_error(conn, 400, "Bad Request");
+        return;
+    }
+    if (strcmp(method, "GET") != 0) {
+        http_error(conn, 405, "Method Not Allowed");
+        return;
+    }
+    
+    char *query = strchr(target, '?');
+    if (query) {
+        *query++ = '\0';
+    } else {
+        query = target + strlen(target);
+    }
+    
+    if (strcmp(target, "/") == 0 || strcmp(target, "/graph.html") == 0) {
+        if (srv->page == NULL) {
+            http_error(conn, 404, "Not Found");
+            return;
+        }
+        http_begin_response(conn, 200, "OK", "text/html; charset=utf-8", (long long)srv->page_len);
+        out_append(conn, srv->page, srv->page_len);
+    } else if (strcmp(target, "/live") == 0) {
+        http_handle_live(conn, query);
+    } else if (strcmp(target, "/range") == 0) {
+        http_handle_range(conn, query);
+    } else if (strcmp(target, "/metrics") == 0) {
+        http_begin_response(conn, 200, "OK", "text/plain; version=0.0.4; charset=utf-8", -1);
+        metrics_render(conn);
+    } else {
+        http_error(conn, 404, "Not Found");
+    }
+}
+
+// Отправка накопленного; по мере освобождения буфера дописываем ответ
+static int http_conn_flush(http_conn_t *conn) {
+    for (;;) {
+        while (conn->out_off < conn->out_len) {
+            ssize_t n = send(conn->watch.fd, conn->out + conn->out_off, conn->out_len - conn->out_off,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                return -1;
+            }
+            conn->out_off += (size_t)n;
+        }
+        conn->out_off = conn->out_len = 0;
+    
+        if (conn->produce == NULL) break;
+        if (conn->produce(conn) == 0) {
+            conn->produce = NULL;
+        }
+        if (conn->out_len == 0) break;
+    }
+    
+    // Обычный ответ отдан полностью - закрываем
+    return conn->state == HTTP_CONN_WRITING ? 1 : 0;
+}
+
+static void http_conn_cb(pzem_watch_t *watch, uint32_t events) {
+    http_conn_t *conn = watch->data;
+    
+    // Соединение могло быть закрыто обработчиком раньше в этой же пачке событий
+    if (watch->fd < 0) return;
+    
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        http_conn_close(conn);
+        return;
+    }
+    
+    if (events & EPOLLIN) {
+        if (conn->state == HTTP_CONN_READING) {
+            ssize_t n = recv(watch->fd, conn->request + conn->request_len, 
+                             sizeof(conn->request) - 1 - conn->request_len, MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                http_conn_close(conn);
+                return;
+            }
+            if (n > 0) {
+                conn->request_len += (size_t)n;
+                conn->request[conn->request_len] = '\0';
+                if (strstr(conn->request, "\r\n\r\n") || strstr(conn->request, "\n\n")) {
+                    http_dispatch(conn);
+                } else if (conn->request_len >= sizeof(conn->request) - 1) {
+                    conn->state = HTTP_CONN_WRITING;
+                    http_error(conn, 431, "Request Header Fields Too Large");
+                }
+            }
+        } else {
+            // После запроса клиенту писать нечего, проверяем только закрытие
+            char discard[256];
+            ssize_t n = recv(watch->fd, discard, sizeof(discard), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                http_conn_close(conn);
+                return;
+            }
+        }
+    }
+    
+    if (conn->state != HTTP_CONN_READING) {
+        int rc = http_conn_flush(conn);
+        if (rc != 0) {
+            http_conn_close(conn);
+            return;
+        }
+    }
+    http_conn_update_events(conn);
+}
+
+static void http_accept_cb(pzem_watch_t *watch, uint32_t events) {
+    (void)events;
+    http_server_t *srv = watch->data;
+    
+    for (;;) {
+        int fd = accept4(watch->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                syslog(LOG_WARNING, "HTTP accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+        
+        // Свободный слот; если нет - вытесняем самое старое соединение без запроса
+        http_conn_t *conn = NULL;
+        http_conn_t *oldest = NULL;
+        for (int i = 0; i < HTTP_MAX_CONNS; i++) {
+            http_conn_t *c = &srv->conns[i];
+            if (c->watch.fd < 0) {
+                conn = c;
+                break;
+            }
+            if (c->state == HTTP_CONN_READING && (!oldest || c->accepted_ms < oldest->accepted_ms)) {
+                oldest = c;
+            }
+        }
+        if (conn == NULL && oldest != NULL) {
+            http_conn_close(oldest);
+            conn = oldest;
+        }
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        
+        conn->watch.fd = fd;
+        conn->state = HTTP_CONN_READING;
+        conn->request_len = 0;
+        conn->device = -1;
+        conn->accepted_ms = get_time_ms();
+        conn->events = EPOLLIN;
+        if (scheduler_add_watch(srv->sched, &conn->watch, conn->events) != 0) {
+            close(fd);
+            conn->watch.fd = -1;
+        }
+    }
+}
+
+// Страница графиков читается один раз, чтобы не трогать диск при запросах
+static void http_load_page(http_server_t *srv, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        syslog(LOG_WARNING, "HTTP page '%s' not available: %s", path, strerror(errno));
+        return;
+    }
+    
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            srv->page = malloc((size_t)size);
+            if (srv->page && fread(srv->page, 1, (size_t)size, file) == (size_t)size) {
+                srv->page_len = (size_t)size;
+            } else {
+                free(srv->page);
+                srv->page = NULL;
+            }
+        }
+    }
+    fclose(file);
+}
+
+pzem_result_t http_init(http_server_t *srv, pzem_scheduler_t *sched, const pzem_config_t *config) {
+    if (!srv || !sched || !config) return PZEM_ERROR_INVALID_PARAM;
+    
+    memset(srv, 0, sizeof(*srv));
+    srv->listen.fd = -1;
+    srv->sched = sched;
+    for (int i = 0; i < HTTP_MAX_CONNS; i++) {
+        srv->conns[i].watch.fd = -1;
+        srv->conns[i].watch.cb = http_conn_cb;
+        srv->conns[i].watch.data = &srv->conns[i];
+        srv->conns[i].server = srv;
+    }
+    
+    if (config->http_port <= 0) {
+        return PZEM_SUCCESS;
+    }
+    
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)config->http_port)
+    };
+    if (inet_pton(AF_INET, config->http_bind, &addr.sin_addr) != 1) {
+        syslog(LOG_ERR, "Invalid http_bind address '%s'", config->http_bind);
+        return PZEM_ERROR_CONFIG;
+    }
+    
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create HTTP socket: %s", strerror(errno));
+        return PZEM_ERROR_IO;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        syslog(LOG_ERR, "Failed to listen on %s:%d: %s", config->http_bind, config->http_port, strerror(errno));
+        close(fd);
+        return PZEM_ERROR_IO;
+    }
+    
+    srv->listen.fd = fd;
+    srv->listen.cb = http_accept_cb;
+    srv->listen.data = srv;
+    if (scheduler_add_watch(sched, &srv->listen, EPOLLIN) != 0) {
+        syslog(LOG_ERR, "Failed to register HTTP socket: %s", strerror(errno));
+        close(fd);
+        srv->listen.fd = -1;
+        return PZEM_ERROR_IO;
+    }
+    
+    http_load_page(srv, config->http_page);
+    syslog(LOG_INFO, "HTTP server listening on %s:%d", config->http_bind, config->http_port);
+    return PZEM_SUCCESS;
+}
+
+// Новое измерение устройства всем подписчикам /live
+void http_publish(http_server_t *srv, int device, const char *line, size_t len) {
+    if (!srv || srv->streams == 0 || !line) return;
+    
+    // Без завершающего перевода строки - его добавляет формат события
+    while (len > 0 && line[len - 1] == '\n') len--;
+    
+    for (int i = 0; i < HTTP_MAX_CONNS; i++) {
+        http_conn_t *conn = &srv->conns[i];
+        if (conn->watch.fd < 0 || conn->state != HTTP_CONN_STREAMING || conn->device != device) continue;
+    
+        // Клиент не успевает читать - пропускаем событие, а не копим бесконечно
+        if (conn->out_len - conn->out_off > HTTP_SSE_BACKLOG) {
+            srv->sse_dropped++;
+            continue;
+        }
+        out_append(conn, "data: ", 6);
+        out_append(conn, line, len);
+        out_append(conn, "\n\n", 2);
+    
+        if (http_conn_flush(conn) != 0) {
+            http_conn_close(conn);
+            continue;
+        }
+        http_conn_update_events(conn);
+    }
+}
+
+void http_close(http_server_t *srv) {
+    if (!srv) return;
+    
+    for (int i = 0; i < HTTP_MAX_CONNS; i++) {
+        if (srv->conns[i].server) {
+            http_conn_close(&srv->conns[i]);
+        }
+    }
+    if (srv->listen.fd >= 0) {
+        scheduler_del_watch(srv->sched, &srv->listen);
+        close(srv->listen.fd);
+        srv->listen.fd = -1;
+    }
+    free(srv->page);
+    srv->page = NULL;
+}
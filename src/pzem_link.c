@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Состояние соединения с шиной: подключено, пауза перед попыткой, переподключение.
+// Пауза растет экспоненциально с разбросом, лог, сокеты и метрики при этом не трогаются:
+// простой шины стоит только самого простоя.
+
+#include "pzem_monitor.h"
+
+pzem_link_t bus_link = {.state = PZEM_LINK_CONNECTED};
+
+// Следующая попытка: задержка удваивается до предела, половина ее случайна,
+// чтобы несколько экземпляров на одном шлюзе не стучались одновременно
+static void link_schedule(pzem_link_t *link) {
+    long long delay = global_config.reconnect_delay_ms;
+    for (int i = 0; i < link->attempts && delay < global_config.reconnect_max_delay_ms; i++) {
+        delay *= 2;
+    }
+    if (delay > global_config.reconnect_max_delay_ms) {
+        delay = global_config.reconnect_max_delay_ms;
+    }
+    delay = delay / 2 + rand_r(&link->seed) % (delay / 2 + 1);
+    
+    link->retry_at_ms = get_time_ms() + delay;
+    link->state = PZEM_LINK_BACKOFF;
+    syslog(LOG_INFO, "Modbus reconnect attempt %d in %lldms", link->attempts + 1, delay);
+}
+
+// Вся шина молчит: закрываем только Modbus контекст
+static void link_down(pzem_link_t *link) {
+    syslog(LOG_WARNING, "No response from any device for %d cycles, closing Modbus connection", 
+           link->silent_cycles);
+    close_modbus_connection();
+    mark_devices_offline();
+    
+    link->silent_cycles = 0;
+    link->attempts = 0;
+    link->down_since_ms = get_time_ms();
+    link_schedule(link);
+}
+
+void link_init(pzem_link_t *link) {
+    if (!link) return;
+    
+    memset(link, 0, sizeof(*link));
+    link->state = PZEM_LINK_CONNECTED;
+    link->seed = (unsigned int)(get_time_us() ^ getpid());
+}
+
+// Итог цикла опроса: failed устройств не ответили после всех попыток
+void link_cycle_done(pzem_link_t *link, int failed) {
+    if (!link || link->state != PZEM_LINK_CONNECTED) return;
+    
+    // Переподключаемся только если молчит вся шина, а не одно устройство
+    if (device_count > 0 && failed == device_count) {
+        if (++link->silent_cycles > LINK_MAX_SILENT_CYCLES) {
+            link_down(link);
+        }
+    } else {
+        link->silent_cycles = 0;
+    }
+}
+
+// Вызывается каждый период. Возвращает 1 если соединение есть и шину можно опрашивать
+int link_poll(pzem_link_t *link) {
+    if (!link) return 0;
+    if (link->state == PZEM_LINK_CONNECTED) return 1;
+    if (get_time_ms() < link->retry_at_ms) return 0;
+    
+    link->state = PZEM_LINK_RECONNECTING;
+    metrics.reconnects++;
+    if (init_modbus_connection(&global_config) != PZEM_SUCCESS) {
+        link->attempts++;
+        link_schedule(link);
+        return 0;
+    }
+    
+    long long downtime = get_time_ms() - link->down_since_ms;
+    metrics.link_down_ms += downtime;
+    syslog(LOG_INFO, "Reconnected after %lldms (%d failed attempts)", downtime, link->attempts);
+    link->state = PZEM_LINK_CONNECTED;
+    link->attempts = 0;
+    
+    // Регистры всех групп читаются заново
+    for (int i = 0; i < device_count; i++) {
+        reset_device_reads(&devices[i]);
+    }
+    return 1;
+}
+
+// Адрес шины сменился при перечитывании конфигурации: старое соединение закрывается
+// и сразу открывается новое. Если новый адрес не отвечает, дальше как при обрыве
+void link_restart(pzem_link_t *link) {
+    if (!link) return;
+    
+    int was_connected = link->state == PZEM_LINK_CONNECTED;
+    close_modbus_connection();
+    link->silent_cycles = 0;
+    link->attempts = 0;
+    
+    if (init_modbus_connection(&global_config) == PZEM_SUCCESS) {
+        if (!was_connected) {
+            metrics.link_down_ms += get_time_ms() - link->down_since_ms;
+        }
+        link->state = PZEM_LINK_CONNECTED;
+        return;
+    }
+    
+    if (was_connected) {
+        mark_devices_offline();
+        link->down_since_ms = get_time_ms();
+    }
+    link_schedule(link);
+}
@@ -0,0 +1,668 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Запись логов на диск в отдельном потоке.
+// Поток опроса только кладет строки в очередь (один писатель / один читатель),
+// буферы логов и файлы принадлежат потоку записи.
+
+#define _GNU_SOURCE
+#include "pzem_monitor.h"
+#include <limits.h>
+
+log_writer_t log_writer = {0};
+
+// Функция получения пути к файлу лога за сутки, в которые попадает when
+void get_log_file_path(char *path, size_t size, const char *log_dir, const char *name, const char *ext,
+                       time_t when) {
+    if (!path || !log_dir || !name || size == 0) return;
+    
+    char date_str[32];
+    struct tm tm_info;
+    localtime_r(&when, &tm_info);
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d", &tm_info);
+    snprintf(path, size, "%s/pzem3_%s_%s.%s", log_dir, name, date_str, ext ? ext : "log");
+}
+
+// Функция инициализации буфера логов
+pzem_result_t init_log_buffer(log_buffer_t *buffer, const pzem_config_t *config, const char *name) {
+    if (!buffer || !config || !name || config->log_buffer_bytes < LOG_ENTRY_SIZE) {
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    
+    // Освобождаем старый буфер если есть
+    if (buffer->data != NULL) {
+        free_log_buffer(buffer);
+    }
+    
+    // Единственное выделение памяти - дальше строки только копируются в буфер
+    buffer->data = (char *)malloc((size_t)config->log_buffer_bytes);
+    if (buffer->data == NULL) {
+        syslog(LOG_ERR, "Failed to allocate log buffer");
+        return PZEM_ERROR_MEMORY;
+    }
+    
+    buffer->capacity = (size_t)config->log_buffer_bytes;
+    buffer->entry_max = LOG_ENTRY_SIZE;
+    buffer->used = 0;
+    buffer->lines = 0;
+    buffer->max_lines = config->log_buffer_size;
+    buffer->first_entry_ms = 0;
+    buffer->batch_day_start = 0;
+    buffer->batch_day_end = 0;
+    buffer->max_age_ms = config->log_flush_max_age_s * 1000LL;
+    
+    STRCPY_SAFE(buffer->log_dir, config->log_dir);
+    STRCPY_SAFE(buffer->config_name, name);
+    buffer->file_ext = output_format_ext(config->log_format);
+    
+    buffer->fd = -1;
+    buffer->day_start = 0;
+    buffer->day_end = 0;
+    buffer->file_size = 0;
+    buffer->alloc_end = 0;
+    buffer->prealloc_bytes = (off_t)config->log_prealloc_kb * 1024;
+    buffer->sync_mode = config->log_sync;
+    buffer->sync_interval_ms = config->log_sync_interval_s * 1000LL;
+    buffer->last_sync_ms = get_time_ms();
+    buffer->unsynced = 0;
+    buffer->compressed = config->log_format == PZEM_FORMAT_COMPRESSED;
+    buffer->block_start = 0;
+    buffer->pzb.block = NULL;
+    buffer->retry_ms = 0;
+    buffer->error_logged_ms = 0;
+    buffer->open_failures = 0;
+    buffer->lost_lines = 0;
+    
+    return PZEM_SUCCESS;
+}
+
+// Локальная полночь суток t, days_ahead = 1 - начало следующих суток
+static time_t local_midnight(time_t t, int days_ahead) {
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    tm_info.tm_hour = 0;
+    tm_info.tm_min = 0;
+    tm_info.tm_sec = 0;
+    tm_info.tm_mday += days_ahead;
+    tm_info.tm_isdst = -1;
+    return mktime(&tm_info);
+}
+
+// Закрытие открытого сжатого блока: в буфере остается готовый блок с заголовком
+static void log_buffer_close_block(log_buffer_t *buffer) {
+    if (buffer->pzb.block == NULL) return;
+    
+    buffer->used = buffer->block_start + pzb_finish(&buffer->pzb);
+}
+
+// Запас под следующую строку: сжатой записи нужно не больше PZEM_PZB_RECORD_MAX_BYTES,
+// иначе блок закрывался бы на каждой строке
+static size_t log_buffer_headroom(const log_buffer_t *buffer) {
+    return buffer->compressed ? PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES : buffer->entry_max;
+}
+
+// Пачку некуда записать: строки отбрасываются и учитываются
+static void log_buffer_drop(log_buffer_t *buffer) {
+    atomic_fetch_add_explicit(&log_writer.queue.write_dropped, (unsigned long long)buffer->lines,
+                              memory_order_relaxed);
+    buffer->lost_lines += (unsigned long long)buffer->lines;
+    buffer->used = 0;
+    buffer->lines = 0;
+    buffer->block_start = 0;
+    buffer->pzb.block = NULL;
+}
+
+// Файла нет, а буфер полон: пачка отбрасывается, чтобы принимать новые строки
+static void log_buffer_drop_if_full(log_buffer_t *buffer) {
+    if (buffer->used + log_buffer_headroom(buffer) > buffer->capacity ||
+        (buffer->max_lines > 0 && buffer->lines >= buffer->max_lines)) {
+        log_buffer_drop(buffer);
+    }
+}
+
+// Сжатый лог: бинарная запись добавляется в открытый блок. Блок закрывается,
+// когда полон или когда буфер уходит на диск, поэтому каждый сброс пишет целые блоки
+static pzem_result_t add_to_compressed_buffer(log_buffer_t *buffer, const char *record, size_t len) {
+    pzem_data_t data;
+    int slave_addr;
+    if (parse_binary_entry(record, len, &data, &slave_addr) != 0) {
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    
+    if (buffer->pzb.block == NULL || buffer->pzb.slave_addr != slave_addr ||
+        pzb_add(&buffer->pzb, &data) != 0) {
+        log_buffer_close_block(buffer);
+        if (buffer->capacity - buffer->used < PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES) {
+            // Без файла полный буфер отбрасывается внутри flush_log_buffer
+            flush_log_buffer(buffer);
+            if (buffer->capacity - buffer->used < PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES) {
+                return PZEM_ERROR_IO;
+            }
+        }
+        buffer->block_start = buffer->used;
+        pzb_begin(&buffer->pzb, (uint8_t *)buffer->data + buffer->used, 
+                  buffer->capacity - buffer->used, slave_addr);
+        pzb_add(&buffer->pzb, &data);
+    }
+    
+    if (buffer->lines == 0) {
+        buffer->first_entry_ms = get_time_ms();
+    }
+    buffer->used = buffer->block_start + pzb_size(&buffer->pzb);
+    buffer->lines++;
+    return PZEM_SUCCESS;
+}
+
+// Функция добавления записи в буфер
+pzem_result_t add_to_log_buffer(log_buffer_t *buffer, const char *log_entry, size_t len, time_t when) {
+    if (!buffer || !log_entry || !buffer->data) {
+        syslog(LOG_ERR, "Invalid parameters to add_to_log_buffer");
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    
+    // Пачка пишется в файл одних суток: строка других суток сначала сбрасывает накопленное,
+    // а если файл недоступен, старая пачка отбрасывается
+    if (buffer->lines > 0 && (when < buffer->batch_day_start || when >= buffer->batch_day_end)) {
+        flush_log_buffer(buffer);
+        if (buffer->lines > 0) {
+            log_buffer_drop(buffer);
+        }
+    }
+    if (buffer->lines == 0) {
+        buffer->batch_day_start = local_midnight(when, 0);
+        buffer->batch_day_end = local_midnight(when, 1);
+    }
+    
+    if (buffer->compressed) {
+        return add_to_compressed_buffer(buffer, log_entry, len);
+    }
+    
+    if (len > buffer->capacity) {
+        len = buffer->capacity;
+    }
+    
+    // Строка не помещается - сначала сбрасываем накопленное в файл
+    if (buffer->used + len > buffer->capacity) {
+#ifdef DEBUG
+        syslog(LOG_DEBUG, "Buffer full (%zu/%zu bytes), flushing...", buffer->used, buffer->capacity);
+#endif
+        flush_log_buffer(buffer);
+        if (buffer->used + len > buffer->capacity) {
+            return PZEM_ERROR_IO;
+        }
+    }
+    
+    if (buffer->lines == 0) {
+        buffer->first_entry_ms = get_time_ms();
+    }
+    memcpy(buffer->data + buffer->used, log_entry, len);
+    buffer->used += len;
+    buffer->lines++;
+    
+#ifdef DEBUG
+    syslog(LOG_DEBUG, "Added log entry to buffer (%d lines, %zu/%zu bytes)", 
+           buffer->lines, buffer->used, buffer->capacity);
+#endif
+    
+    return PZEM_SUCCESS;
+}
+
+// Синхронизация данных файла на носитель
+static void log_buffer_sync(log_buffer_t *buffer) {
+    if (buffer->fd < 0 || !buffer->unsynced) return;
+    
+    if (fdatasync(buffer->fd) == -1) {
+        syslog(LOG_WARNING, "fdatasync failed for %s: %s", buffer->config_name, strerror(errno));
+    }
+    buffer->unsynced = 0;
+    buffer->last_sync_ms = get_time_ms();
+}
+
+// Закрытие текущего файла лога с освобождением непотраченной преаллокации
+static void log_buffer_close_file(log_buffer_t *buffer) {
+    if (buffer->fd < 0) return;
+    
+    if (buffer->sync_mode != LOG_SYNC_NONE) {
+        log_buffer_sync(buffer);
+    }
+    // Блоки за концом файла освобождаются усечением до текущего размера
+    if (buffer->alloc_end > buffer->file_size) {
+        if (ftruncate(buffer->fd, buffer->file_size) == -1) {
+            syslog(LOG_WARNING, "Failed to release preallocated space for %s: %s",
+                   buffer->config_name, strerror(errno));
+        }
+    }
+    
+    close(buffer->fd);
+    buffer->fd = -1;
+    buffer->day_start = 0;
+    buffer->day_end = 0;
+}
+
+// Открытие файла лога за сутки, в которые попадает when; дескриптор держим открытым,
+// пока пишутся строки тех же суток
+pzem_result_t log_buffer_open_file(log_buffer_t *buffer, time_t when) {
+    if (!buffer) return PZEM_ERROR_INVALID_PARAM;
+    
+    if (buffer->fd >= 0 && when >= buffer->day_start && when < buffer->day_end) {
+        return PZEM_SUCCESS;
+    }
+    
+    // Строки других суток - закрываем прежний файл
+    log_buffer_close_file(buffer);
+    
+    char log_path[512];
+    get_log_file_path(log_path, sizeof(log_path), buffer->log_dir, buffer->config_name, buffer->file_ext, when);
+    
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        // Повтор через LOG_OPEN_RETRY_MS, в syslog первая ошибка и дальше раз в минуту
+        long long now_ms = get_time_ms();
+        buffer->retry_ms = now_ms + LOG_OPEN_RETRY_MS;
+        if (buffer->open_failures++ == 0 || now_ms - buffer->error_logged_ms >= LOG_ERROR_INTERVAL_MS) {
+            syslog(LOG_ERR, "Error opening log file '%s': %s (attempt %u, %llu lines dropped so far)",
+                   log_path, strerror(errno), buffer->open_failures, buffer->lost_lines);
+            buffer->error_logged_ms = now_ms;
+        }
+        return PZEM_ERROR_IO;
+    }
+    if (buffer->open_failures > 0) {
+        syslog(LOG_NOTICE, "Log file '%s' opened after %u failed attempts, %llu lines dropped",
+               log_path, buffer->open_failures, buffer->lost_lines);
+        buffer->open_failures = 0;
+        buffer->lost_lines = 0;
+    }
+    buffer->retry_ms = 0;
+    
+    // Устанавливаем правильные права на файл
+    fchmod(fd, 0644);
+    
+    struct stat st;
+    buffer->file_size = (fstat(fd, &st) == 0) ? st.st_size : 0;
+    buffer->alloc_end = buffer->file_size;
+    buffer->fd = fd;
+    buffer->day_start = local_midnight(when, 0);
+    buffer->day_end = local_midnight(when, 1);
+    
+#ifdef DEBUG
+    syslog(LOG_DEBUG, "Opened log file %s", log_path);
+#endif
+    return PZEM_SUCCESS;
+}
+
+// Преаллокация места под файл блоками, чтобы дневной лог не фрагментировался
+static void log_buffer_reserve(log_buffer_t *buffer, size_t bytes) {
+    if (buffer->prealloc_bytes <= 0) return;
+    
+    off_t needed = buffer->file_size + (off_t)bytes;
+    if (needed <= buffer->alloc_end) return;
+    
+    off_t chunks = (needed - buffer->alloc_end + buffer->prealloc_bytes - 1) / buffer->prealloc_bytes;
+    off_t length = chunks * buffer->prealloc_bytes;
+    if (fallocate(buffer->fd, FALLOC_FL_KEEP_SIZE, buffer->alloc_end, length) == -1) {
+        syslog(LOG_WARNING, "Log preallocation disabled for %s: %s", buffer->config_name, strerror(errno));
+        buffer->prealloc_bytes = 0;
+        return;
+    }
+    buffer->alloc_end += length;
+}
+
+// Функция сброса буфера в файл
+pzem_result_t flush_log_buffer(log_buffer_t *buffer) {
+    if (!buffer || !buffer->data) {
+        return PZEM_SUCCESS;
+    }
+    log_buffer_close_block(buffer);
+    if (buffer->used == 0) {
+        return PZEM_SUCCESS;
+    }
+    
+    // После ошибки открытия файл не трогаем до retry_ms, строки копятся до заполнения буфера
+    if (get_time_ms() < buffer->retry_ms ||
+        log_buffer_open_file(buffer, buffer->batch_day_start) != PZEM_SUCCESS) {
+        log_buffer_drop_if_full(buffer);
+        return PZEM_ERROR_IO;
+    }
+    
+    log_buffer_reserve(buffer, buffer->used);
+    long long start_us = get_time_us();
+    
+    // Вся пачка уходит одним write
+    pzem_result_t result = PZEM_SUCCESS;
+    size_t offset = 0;
+    while (offset < buffer->used) {
+        ssize_t written = write(buffer->fd, buffer->data + offset, buffer->used - offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            syslog(LOG_ERR, "Error writing log file for %s: %s", buffer->config_name, strerror(errno));
+            result = PZEM_ERROR_IO;
+            break;
+        }
+        offset += (size_t)written;
+    }
+    if (offset > 0) {
+        buffer->file_size += (off_t)offset;
+        buffer->unsynced = 1;
+    }
+    
+#ifdef DEBUG
+    syslog(LOG_DEBUG, "Write log entry to log file %s, size: %d)", buffer->config_name, buffer->lines);
+#endif
+    
+    // Политика надежности записи
+    if (buffer->sync_mode == LOG_SYNC_BATCH ||
+        (buffer->sync_mode == LOG_SYNC_PERIODIC &&
+         get_time_ms() - buffer->last_sync_ms >= buffer->sync_interval_ms)) {
+        log_buffer_sync(buffer);
+    }
+    histogram_add(&metrics.flush_us, (uint64_t)(get_time_us() - start_us));
+    
+    buffer->used = 0;
+    buffer->lines = 0;
+    
+    return result;
+}
+
+// Функция освобождения буфера
+void free_log_buffer(log_buffer_t *buffer) {
+    if (!buffer) return;
+    
+    safe_free((void**)&buffer->data);
+    log_buffer_close_file(buffer);
+    
+    buffer->used = 0;
+    buffer->capacity = 0;
+    buffer->lines = 0;
+}
+
+// Функция проверки необходимости сброса буфера: по размеру, числу строк или возрасту
+int should_flush_buffer(const log_buffer_t *buffer) {
+    if (!buffer || buffer->lines == 0) return 0;
+    
+    if (buffer->used + log_buffer_headroom(buffer) > buffer->capacity) return 1;
+    if (buffer->max_lines > 0 && buffer->lines >= buffer->max_lines) return 1;
+    return get_time_ms() - buffer->first_entry_ms >= buffer->max_age_ms;
+}
+
+// Ближайший момент, когда буферу нужно внимание потока записи (сброс по возрасту или fdatasync)
+long long log_buffer_deadline(const log_buffer_t *buffer) {
+    long long deadline = LLONG_MAX;
+    if (!buffer) return deadline;
+    
+    if (buffer->lines > 0) {
+        deadline = buffer->first_entry_ms + buffer->max_age_ms;
+        // Файл не открылся - прошедший дедлайн не взводим, ждем следующей попытки
+        if (deadline < buffer->retry_ms) {
+            deadline = buffer->retry_ms;
+        }
+    }
+    if (buffer->sync_mode == LOG_SYNC_PERIODIC && buffer->unsynced &&
+        buffer->last_sync_ms + buffer->sync_interval_ms < deadline) {
+        deadline = buffer->last_sync_ms + buffer->sync_interval_ms;
+    }
+    return deadline;
+}
+
+// Обслуживание буфера по таймеру: сброс старых строк и периодический fdatasync
+static void log_buffer_tick(log_buffer_t *buffer, long long now) {
+    if (should_flush_buffer(buffer)) {
+        flush_log_buffer(buffer);
+    } else if (buffer->sync_mode == LOG_SYNC_PERIODIC && buffer->unsynced &&
+               now - buffer->last_sync_ms >= buffer->sync_interval_ms) {
+        log_buffer_sync(buffer);
+    }
+}
+
+// Округление размера очереди до степени двойки
+static unsigned int round_up_pow2(unsigned int value) {
+    unsigned int result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Инициализация очереди строк лога
+static pzem_result_t log_queue_init(log_queue_t *queue, int capacity) {
+    if (capacity < MIN_LOG_QUEUE_SIZE) {
+        capacity = MIN_LOG_QUEUE_SIZE;
+    } else if (capacity > MAX_LOG_QUEUE_SIZE) {
+        capacity = MAX_LOG_QUEUE_SIZE;
+    }
+    
+    queue->capacity = round_up_pow2((unsigned int)capacity);
+    queue->slots = (log_slot_t *)calloc(queue->capacity, sizeof(log_slot_t));
+    if (queue->slots == NULL) {
+        syslog(LOG_ERR, "Failed to allocate log queue");
+        return PZEM_ERROR_MEMORY;
+    }
+    
+    atomic_store(&queue->head, 0);
+    atomic_store(&queue->tail, 0);
+    atomic_store(&queue->enqueued, 0);
+    atomic_store(&queue->dropped, 0);
+    atomic_store(&queue->write_dropped, 0);
+    atomic_store(&queue->max_depth, 0);
+    return PZEM_SUCCESS;
+}
+
+// Текущая глубина очереди
+unsigned int log_queue_depth(const log_queue_t *queue) {
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return head - tail;
+}
+
+// Буфер потока устройства: 0 - лог измерений, 1.. - уровни сводок
+static log_buffer_t *stream_buffer(const log_writer_t *writer, int device, int stream) {
+    if (device < 0 || device >= writer->devices || stream < 0 || stream >= writer->streams) {
+        return NULL;
+    }
+    return stream == 0 ? &devices[device].log_buffer : &devices[device].rollup.buffer[stream - 1];
+}
+
+// Поток записи: разбирает очередь в буферы устройств и сбрасывает их на диск
+static void *log_writer_thread(void *arg) {
+    log_writer_t *writer = (log_writer_t *)arg;
+    log_queue_t *queue = &writer->queue;
+    
+    for (;;) {
+        // Спим до новой строки или до ближайшего дедлайна буферов
+        long long deadline = LLONG_MAX;
+        for (int i = 0; i < writer->devices; i++) {
+            for (int s = 0; s < writer->streams; s++) {
+                long long d = log_buffer_deadline(stream_buffer(writer, i, s));
+                if (d < deadline) deadline = d;
+            }
+        }
+        
+        if (deadline == LLONG_MAX) {
+            while (sem_wait(&writer->items) == -1 && errno == EINTR) {
+            }
+        } else {
+            // Дедлайны буферов по CLOCK_MONOTONIC (get_time_ms), ждем по тем же часам:
+            // перевод реального времени назад не должен задерживать сброс
+            struct timespec ts = {
+                .tv_sec = deadline / 1000,
+                .tv_nsec = (deadline % 1000) * 1000000LL
+            };
+            while (sem_clockwait(&writer->items, CLOCK_MONOTONIC, &ts) == -1 && errno == EINTR) {
+            }
+        }
+    
+        unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    
+        while (tail != head) {
+            log_slot_t *slot = &queue->slots[tail & (queue->capacity - 1)];
+            log_buffer_t *buffer = stream_buffer(writer, slot->device, slot->stream);
+            time_t when = (time_t)(slot->time_ms / 1000);
+            const char *line = slot->line;
+            size_t len = slot->len;
+            
+            // Строка в нескольких ячейках (сводка) собирается целиком и идет в буфер одной строкой:
+            // ее нельзя разорвать сбросом или потерять частью
+            if (slot->more) {
+                len = 0;
+                do {
+                    slot = &queue->slots[tail & (queue->capacity - 1)];
+                    if (len + slot->len <= sizeof(writer->joined)) {
+                        memcpy(writer->joined + len, slot->line, slot->len);
+                        len += slot->len;
+                    }
+                    tail++;
+                } while (slot->more && tail != head);
+                line = writer->joined;
+            } else {
+                tail++;
+            }
+            
+            if (buffer != NULL) {
+                add_to_log_buffer(buffer, line, len, when);
+                if (should_flush_buffer(buffer)) {
+                    flush_log_buffer(buffer);
+                }
+            }
+            atomic_store_explicit(&queue->tail, tail, memory_order_release);
+        }
+        
+        long long now = get_time_ms();
+        for (int i = 0; i < writer->devices; i++) {
+            for (int s = 0; s < writer->streams; s++) {
+                log_buffer_tick(stream_buffer(writer, i, s), now);
+            }
+        }
+    
+        if (!atomic_load(&writer->running)) {
+            break;
+        }
+    }
+    
+    // Остановка: дописываем все, что осталось в буферах
+    for (int i = 0; i < writer->devices; i++) {
+        for (int s = 0; s < writer->streams; s++) {
+            flush_log_buffer(stream_buffer(writer, i, s));
+        }
+    }
+    
+    return NULL;
+}
+
+// Запуск потока записи
+pzem_result_t log_writer_start(log_writer_t *writer, const pzem_config_t *config) {
+    if (!writer || !config) return PZEM_ERROR_INVALID_PARAM;
+    
+    if (atomic_load(&writer->running)) {
+        return PZEM_SUCCESS;
+    }
+    
+    if (writer->queue.slots == NULL) {
+        pzem_result_t result = log_queue_init(&writer->queue, config->log_queue_size);
+        if (result != PZEM_SUCCESS) {
+            return result;
+        }
+    }
+    
+    if (sem_init(&writer->items, 0, 0) != 0) {
+        syslog(LOG_ERR, "Failed to initialize log writer semaphore: %s", strerror(errno));
+        return PZEM_ERROR_IO;
+    }
+    
+    writer->devices = device_count;
+    writer->streams = config->rollup_count + 1;
+    atomic_store(&writer->running, 1);
+    if (pthread_create(&writer->thread, NULL, log_writer_thread, writer) != 0) {
+        syslog(LOG_ERR, "Failed to start log writer thread");
+        atomic_store(&writer->running, 0);
+        sem_destroy(&writer->items);
+        return PZEM_ERROR_IO;
+    }
+    
+    return PZEM_SUCCESS;
+}
+
+// Передача строки лога потоку записи, никогда не блокирует поток опроса.
+// Строка длиннее ячейки (сводка) занимает несколько ячеек подряд и публикуется целиком.
+// time_ms - реальное время строки (у сводки - начало окна), по нему строка попадает в файл своих суток
+pzem_result_t log_writer_submit(log_writer_t *writer, int device, int stream, long long time_ms,
+                                const char *log_entry, size_t len) {
+    if (!writer || !log_entry || !writer->queue.slots) {
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    if (len > sizeof(writer->joined)) {
+        len = sizeof(writer->joined);
+    }
+    
+    log_queue_t *queue = &writer->queue;
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    unsigned int depth = head - tail;
+    unsigned int parts = len > LOG_ENTRY_SIZE ? (unsigned int)((len + LOG_ENTRY_SIZE - 1) / LOG_ENTRY_SIZE) : 1;
+    
+    // Очередь полна - диск не успевает, строку отбрасываем
+    if (depth + parts > queue->capacity) {
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+        return PZEM_ERROR_IO;
+    }
+    
+    for (unsigned int i = 0; i < parts; i++) {
+        log_slot_t *slot = &queue->slots[(head + i) & (queue->capacity - 1)];
+        size_t part = len > sizeof(slot->line) ? sizeof(slot->line) : len;
+        slot->device = device;
+        slot->stream = stream;
+        slot->time_ms = time_ms;
+        slot->len = (uint16_t)part;
+        slot->more = i + 1 < parts;
+        memcpy(slot->line, log_entry, part);
+        log_entry += part;
+        len -= part;
+    }
+    
+    atomic_store_explicit(&queue->head, head + parts, memory_order_release);
+    atomic_fetch_add_explicit(&queue->enqueued, 1, memory_order_relaxed);
+    if (depth + parts > atomic_load_explicit(&queue->max_depth, memory_order_relaxed)) {
+        atomic_store_explicit(&queue->max_depth, depth + parts, memory_order_relaxed);
+    }
+    
+    sem_post(&writer->items);
+    return PZEM_SUCCESS;
+}
+
+// Остановка потока записи с дозаписью очереди
+void log_writer_stop(log_writer_t *writer) {
+    if (!writer || !atomic_load(&writer->running)) return;
+    
+    atomic_store(&writer->running, 0);
+    sem_post(&writer->items);
+    pthread_join(writer->thread, NULL);
+    sem_destroy(&writer->items);
+}
+
+// Освобождение очереди после остановки потока
+void log_writer_free(log_writer_t *writer) {
+    if (!writer) return;
+    
+    log_writer_stop(writer);
+    safe_free((void **)&writer->queue.slots);
+    writer->queue.capacity = 0;
+}
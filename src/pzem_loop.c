@@ -0,0 +1,289 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Планировщик опроса на абсолютных дедлайнах (timerfd + epoll)
+
+#include "pzem_monitor.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define MAX_EPOLL_EVENTS 16
+
+static long long timespec_to_ns(const struct timespec *ts) {
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec ns_to_timespec(long long ns) {
+    struct timespec ts = {
+        .tv_sec = ns / NSEC_PER_SEC,
+        .tv_nsec = ns % NSEC_PER_SEC
+    };
+    return ts;
+}
+
+static long long scheduler_now_ns(const pzem_scheduler_t *sched) {
+    struct timespec ts;
+    clock_gettime(sched->clock_id, &ts);
+    return timespec_to_ns(&ts);
+}
+
+// Первый дедлайн: сразу, либо ближайшая граница периода по часам
+static long long scheduler_first_deadline(const pzem_scheduler_t *sched, long long now) {
+    if (!sched->align) {
+        return now;
+    }
+    return (now / sched->interval_ns + 1) * sched->interval_ns;
+}
+
+// Обработчик eventfd пробуждения - просто вычитываем счетчик
+static void scheduler_wakeup_cb(pzem_watch_t *watch, uint32_t events) {
+    (void)events;
+    uint64_t value;
+    while (read(watch->fd, &value, sizeof(value)) > 0) {
+    }
+    ((pzem_scheduler_t *)watch->data)->woken = 1;
+}
+
+// Инициализация планировщика
+pzem_result_t scheduler_init(pzem_scheduler_t *sched, int interval_ms, int align) {
+    if (!sched || interval_ms <= 0) {
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    
+    memset(sched, 0, sizeof(*sched));
+    sched->epoll_fd = -1;
+    sched->timer_fd = -1;
+    sched->wakeup.fd = -1;
+    sched->align = align;
+    // При выравнивании сетка строится по реальному времени
+    sched->clock_id = align ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+    sched->interval_ns = interval_ms * 1000000LL;
+    
+    sched->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sched->epoll_fd == -1) {
+        syslog(LOG_ERR, "Failed to create epoll instance: %s", strerror(errno));
+        return PZEM_ERROR_IO;
+    }
+    
+    sched->timer_fd = timerfd_create(sched->clock_id, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sched->timer_fd == -1) {
+        syslog(LOG_ERR, "Failed to create timerfd: %s", strerror(errno));
+        scheduler_close(sched);
+        return PZEM_ERROR_IO;
+    }
+    
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = NULL
+    };
+    if (epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, sched->timer_fd, &ev) == -1) {
+        syslog(LOG_ERR, "Failed to register timerfd: %s", strerror(errno));
+        scheduler_close(sched);
+        return PZEM_ERROR_IO;
+    }
+    
+    sched->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sched->wakeup.cb = scheduler_wakeup_cb;
+    sched->wakeup.data = sched;
+    if (sched->wakeup.fd == -1 || scheduler_add_watch(sched, &sched->wakeup, EPOLLIN) != 0) {
+        syslog(LOG_ERR, "Failed to create wakeup eventfd: %s", strerror(errno));
+        scheduler_close(sched);
+        return PZEM_ERROR_IO;
+    }
+    
+    sched->next_ns = scheduler_first_deadline(sched, scheduler_now_ns(sched));
+    return PZEM_SUCCESS;
+}
+
+// Смена периода опроса, сетка дедлайнов строится заново
+void scheduler_set_interval(pzem_scheduler_t *sched, int interval_ms) {
+    if (!sched || interval_ms <= 0) return;
+    
+    long long interval_ns = interval_ms * 1000000LL;
+    if (interval_ns == sched->interval_ns) return;
+    
+    long long last = sched->next_ns - sched->interval_ns;
+    sched->interval_ns = interval_ns;
+    if (sched->align) {
+        sched->next_ns = scheduler_first_deadline(sched, last);
+    } else {
+        sched->next_ns = last + interval_ns;
+    }
+}
+
+// Регистрация дескриптора в цикле событий
+int scheduler_add_watch(pzem_scheduler_t *sched, pzem_watch_t *watch, uint32_t events) {
+    if (!sched || !watch || watch->fd < 0) return -1;
+    
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = watch
+    };
+    return epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, watch->fd, &ev);
+}
+
+int scheduler_mod_watch(pzem_scheduler_t *sched, pzem_watch_t *watch, uint32_t events) {
+    if (!sched || !watch || watch->fd < 0) return -1;
+    
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = watch
+    };
+    return epoll_ctl(sched->epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev);
+}
+
+void scheduler_del_watch(pzem_scheduler_t *sched, pzem_watch_t *watch) {
+    if (!sched || !watch || watch->fd < 0 || sched->epoll_fd < 0) return;
+    epoll_ctl(sched->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+}
+
+// Немедленное пробуждение планировщика (безопасно вызывать из обработчика сигнала)
+void scheduler_wakeup(pzem_scheduler_t *sched) {
+    if (!sched || sched->wakeup.fd < 0) return;
+    
+    uint64_t one = 1;
+    ssize_t rc = write(sched->wakeup.fd, &one, sizeof(one));
+    (void)rc;
+}
+
+// Повтор неудачного чтения через delay_ms: пока ждем, цикл событий обслуживает сокеты
+void scheduler_retry_after(pzem_scheduler_t *sched, int delay_ms) {
+    if (!sched) return;
+    
+    long long at = scheduler_now_ns(sched) + delay_ms * 1000000LL;
+    if (sched->retry_ns == 0 || at < sched->retry_ns) {
+        sched->retry_ns = at;
+    }
+}
+
+// Обработка готовых дескрипторов. Возвращает 1 если сработал таймер, -1 при ошибке
+static int scheduler_dispatch(pzem_scheduler_t *sched, int timeout_ms) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int n = epoll_wait(sched->epoll_fd, events, MAX_EPOLL_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno == EINTR) return 0;
+        syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+        return -1;
+    }
+    
+    int expired = 0;
+    for (int i = 0; i < n; i++) {
+        pzem_watch_t *watch = events[i].data.ptr;
+        if (watch == NULL) {
+            uint64_t ticks;
+            if (read(sched->timer_fd, &ticks, sizeof(ticks)) > 0) {
+                expired = 1;
+            }
+        } else if (watch->cb) {
+            watch->cb(watch, events[i].events);
+        }
+    }
+    return expired;
+}
+
+// Ожидание следующего дедлайна с обработкой событий дескрипторов.
+// Возвращает число пропущенных периодов, SCHEDULER_RETRY если подошло время отложенного
+// повтора, SCHEDULER_WAKEUP если ожидание прервал scheduler_wakeup, или -1 при остановке.
+// Новый период отменяет повтор.
+int scheduler_wait(pzem_scheduler_t *sched) {
+    if (!sched) return -1;
+    
+    long long now = scheduler_now_ns(sched);
+    
+    // Опоздали: запускаем цикл сразу, пропущенные дедлайны не копим.
+    // Готовые дескрипторы все равно обслуживаем, иначе при медленной шине сокеты голодают
+    if (now >= sched->next_ns) {
+        long long behind = (now - sched->next_ns) / sched->interval_ns;
+        sched->next_ns += (behind + 1) * sched->interval_ns;
+        sched->missed += behind;
+        sched->retry_ns = 0;
+        scheduler_dispatch(sched, 0);
+        return (int)behind;
+    }
+    
+    if (sched->retry_ns != 0 && now >= sched->retry_ns) {
+        sched->retry_ns = 0;
+        scheduler_dispatch(sched, 0);
+        return SCHEDULER_RETRY;
+    }
+    
+    // Часы реального времени перевели назад - строим сетку заново
+    if (sched->align && sched->next_ns - now > 2 * sched->interval_ns) {
+        sched->next_ns = scheduler_first_deadline(sched, now);
+    }
+    
+    long long deadline = sched->next_ns;
+    int retry = sched->retry_ns != 0 && sched->retry_ns < deadline;
+    if (retry) {
+        deadline = sched->retry_ns;
+    }
+    
+    struct itimerspec its = {
+        .it_interval = {0, 0},
+        .it_value = ns_to_timespec(deadline)
+    };
+    if (timerfd_settime(sched->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+        syslog(LOG_ERR, "Failed to arm timerfd: %s", strerror(errno));
+        return -1;
+    }
+    
+    while (keep_running) {
+        int expired = scheduler_dispatch(sched, -1);
+        if (expired < 0) {
+            return -1;
+        }
+        if (expired) {
+            if (retry) {
+                sched->retry_ns = 0;
+                return SCHEDULER_RETRY;
+            }
+            sched->next_ns += sched->interval_ns;
+            sched->retry_ns = 0;
+            return 0;
+        }
+        // Сигнал (SIGHUP, SIGUSR1) обрабатывается сразу, дедлайн остается прежним
+        if (sched->woken) {
+            sched->woken = 0;
+            return SCHEDULER_WAKEUP;
+        }
+    }
+    
+    return -1;
+}
+
+// Закрытие дескрипторов планировщика
+void scheduler_close(pzem_scheduler_t *sched) {
+    if (!sched) return;
+    
+    if (sched->wakeup.fd >= 0) {
+        close(sched->wakeup.fd);
+        sched->wakeup.fd = -1;
+    }
+    if (sched->timer_fd >= 0) {
+        close(sched->timer_fd);
+        sched->timer_fd = -1;
+    }
+    if (sched->epoll_fd >= 0) {
+        close(sched->epoll_fd);
+        sched->epoll_fd = -1;
+    }
+}
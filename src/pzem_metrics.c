@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Экспорт метрик в текстовом формате Prometheus для /metrics встроенного HTTP сервера.
+// Ответ собирается из уже имеющихся в памяти значений в потоке опроса, без ожиданий.
+// Здесь же гистограммы задержек с логарифмическими корзинами.
+
+#include "pzem_monitor.h"
+
+// Имена метрик по группам каналов
+static const struct {
+    const char *name;
+    const char *help;
+} group_metrics[] = {
+    [PZEM_GROUP_VOLTAGE] = {"pzem_voltage_volts", "Phase voltage"},
+    [PZEM_GROUP_CURRENT] = {"pzem_current_amperes", "Phase current"},
+    [PZEM_GROUP_FREQUENCY] = {"pzem_frequency_hertz", "Phase frequency"},
+    [PZEM_GROUP_ANGLEV] = {"pzem_voltage_angle_degrees", "Voltage phase angle relative to phase A"},
+    [PZEM_GROUP_ANGLEI] = {"pzem_current_angle_degrees", "Current phase angle relative to voltage"},
+    [PZEM_GROUP_POWER] = {"pzem_power_watts", "Phase active power"}
+};
+
+#define GROUP_METRIC_COUNT (int)(sizeof(group_metrics) / sizeof(group_metrics[0]))
+
+// Номер корзины: наименьшее i, для которого value <= 2^i
+static int histogram_bucket(uint64_t value) {
+    if (value <= 1) return 0;
+    int bucket = 64 - __builtin_clzll(value - 1);
+    return bucket < PZEM_HIST_BUCKETS - 1 ? bucket : PZEM_HIST_BUCKETS - 1;
+}
+
+// Добавление значения; писатель у каждой гистограммы один, поэтому max без CAS
+void histogram_add(pzem_histogram_t *hist, uint64_t value) {
+    if (!hist) return;
+    
+    atomic_fetch_add_explicit(&hist->buckets[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+    }
+}
+
+// Оценка квантиля сверху: граница корзины, не больше максимума
+uint64_t histogram_quantile(const pzem_histogram_t *hist, double q) {
+    if (!hist) return 0;
+    
+    uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    if (count == 0) return 0;
+    
+    uint64_t rank = (uint64_t)(q * (double)count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < PZEM_HIST_BUCKETS - 1; i++) {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t bound = 1ull << i;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+static void metric_header(http_conn_t *conn, const char *name, const char *type, const char *help) {
+    http_printf(conn, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metric_value(http_conn_t *conn, const char *name, double value) {
+    http_printf(conn, "%s %.15g\n", name, value);
+}
+
+// Метрика с меткой устройства для каждого устройства шины
+#define DEVICE_METRIC(conn, metric, type, help, expr) do { \
+    metric_header(conn, metric, type, help); \
+    for (int i = 0; i < device_count; i++) { \
+        const pzem_device_t *dev = &devices[i]; \
+        http_printf(conn, "%s{device=\"%s\",addr=\"%d\"} %.15g\n", metric, dev->name, dev->slave_addr, \
+                    (double)(expr)); \
+    } \
+} while (0)
+
+// Гистограмма Prometheus: накопительные корзины, scale переводит единицы гистограммы
+static void metric_histogram(http_conn_t *conn, const char *name, const char *help,
+                             const pzem_histogram_t *hist, double scale) {
+    metric_header(conn, name, "histogram", help);
+    
+    uint64_t cumulative = 0;
+    for (int i = 0; i < PZEM_HIST_BUCKETS - 1; i++) {
+        cumulative += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        http_printf(conn, "%s_bucket{le=\"%.6g\"} %llu\n", name, (double)(1ull << i) * scale,
+                    (unsigned long long)cumulative);
+    }
+    cumulative += atomic_load_explicit(&hist->buckets[PZEM_HIST_BUCKETS - 1], memory_order_relaxed);
+    http_printf(conn, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+    http_printf(conn, "%s_sum %.15g\n", name, (double)atomic_load_explicit(&hist->sum, memory_order_relaxed) * scale);
+    http_printf(conn, "%s_count %llu\n", name, (unsigned long long)cumulative);
+}
+
+// Последние значения каналов и состояния порогов
+static void metrics_channels(http_conn_t *conn) {
+    char value[32];
+    
+    for (int group = 0; group < GROUP_METRIC_COUNT; group++) {
+        metric_header(conn, group_metrics[group].name, "gauge", group_metrics[group].help);
+        for (int i = 0; i < device_count; i++) {
+            const pzem_device_t *dev = &devices[i];
+            // Значения неудачного чтения не отдаем, чтобы не рисовать устаревшие данные
+            if (dev->current.status != 0 || dev->current.sample.timestamp_ms == 0) continue;
+    
+            for (int ch = 0; ch < PZEM_CHANNEL_COUNT; ch++) {
+                if ((int)pzem_channels[ch].group != group) continue;
+                size_t len = format_channel_value(value, &dev->current.sample, ch);
+                const char *name = pzem_channels[ch].name;
+                http_printf(conn, "%s{device=\"%s\",addr=\"%d\",phase=\"%c\"} %.*s\n", group_metrics[group].name,
+                            dev->name, dev->slave_addr, name[strlen(name) - 1], (int)len, value);
+            }
+        }
+    }
+    
+    metric_header(conn, "pzem_threshold_state", "gauge", "Threshold state: 1 high, 0 normal, -1 low");
+    for (int i = 0; i < device_count; i++) {
+        const pzem_device_t *dev = &devices[i];
+        if (dev->current.status != 0 || dev->current.sample.timestamp_ms == 0) continue;
+    
+        for (int ch = 0; ch < PZEM_STATE_COUNT; ch++) {
+            char state = dev->current.state[ch];
+            http_printf(conn, "pzem_threshold_state{device=\"%s\",addr=\"%d\",channel=\"%s\"} %d\n",
+                        dev->name, dev->slave_addr, pzem_channels[ch].name,
+                        state == 'H' ? 1 : state == 'L' ? -1 : 0);
+        }
+    }
+}
+
+// Полный ответ /metrics
+void metrics_render(http_conn_t *conn) {
+    if (!conn) return;
+    
+    DEVICE_METRIC(conn, "pzem_up", "gauge", "1 if the last read of the device succeeded",
+                  dev->current.status == 0 && dev->current.sample.timestamp_ms != 0);
+    DEVICE_METRIC(conn, "pzem_last_sample_timestamp_seconds", "gauge", "Time of the last read",
+                  dev->current.sample.timestamp_ms / 1000.0);
+    DEVICE_METRIC(conn, "pzem_reads_total", "counter", "Modbus reads of the device", dev->reads);
+    DEVICE_METRIC(conn, "pzem_read_errors_total", "counter", "Failed Modbus reads of the device", dev->read_errors);
+    
+    metric_header(conn, "pzem_modbus_timeout_seconds", "gauge", "Current response timeout per register group");
+    for (int i = 0; i < device_count; i++) {
+        const pzem_device_t *dev = &devices[i];
+        for (int g = 0; g < global_config.reg_group_count; g++) {
+            const pzem_reg_group_t *group = &global_config.reg_groups[g];
+            http_printf(conn, "pzem_modbus_timeout_seconds{device=\"%s\",addr=\"%d\",registers=\"%d-%d\"} %.15g\n",
+                        dev->name, dev->slave_addr, group->start, group->start + group->count - 1,
+                        dev->rtt[g].timeout_us / 1e6);
+        }
+    }
+    metrics_channels(conn);
+    
+    // Цикл опроса
+    metric_header(conn, "pzem_uptime_seconds", "gauge", "Time since start");
+    metric_value(conn, "pzem_uptime_seconds", (get_time_ms() - metrics.start_time) / 1000.0);
+    metric_header(conn, "pzem_poll_interval_seconds", "gauge", "Current poll interval, changes in adaptive mode");
+    metric_value(conn, "pzem_poll_interval_seconds", metrics.poll_interval_ms / 1000.0);
+    metric_header(conn, "pzem_iterations_total", "counter", "Poll cycles");
+    metric_value(conn, "pzem_iterations_total", (double)metrics.total_iterations);
+    metric_header(conn, "pzem_iteration_errors_total", "counter", "Failed device reads over all cycles");
+    metric_value(conn, "pzem_iteration_errors_total", (double)metrics.error_count);
+    metric_header(conn, "pzem_modbus_seconds_total", "counter", "Time spent in Modbus reads");
+    metric_value(conn, "pzem_modbus_seconds_total", metrics.modbus_time_total / 1000.0);
+    metric_header(conn, "pzem_iteration_seconds_total", "counter", "Time spent in poll cycles");
+    metric_value(conn, "pzem_iteration_seconds_total", metrics.processing_time_total / 1000.0);
+    metric_header(conn, "pzem_iteration_max_seconds", "gauge", "Longest poll cycle");
+    metric_value(conn, "pzem_iteration_max_seconds", metrics.max_iteration_time / 1000.0);
+    metric_header(conn, "pzem_missed_deadlines_total", "counter", "Poll periods skipped because a cycle ran late");
+    metric_value(conn, "pzem_missed_deadlines_total", (double)metrics.missed_deadlines);
+    metric_header(conn, "pzem_reconnects_total", "counter", "Modbus reconnect attempts after the whole bus went silent");
+    metric_value(conn, "pzem_reconnects_total", (double)metrics.reconnects);
+    metric_header(conn, "pzem_read_retries_total", "counter", "Failed reads retried from the event loop");
+    metric_value(conn, "pzem_read_retries_total", (double)metrics.retries);
+    metric_header(conn, "pzem_link_state", "gauge", "Bus connection: 0 connected, 1 backing off, 2 reconnecting");
+    metric_value(conn, "pzem_link_state", (double)bus_link.state);
+    metric_header(conn, "pzem_link_down_seconds_total", "counter", "Time without a Modbus connection, closed outages");
+    metric_value(conn, "pzem_link_down_seconds_total", metrics.link_down_ms / 1000.0);
+    
+    metric_histogram(conn, "pzem_modbus_rtt_seconds", "Modbus request round trip time", &metrics.modbus_rtt_us, 1e-6);
+    metric_histogram(conn, "pzem_modbus_attempts", "Attempts per device read", &metrics.modbus_attempts, 1);
+    metric_histogram(conn, "pzem_processing_seconds", "Sample processing time after the read", 
+                     &metrics.processing_us, 1e-6);
+    metric_histogram(conn, "pzem_log_flush_seconds", "Log batch write time including fdatasync", 
+                     &metrics.flush_us, 1e-6);
+    metric_histogram(conn, "pzem_poll_interval_actual_seconds", "Time between poll cycle starts", 
+                     &metrics.interval_us, 1e-6);
+    
+    // Очередь потока записи
+    const log_queue_t *queue = &log_writer.queue;
+    if (queue->slots != NULL) {
+        metric_header(conn, "pzem_log_queue_depth", "gauge", "Lines waiting for the log writer thread");
+        metric_value(conn, "pzem_log_queue_depth", log_queue_depth(queue));
+        metric_header(conn, "pzem_log_queue_capacity", "gauge", "Log queue size");
+        metric_value(conn, "pzem_log_queue_capacity", queue->capacity);
+        metric_header(conn, "pzem_log_queue_max_depth", "gauge", "Highest log queue depth seen");
+        metric_value(conn, "pzem_log_queue_max_depth", atomic_load(&queue->max_depth));
+        metric_header(conn, "pzem_log_lines_total", "counter", "Lines passed to the log writer thread");
+        metric_value(conn, "pzem_log_lines_total", (double)atomic_load(&queue->enqueued));
+        metric_header(conn, "pzem_log_dropped_total", "counter", "Lines dropped because the log queue was full");
+        metric_value(conn, "pzem_log_dropped_total", (double)atomic_load(&queue->dropped));
+        metric_header(conn, "pzem_log_write_dropped_total", "counter", "Lines dropped because the log file could not be opened");
+        metric_value(conn, "pzem_log_write_dropped_total", (double)atomic_load(&queue->write_dropped));
+    }
+    
+    // Раздача данных
+    DEVICE_METRIC(conn, "pzem_subscribers", "gauge", "Clients connected to the data socket", dev->pubsub.client_count);
+    DEVICE_METRIC(conn, "pzem_subscriber_lines_total", "counter", "Lines published to the data socket",
+                  dev->pubsub.published);
+    DEVICE_METRIC(conn, "pzem_subscriber_dropped_total", "counter", "Lines dropped for slow subscribers",
+                  dev->pubsub.dropped);
+    DEVICE_METRIC(conn, "pzem_history_samples", "gauge", "Samples held in memory for /range", dev->history.count);
+    
+    if (shm_ring.hdr != NULL) {
+        metric_header(conn, "pzem_shm_records_total", "counter", "Samples written to the shared memory ring");
+        metric_value(conn, "pzem_shm_records_total", (double)shm_ring.next);
+    }
+    
+    metric_header(conn, "pzem_http_requests_total", "counter", "HTTP requests served");
+    metric_value(conn, "pzem_http_requests_total", (double)http_server.requests);
+    metric_header(conn, "pzem_http_streams", "gauge", "Open /live streams");
+    metric_value(conn, "pzem_http_streams", http_server.streams);
+    metric_header(conn, "pzem_http_stream_dropped_total", "counter", "Events dropped for slow /live clients");
+    metric_value(conn, "pzem_http_stream_dropped_total", (double)http_server.sse_dropped);
+}
@@ -22,28 +22,46 @@ THE SOFTWARE.
 */
 
 #include "pzem_monitor.h"
+#include <modbus/modbus.h>
 const char *version = "1.0.0";
 // Глобальные переменные
 modbus_t *ctx = NULL;
 volatile sig_atomic_t keep_running = 1;
-log_buffer_t log_buffer = {0};
+volatile sig_atomic_t dump_metrics = 0;
+volatile sig_atomic_t reload_requested = 0;
+pzem_device_t devices[PZEM_MAX_DEVICES];
+int device_count = 0;
 pzem_config_t global_config;
 char *service_name = "pzem3";
 char config_name[64] = "default";
-char fifo_path[256];
 char device_type = 'U';
 performance_metrics_t metrics = {0};
-
-// Макрос для проверки изменений
-#define CHECK_CHANGE(field, sensitivity) \
-    (fabsf(current->field - previous->field) > config->sensitivity)
+pzem_scheduler_t scheduler = {.epoll_fd = -1, .timer_fd = -1, .wakeup = {.fd = -1}};
+static int poll_activity = 0;            // в текущем цикле были изменения или значения у порогов
+static unsigned long long poll_tick = 0; // номер цикла базового периода для групп регистров
+static int cycle_failed = 0;             // устройств, не прочитанных в текущем цикле
+static pzem_rtt_t bus_rtt;               // время ответа по всей шине, начальная оценка для новых групп
+static char config_path[512];            // файл конфигурации для перечитывания по SIGHUP
 
 // Обработчик сигналов
 void signal_handler(int sig) {
+    // SIGUSR1 - снимок метрик в syslog без остановки
+    if (sig == SIGUSR1) {
+        dump_metrics = 1;
+        scheduler_wakeup(&scheduler);
+        return;
+    }
+    // SIGHUP - перечитать конфигурацию между циклами опроса
+    if (sig == SIGHUP) {
+        reload_requested = 1;
+        scheduler_wakeup(&scheduler);
+        return;
+    }
 #ifdef DEBUG
     syslog(LOG_DEBUG, "Received signal %d, shutting down", sig);
 #endif
     keep_running = 0;
+    scheduler_wakeup(&scheduler);
 }
 
 void setup_signal_handlers(void) {
@@ -55,14 +73,11 @@ void setup_signal_handlers(void) {
     
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
     
-    // Игнорируем SIGPIPE чтобы не падать при проблемах с FIFO
+    // Игнорируем SIGPIPE чтобы не падать при отключении подписчиков
     signal(SIGPIPE, SIG_IGN);
-    signal(SIGHUP, SIG_IGN);
-}
-
-float lsbVal(uint16_t dat) {
-    return (float)(((dat & 0xFF) << 8) | (dat >> 8));
 }
 
 // Функция извлечения имени конфигурации из пути
@@ -90,59 +105,120 @@ void extract_config_name(const char *config_path) {
     }
 }
 
-// Инициализация FIFO
-int init_data_fifo(const char *fifo_path) {
-    if (!fifo_path) {
+// Разбор списка адресов вида "1, 2, 5"
+int parse_slave_list(const char *value, int *addrs, int max_count) {
+    if (!value || !addrs || max_count <= 0) {
         return -1;
     }
     
-    unlink(fifo_path);
-    if (mkfifo(fifo_path, 0666) == -1) {
-        syslog(LOG_ERR, "Failed to create FIFO %s: %s", fifo_path, strerror(errno));
-        return -1;
+    int count = 0;
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == ',' || *p == '\t') p++;
+        if (*p == '\0' || *p == '#') break;
+        
+        char *end;
+        long addr = strtol(p, &end, 10);
+        if (end == p) {
+            return -1;
+        }
+        if (count >= max_count) {
+            syslog(LOG_WARNING, "Too many slave addresses, only first %d used", max_count);
+            break;
+        }
+        addrs[count++] = (int)addr;
+        p = end;
     }
-    syslog(LOG_INFO, "Data FIFO created: %s", fifo_path);
+    return count;
+}
+
+// Разбор группы регистров "6-19@2000" или "7@500", 0 при успехе
+int parse_reg_group(const char *value, pzem_reg_group_t *group) {
+    if (!value || !group) return -1;
+    
+    char *end;
+    long first = strtol(value, &end, 10);
+    if (end == value) return -1;
+    long last = first;
+    if (*end == '-') {
+        const char *p = end + 1;
+        last = strtol(p, &end, 10);
+        if (end == p) return -1;
+    }
+    while (*end == ' ') end++;
+    if (*end != '@') return -1;
+    const char *p = end + 1;
+    long interval = strtol(p, &end, 10);
+    if (end == p) return -1;
+    
+    if (first < 0 || last < first || last >= PZEM_REG_COUNT) return -1;
+    
+    group->start = (int)first;
+    group->count = (int)(last - first + 1);
+    group->interval_ms = (int)interval;
+    group->every = 1;
     return 0;
 }
 
-// Запись данных в FIFO
-int write_to_fifo(const char *fifo_path, const char *data) {
-    if (!fifo_path || !data) {
-        return -1;
-    }
-    
-    int fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
-    if (fd == -1) {
-        if (errno == ENXIO) {
-            return 0; // Нет читателей - это нормально
+// Проверка групп регистров: без пересечений, покрывают все регистры и не делят мощность
+// пополам. Период базового цикла - период самой быстрой группы
+static int validate_reg_groups(pzem_config_t *config) {
+    pzem_reg_group_t *groups = config->reg_groups;
+    int count = config->reg_group_count;
+    
+    // Сортировка вставками по первому регистру
+    for (int i = 1; i < count; i++) {
+        pzem_reg_group_t g = groups[i];
+        int j = i;
+        while (j > 0 && groups[j - 1].start > g.start) {
+            groups[j] = groups[j - 1];
+            j--;
         }
-#ifdef DEBUG
-        syslog(LOG_DEBUG, "Failed to open FIFO %s: %s", fifo_path, strerror(errno));
-#endif
-        return -1;
+        groups[j] = g;
+    }
+    
+    // Быстрее MIN_POLL_INTERVAL можно только короткими запросами, а не всем блоком
+    int min_interval = count > 1 ? MIN_REG_GROUP_INTERVAL : MIN_POLL_INTERVAL;
+    int next = 0;
+    int base = MAX_POLL_INTERVAL;
+    for (int i = 0; i < count; i++) {
+        const pzem_reg_group_t *g = &groups[i];
+        int last = g->start + g->count - 1;
+        if (g->start != next) {
+            syslog(LOG_WARNING, "Register groups overlap or leave a gap at register %d", next);
+            return -1;
+        }
+        // Мощность занимает пары регистров, граница группы не может пройти между ними
+        for (int c = 0; c < PZEM_CHANNEL_COUNT; c++) {
+            const pzem_channel_t *ch = &pzem_channels[c];
+            if (ch->wide && (g->start == ch->reg + 1 || last == ch->reg)) {
+                syslog(LOG_WARNING, "Register group %d-%d splits %s registers", g->start, last, ch->name);
+                return -1;
+            }
+        }
+        if (g->interval_ms < min_interval || g->interval_ms > MAX_POLL_INTERVAL) {
+            syslog(LOG_WARNING, "Register group %d-%d interval out of range (%dms), allowed %d - %dms",
+                   g->start, last, g->interval_ms, min_interval, MAX_POLL_INTERVAL);
+            return -1;
+        }
+        if (g->interval_ms < base) base = g->interval_ms;
+        next = last + 1;
     }
-
-    ssize_t bytes_written = write(fd, data, strlen(data));
-    close(fd);
-    
-    if (bytes_written == -1) {
-#ifdef DEBUG
-        syslog(LOG_DEBUG, "Failed to write to FIFO: %s", strerror(errno));
-#endif
+    if (next != PZEM_REG_COUNT) {
+        syslog(LOG_WARNING, "Register groups do not cover registers %d-%d", next, PZEM_REG_COUNT - 1);
         return -1;
     }
     
-#ifdef DEBUG
-    syslog(LOG_DEBUG, "Successfully wrote to FIFO: %s", fifo_path);
-#endif
-    return 0;
-}
-
-// Очистка FIFO
-void cleanup_fifo(const char *fifo_path) {
-    if (fifo_path) {
-        unlink(fifo_path);
+    for (int i = 0; i < count; i++) {
+        pzem_reg_group_t *g = &groups[i];
+        g->every = (g->interval_ms + base / 2) / base;
+        if (g->every * base != g->interval_ms) {
+            syslog(LOG_WARNING, "Register group %d-%d interval %dms rounded to %dms (multiple of %dms)",
+                   g->start, g->start + g->count - 1, g->interval_ms, g->every * base, base);
+        }
     }
+    config->poll_interval_ms = base;
+    return 0;
 }
 
 // Функция создания директории если не существует
@@ -171,13 +247,28 @@ long long get_time_ms(void) {
     return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
 }
 
+long long get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+// Реальное время в миллисекундах - метка времени измерения
+long long get_wall_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+}
+
 // Функция получения текущей даты в формате YYYY-MM-DD
 void get_current_date(char *date_str, size_t size) {
     if (!date_str || size == 0) return;
     
+    // localtime_r: функция вызывается и из потока записи логов
     time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    strftime(date_str, size, "%Y-%m-%d", tm_info);
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    strftime(date_str, size, "%Y-%m-%d", &tm_info);
 }
 
 // Функция получения текущего времени в формате HH:MM:SS
@@ -185,327 +276,9 @@ void get_current_time(char *time_str, size_t size) {
     if (!time_str || size == 0) return;
     
     time_t t = time(NULL);
-    struct tm *tm_info = localtime(&t);
-    strftime(time_str, size, "%H:%M:%S", tm_info);
-}
-
-// Функция получения пути к файлу лога для текущей даты
-void get_log_file_path(char *path, size_t size, const char *log_dir) {
-    if (!path || !log_dir || size == 0) return;
-    
-    char date_str[32];
-    get_current_date(date_str, sizeof(date_str));
-    snprintf(path, size, "%s/pzem3_%s_%s.log", log_dir, config_name, date_str);
-}
-
-// Функция инициализации буфера логов
-pzem_result_t init_log_buffer(log_buffer_t *buffer, int initial_capacity, const char *log_dir) {
-    if (!buffer || !log_dir || initial_capacity <= 0) {
-        return PZEM_ERROR_INVALID_PARAM;
-    }
-    
-    // Освобождаем старый буфер если есть
-    if (buffer->buffer != NULL) {
-        free_log_buffer(buffer);
-    }
-    
-    // Ограничиваем максимальный размер буфера
-    if (initial_capacity > MAX_LOG_BUFFER_SIZE) {
-        initial_capacity = MAX_LOG_BUFFER_SIZE;
-    }
-    
-    buffer->buffer = (char **)malloc((size_t)initial_capacity * sizeof(char *));
-    if (buffer->buffer == NULL) {
-        syslog(LOG_ERR, "Failed to allocate log buffer");
-        return PZEM_ERROR_MEMORY;
-    }
-    
-    buffer->capacity = initial_capacity;
-    buffer->size = 0;
-    buffer->read_index = 0;
-    buffer->write_index = 0;
-    
-    STRCPY_SAFE(buffer->log_dir, log_dir);
-    STRCPY_SAFE(buffer->config_name, config_name);
-    
-    // Инициализируем мьютекс
-    if (pthread_mutex_init(&buffer->mutex, NULL) != 0) {
-        free(buffer->buffer);
-        buffer->buffer = NULL;
-        return PZEM_ERROR_MEMORY;
-    }
-    
-    // Инициализируем все указатели в NULL
-    for (int i = 0; i < buffer->capacity; i++) {
-        buffer->buffer[i] = NULL;
-    }
-    
-    return PZEM_SUCCESS;
-}
-
-// Функция добавления записи в буфер
-pzem_result_t add_to_log_buffer(log_buffer_t *buffer, const char *log_entry) {
-    if (!buffer || !log_entry || !buffer->buffer) {
-        syslog(LOG_ERR, "Invalid parameters to add_to_log_buffer");
-        return PZEM_ERROR_INVALID_PARAM;
-    }
-    
-    pthread_mutex_lock(&buffer->mutex);
-    
-    // Если буфер полный, сбрасываем его в файл
-    if (buffer->size >= buffer->capacity) {
-#ifdef DEBUG
-        syslog(LOG_DEBUG, "Buffer full (%d/%d), flushing...", buffer->size, buffer->capacity);
-#endif
-        if (flush_log_buffer(buffer) != PZEM_SUCCESS) {
-            pthread_mutex_unlock(&buffer->mutex);
-            syslog(LOG_ERR, "Failed to flush buffer to disk");
-            return PZEM_ERROR_IO;
-        }
-    }
-    
-    char *entry_copy = strdup(log_entry);
-    if (entry_copy == NULL) {
-        pthread_mutex_unlock(&buffer->mutex);
-        syslog(LOG_ERR, "Failed to allocate memory for log entry");
-        return PZEM_ERROR_MEMORY;
-    }
-    
-    // Освобождаем старую запись если нужно
-    if (buffer->buffer[buffer->write_index] != NULL) {
-        free(buffer->buffer[buffer->write_index]);
-    }
-    
-    buffer->buffer[buffer->write_index] = entry_copy;
-    buffer->write_index = (buffer->write_index + 1) % buffer->capacity;
-    
-    if (buffer->size < buffer->capacity) {
-        buffer->size++;
-    } else {
-        // Буфер полный, двигаем read_index
-        buffer->read_index = (buffer->read_index + 1) % buffer->capacity;
-    }
-    
-#ifdef DEBUG
-    syslog(LOG_DEBUG, "Added log entry to buffer (%d/%d)", buffer->size, buffer->capacity);
-#endif
-    
-    pthread_mutex_unlock(&buffer->mutex);
-    return PZEM_SUCCESS;
-}
-
-// Функция сброса буфера в файл
-pzem_result_t flush_log_buffer(log_buffer_t *buffer) {
-    if (!buffer || !buffer->buffer || buffer->size == 0) {
-        return PZEM_SUCCESS;
-    }
-    
-    pthread_mutex_lock(&buffer->mutex);
-    
-    char log_path[512];
-    get_log_file_path(log_path, sizeof(log_path), buffer->log_dir);
-    
-    // Проверяем доступность файла перед записью
-    FILE *test_file = fopen(log_path, "a");
-    if (test_file == NULL) {
-        pthread_mutex_unlock(&buffer->mutex);
-        syslog(LOG_ERR, "Cannot open log file '%s' for appending: %s", log_path, strerror(errno));
-        return PZEM_ERROR_IO;
-    }
-    fclose(test_file);
-    
-    // Теперь открываем для реальной записи
-    FILE *log_file = fopen(log_path, "a");
-    if (log_file == NULL) {
-        pthread_mutex_unlock(&buffer->mutex);
-        syslog(LOG_ERR, "Error opening log file '%s': %s", log_path, strerror(errno));
-        return PZEM_ERROR_IO;
-    }
-    
-    // Устанавливаем правильные права на файл
-    fchmod(fileno(log_file), 0644);
-    
-    for (int i = 0; i < buffer->size; i++) {
-        int index = (buffer->read_index + i) % buffer->capacity;
-        if (buffer->buffer[index] != NULL) {
-            fprintf(log_file, "%s", buffer->buffer[index]);
-            free(buffer->buffer[index]);
-            buffer->buffer[index] = NULL;
-        }
-    }
-    
-#ifdef DEBUG
-    syslog(LOG_DEBUG, "Write log entry to log file %s, size: %d)", log_path, buffer->size);
-#endif
-    
-    fflush(log_file);
-    fclose(log_file);
-    
-    buffer->size = 0;
-    buffer->read_index = 0;
-    buffer->write_index = 0;
-    
-    pthread_mutex_unlock(&buffer->mutex);
-    return PZEM_SUCCESS;
-}
-
-// Функция освобождения буфера
-void free_log_buffer(log_buffer_t *buffer) {
-    if (!buffer) return;
-    
-    pthread_mutex_lock(&buffer->mutex);
-    
-    if (buffer->buffer != NULL) {
-        for (int i = 0; i < buffer->capacity; i++) {
-            safe_free((void**)&buffer->buffer[i]);
-        }
-        free(buffer->buffer);
-        buffer->buffer = NULL;
-    }
-    
-    buffer->size = 0;
-    buffer->capacity = 0;
-    buffer->read_index = 0;
-    buffer->write_index = 0;
-    
-    pthread_mutex_unlock(&buffer->mutex);
-    pthread_mutex_destroy(&buffer->mutex);
-}
-
-// Функция проверки необходимости сброса буфера
-int should_flush_buffer(const log_buffer_t *buffer) {
-    return buffer && buffer->size >= buffer->capacity;
-}
-
-// Вспомогательная функция для обработки одного параметра
-void update_threshold_state(float value, char* state, const threshold_config_t* config) {
-    if (!state || !config) return;
-    
-    if (config->high_alarm > 0) {
-        if (value >= config->high_alarm) {
-            *state = 'H';
-        } else if (value <= config->low_alarm) {
-            *state = 'L';
-        } else if (*state == 'H' && value > config->high_warning) {
-            *state = 'H';
-        } else if (*state == 'L' && value < config->low_warning) {
-            *state = 'L';
-        } else {
-            *state = 'N';
-        }
-    } else {
-        *state = 'N';
-    }
-}
-
-void update_threshold_states(pzem_data_t *data, const pzem_config_t *config) {
-    if (!data || !config) return;
-    
-    // Обработка напряжений
-    threshold_config_t voltage_config = {
-        config->voltage_high_alarm,
-        config->voltage_high_warning,
-        config->voltage_low_warning,
-        config->voltage_low_alarm
-    };
-    
-    update_threshold_state(data->voltage_A, &data->voltage_state_A, &voltage_config);
-    update_threshold_state(data->voltage_B, &data->voltage_state_B, &voltage_config);
-    update_threshold_state(data->voltage_C, &data->voltage_state_C, &voltage_config);
-    
-    // Обработка токов
-    threshold_config_t current_config = {
-        config->current_high_alarm,
-        config->current_high_warning,
-        config->current_low_warning,
-        config->current_low_alarm
-    };
-    
-    update_threshold_state(data->current_A, &data->current_state_A, &current_config);
-    update_threshold_state(data->current_B, &data->current_state_B, &current_config);
-    update_threshold_state(data->current_C, &data->current_state_C, &current_config);
-    
-    // Обработка частот
-    threshold_config_t frequency_config = {
-        config->frequency_high_alarm,
-        config->frequency_high_warning,
-        config->frequency_low_warning,
-        config->frequency_low_alarm
-    };
-    
-    update_threshold_state(data->frequency_A, &data->frequency_state_A, &frequency_config);
-    update_threshold_state(data->frequency_B, &data->frequency_state_B, &frequency_config);
-    update_threshold_state(data->frequency_C, &data->frequency_state_C, &frequency_config);
-    
-    // Обработка углов напряжения
-    threshold_config_t angleV_config = {
-        config->angleV_high_alarm,
-        config->angleV_high_warning,
-        config->angleV_low_warning,
-        config->angleV_low_alarm
-    };
-    
-    update_threshold_state(data->angleV_B, &data->angleV_state_B, &angleV_config);
-    update_threshold_state(data->angleV_C, &data->angleV_state_C, &angleV_config);
-    
-    // Обработка углов тока
-    threshold_config_t angleI_config = {
-        config->angleI_high_alarm,
-        config->angleI_high_warning,
-        config->angleI_low_warning,
-        config->angleI_low_alarm
-    };
-    
-    update_threshold_state(data->angleI_A, &data->angleI_state_A, &angleI_config);
-    update_threshold_state(data->angleI_B, &data->angleI_state_B, &angleI_config);
-    update_threshold_state(data->angleI_C, &data->angleI_state_C, &angleI_config);
-}
-
-// Функция проверки изменения состояний порогов
-int threshold_states_changed(const pzem_data_t *current, const pzem_data_t *previous) {
-    if (!current || !previous) return 1;
-    
-    return (current->voltage_state_A != previous->voltage_state_A) ||
-           (current->voltage_state_B != previous->voltage_state_B) ||
-           (current->voltage_state_C != previous->voltage_state_C) ||
-           (current->current_state_A != previous->current_state_A) ||
-           (current->current_state_B != previous->current_state_B) ||
-           (current->current_state_C != previous->current_state_C) ||
-           (current->frequency_state_A != previous->frequency_state_A) ||
-           (current->frequency_state_B != previous->frequency_state_B) ||
-           (current->frequency_state_C != previous->frequency_state_C) ||
-           (current->angleV_state_B != previous->angleV_state_B) ||
-           (current->angleV_state_C != previous->angleV_state_C) ||
-           (current->angleI_state_A != previous->angleI_state_A) ||
-           (current->angleI_state_B != previous->angleI_state_B) ||
-           (current->angleI_state_C != previous->angleI_state_C);
-}
-
-// Функция подготовки строки лога с датой и временем
-void prepare_log_entry(char *log_entry, size_t size, const pzem_data_t *data) {
-    if (!log_entry || !data || size == 0) return;
-    
-    char date_str[32];
-    char time_str[32];
-    get_current_date(date_str, sizeof(date_str));
-    get_current_time(time_str, sizeof(time_str));
-    
-    if (data->status == 0) {
-        snprintf(log_entry, size, 
-                 "%s,%s,%.1f,%c,%.1f,%c,%.1f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.2f,%c,%.1f,%.1f,%.1f,%d\n",
-                 date_str, time_str,
-                 data->voltage_A, data->voltage_state_A, data->voltage_B, data->voltage_state_B, 
-                 data->voltage_C, data->voltage_state_C, data->current_A, data->current_state_A,
-                 data->current_B, data->current_state_B, data->current_C, data->current_state_C,
-                 data->frequency_A, data->frequency_state_A, data->frequency_B, data->frequency_state_B,
-                 data->frequency_C, data->frequency_state_C, data->angleV_B, data->angleV_state_B,
-                 data->angleV_C, data->angleV_state_C, data->angleI_A, data->angleI_state_A,
-                 data->angleI_B, data->angleI_state_B, data->angleI_C, data->angleI_state_C,
-                 data->power_A, data->power_B, data->power_C, data->status);
-    } else {
-        snprintf(log_entry, size, "%s,%s,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,-,%d\n",
-                 date_str, time_str, data->status);
-    }
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    strftime(time_str, size, "%H:%M:%S", &tm_info);
 }
 
 // Валидация конфигурации
@@ -524,13 +297,28 @@ pzem_result_t validate_config(const pzem_config_t *config) {
         return PZEM_ERROR_CONFIG;
     }
     
-    if (config->slave_addr < 1 || config->slave_addr > 247) {
-        syslog(LOG_ERR, "Invalid configuration: slave_addr must be between 1 and 247");
+    if (config->slave_count < 1) {
+        syslog(LOG_ERR, "Invalid configuration: slave_addr is empty");
         return PZEM_ERROR_CONFIG;
     }
     
-    if (config->poll_interval_ms < MIN_POLL_INTERVAL) {
-        syslog(LOG_ERR, "Invalid configuration: poll_interval_ms must be at least %dms", MIN_POLL_INTERVAL);
+    for (int i = 0; i < config->slave_count; i++) {
+        if (config->slave_addrs[i] < 1 || config->slave_addrs[i] > 247) {
+            syslog(LOG_ERR, "Invalid configuration: slave_addr must be between 1 and 247");
+            return PZEM_ERROR_CONFIG;
+        }
+        for (int j = 0; j < i; j++) {
+            if (config->slave_addrs[i] == config->slave_addrs[j]) {
+                syslog(LOG_ERR, "Invalid configuration: duplicate slave_addr %d", config->slave_addrs[i]);
+                return PZEM_ERROR_CONFIG;
+            }
+        }
+    }
+    
+    // С группами регистров базовый период - период самой быстрой группы
+    int min_interval = config->reg_group_count > 1 ? MIN_REG_GROUP_INTERVAL : MIN_POLL_INTERVAL;
+    if (config->poll_interval_ms < min_interval) {
+        syslog(LOG_ERR, "Invalid configuration: poll_interval_ms must be at least %dms", min_interval);
         return PZEM_ERROR_CONFIG;
     }
     
@@ -542,37 +330,6 @@ pzem_result_t validate_config(const pzem_config_t *config) {
     return validate_thresholds(config);
 }
 
-// Валидация порогов
-pzem_result_t validate_thresholds(const pzem_config_t *config) {
-    const struct {
-        float high_alarm, high_warning, low_warning, low_alarm;
-        const char *name;
-    } thresholds[] = {
-        {config->voltage_high_alarm, config->voltage_high_warning, 
-         config->voltage_low_warning, config->voltage_low_alarm, "voltage"},
-        {config->current_high_alarm, config->current_high_warning,
-         config->current_low_warning, config->current_low_alarm, "current"},
-        {config->frequency_high_alarm, config->frequency_high_warning,
-         config->frequency_low_warning, config->frequency_low_alarm, "frequency"},
-        {config->angleV_high_alarm, config->angleV_high_warning,
-         config->angleV_low_warning, config->angleV_low_alarm, "angleV"},
-        {config->angleI_high_alarm, config->angleI_high_warning,
-         config->angleI_low_warning, config->angleI_low_alarm, "angleI"}
-    };
-    
-    for (size_t i = 0; i < sizeof(thresholds)/sizeof(thresholds[0]); i++) {
-        if (thresholds[i].high_alarm > 0) {
-            if (thresholds[i].high_alarm <= thresholds[i].high_warning ||
-                thresholds[i].high_warning <= thresholds[i].low_warning ||
-                thresholds[i].low_warning <= thresholds[i].low_alarm) {
-                syslog(LOG_ERR, "Invalid %s thresholds order", thresholds[i].name);
-                return PZEM_ERROR_CONFIG;
-            }
-        }
-    }
-    return PZEM_SUCCESS;
-}
-
 // Функция загрузки конфигурации из файла
 pzem_result_t load_config(const char *config_file, pzem_config_t *config) {
     if (!config_file || !config) {
@@ -590,9 +347,40 @@ pzem_result_t load_config(const char *config_file, pzem_config_t *config) {
         .tty_port = "/dev/ttyS1@9600",
         .baudrate = 9600,
         .slave_addr = 1,
+        .slave_addrs = {1},
+        .slave_count = 1,
         .poll_interval_ms = DEFAULT_POLL_INTERVAL,
+        .poll_interval_min_ms = MIN_POLL_INTERVAL,
+        .poll_interval_max_ms = DEFAULT_POLL_INTERVAL_MAX,
+        .poll_adaptive_margin = DEFAULT_POLL_ADAPTIVE_MARGIN,
+        .poll_adaptive_hold = DEFAULT_POLL_ADAPTIVE_HOLD,
+        .modbus_timeout_ms = DEFAULT_MODBUS_TIMEOUT_MS,
+        .modbus_timeout_auto = 1,
+        .modbus_timeout_min_ms = DEFAULT_MODBUS_TIMEOUT_MIN_MS,
+        .modbus_timeout_margin_ms = DEFAULT_MODBUS_TIMEOUT_MARGIN_MS,
+        .reconnect_delay_ms = DEFAULT_RECONNECT_DELAY_MS,
+        .reconnect_max_delay_ms = DEFAULT_RECONNECT_MAX_DELAY_MS,
         .log_dir = "/var/log/pzem3",
-        .log_buffer_size = 10,
+        .log_buffer_size = 0,
+        .log_buffer_bytes = DEFAULT_LOG_BUFFER_BYTES,
+        .log_flush_max_age_s = DEFAULT_LOG_FLUSH_MAX_AGE,
+        .log_queue_size = DEFAULT_LOG_QUEUE_SIZE,
+        .log_prealloc_kb = 0,
+        .log_sync = LOG_SYNC_NONE,
+        .log_sync_interval_s = 60,
+        .log_mode = LOG_MODE_CHANGE,
+        .log_max_silence_s = DEFAULT_LOG_MAX_SILENCE,
+        .rollup_periods = {60, 900, 3600},
+        .rollup_count = 3,
+        .log_format = PZEM_FORMAT_CSV,
+        .pubsub_format = PZEM_FORMAT_CSV,
+        .pubsub_max_clients = DEFAULT_PUBSUB_MAX_CLIENTS,
+        .pubsub_queue_size = DEFAULT_PUBSUB_QUEUE_SIZE,
+        .shm_records = DEFAULT_SHM_RECORDS,
+        .history_size = DEFAULT_HISTORY_SIZE,
+        .http_port = 0,
+        .http_bind = "0.0.0.0",
+        .http_page = DEFAULT_HTTP_PAGE,
         .voltage_sensitivity = 0.1f,
         .current_sensitivity = 0.01f,
         .frequency_sensitivity = 0.01f,
@@ -601,13 +389,29 @@ pzem_result_t load_config(const char *config_file, pzem_config_t *config) {
         .power_sensitivity = 1.0f,
     };
     
-    char line[256];
+    // Значение читается в буфер размера строки, так что обрезаться может только сама строка
+    char line[512];
     while (fgets(line, sizeof(line), file)) {
+        int too_long = strchr(line, '\n') == NULL && !feof(file);
+        if (too_long) {
+            // Хвост не должен разбираться как отдельный параметр
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n') {
+            }
+        }
+        
         // Пропускаем комментарии и пустые строки
         if (line[0] == '#' || line[0] == '\n') continue;
         
-        char key[64], value[64];
-        if (sscanf(line, "%63[^ =] = %63[^\n]", key, value) == 2) {
+        // Обрезанное значение (например, список slave_addr) молча не принимаем
+        if (too_long) {
+            syslog(LOG_ERR, "Config line too long (max %zu characters): '%.40s...'", sizeof(line) - 2, line);
+            fclose(file);
+            return PZEM_ERROR_CONFIG;
+        }
+        
+        char key[64], value[sizeof(line)];
+        if (sscanf(line, "%63[^ =] = %511[^\n]", key, value) == 2) {
             char *trimmed_value = value;
             while (*trimmed_value == ' ') trimmed_value++;
             
@@ -617,11 +421,115 @@ pzem_result_t load_config(const char *config_file, pzem_config_t *config) {
             } else if (strcmp(key, "log_dir") == 0) {
                 STRCPY_SAFE(config->log_dir, trimmed_value);
             } else if (strcmp(key, "slave_addr") == 0) {
-                config->slave_addr = atoi(trimmed_value);
+                config->slave_count = parse_slave_list(trimmed_value, config->slave_addrs, PZEM_MAX_DEVICES);
+                if (config->slave_count < 0) {
+                    syslog(LOG_WARNING, "Invalid slave_addr list: '%s'", trimmed_value);
+                    config->slave_count = 0;
+                }
+                config->slave_addr = config->slave_count > 0 ? config->slave_addrs[0] : 0;
             } else if (strcmp(key, "poll_interval_ms") == 0) {
                 config->poll_interval_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_align") == 0) {
+                config->poll_align = atoi(trimmed_value);
+            } else if (strcmp(key, "reg_group") == 0) {
+                if (config->reg_group_count >= PZEM_MAX_REG_GROUPS) {
+                    syslog(LOG_WARNING, "Too many register groups, only first %d used", PZEM_MAX_REG_GROUPS);
+                } else if (parse_reg_group(trimmed_value, &config->reg_groups[config->reg_group_count]) != 0) {
+                    syslog(LOG_WARNING, "Invalid reg_group: '%s'", trimmed_value);
+                } else {
+                    config->reg_group_count++;
+                }
+            } else if (strcmp(key, "modbus_timeout_ms") == 0) {
+                config->modbus_timeout_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "modbus_timeout_auto") == 0) {
+                config->modbus_timeout_auto = atoi(trimmed_value);
+            } else if (strcmp(key, "modbus_timeout_min_ms") == 0) {
+                config->modbus_timeout_min_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "modbus_timeout_margin_ms") == 0) {
+                config->modbus_timeout_margin_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "reconnect_delay_ms") == 0) {
+                config->reconnect_delay_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "reconnect_max_delay_ms") == 0) {
+                config->reconnect_max_delay_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_adaptive") == 0) {
+                config->poll_adaptive = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_interval_min_ms") == 0) {
+                config->poll_interval_min_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_interval_max_ms") == 0) {
+                config->poll_interval_max_ms = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_adaptive_margin") == 0) {
+                config->poll_adaptive_margin = atoi(trimmed_value);
+            } else if (strcmp(key, "poll_adaptive_hold") == 0) {
+                config->poll_adaptive_hold = atoi(trimmed_value);
             } else if (strcmp(key, "log_buffer_size") == 0) {
                 config->log_buffer_size = atoi(trimmed_value);
+            } else if (strcmp(key, "log_buffer_bytes") == 0) {
+                config->log_buffer_bytes = atoi(trimmed_value);
+            } else if (strcmp(key, "log_flush_max_age_s") == 0) {
+                config->log_flush_max_age_s = atoi(trimmed_value);
+            } else if (strcmp(key, "log_queue_size") == 0) {
+                config->log_queue_size = atoi(trimmed_value);
+            } else if (strcmp(key, "log_prealloc_kb") == 0) {
+                config->log_prealloc_kb = atoi(trimmed_value);
+            } else if (strcmp(key, "log_sync") == 0) {
+                if (strncmp(trimmed_value, "none", 4) == 0) {
+                    config->log_sync = LOG_SYNC_NONE;
+                } else if (strncmp(trimmed_value, "batch", 5) == 0) {
+                    config->log_sync = LOG_SYNC_BATCH;
+                } else if (strncmp(trimmed_value, "periodic", 8) == 0) {
+                    config->log_sync = LOG_SYNC_PERIODIC;
+                } else {
+                    syslog(LOG_WARNING, "Unknown log_sync mode '%s', using none", trimmed_value);
+                    config->log_sync = LOG_SYNC_NONE;
+                }
+            } else if (strcmp(key, "log_sync_interval_s") == 0) {
+                config->log_sync_interval_s = atoi(trimmed_value);
+            } else if (strcmp(key, "log_mode") == 0) {
+                if (strncmp(trimmed_value, "change", 6) == 0) {
+                    config->log_mode = LOG_MODE_CHANGE;
+                } else if (strncmp(trimmed_value, "sdt", 3) == 0) {
+                    config->log_mode = LOG_MODE_SDT;
+                } else {
+                    syslog(LOG_WARNING, "Unknown log_mode '%s', using change", trimmed_value);
+                    config->log_mode = LOG_MODE_CHANGE;
+                }
+            } else if (strcmp(key, "log_max_silence_s") == 0) {
+                config->log_max_silence_s = atoi(trimmed_value);
+            } else if (strcmp(key, "rollup_periods") == 0) {
+                config->rollup_count = parse_rollup_periods(trimmed_value, config->rollup_periods, PZEM_MAX_ROLLUPS);
+                if (config->rollup_count < 0) {
+                    syslog(LOG_WARNING, "Invalid rollup_periods list: '%s', rollups disabled", trimmed_value);
+                    config->rollup_count = 0;
+                }
+            } else if (strcmp(key, "log_format") == 0 || strcmp(key, "pubsub_format") == 0) {
+                int format = parse_output_format(trimmed_value);
+                if (format < 0) {
+                    syslog(LOG_WARNING, "Unknown %s '%s', using csv", key, trimmed_value);
+                    format = PZEM_FORMAT_CSV;
+                }
+                if (key[0] == 'l') {
+                    config->log_format = (pzem_format_t)format;
+                } else if (format == PZEM_FORMAT_COMPRESSED) {
+                    // Сжатие идет блоками, подписчикам нужны отдельные записи
+                    syslog(LOG_WARNING, "pubsub_format compressed is log only, using binary");
+                    config->pubsub_format = PZEM_FORMAT_BINARY;
+                } else {
+                    config->pubsub_format = (pzem_format_t)format;
+                }
+            } else if (strcmp(key, "pubsub_max_clients") == 0) {
+                config->pubsub_max_clients = atoi(trimmed_value);
+            } else if (strcmp(key, "pubsub_queue_size") == 0) {
+                config->pubsub_queue_size = atoi(trimmed_value);
+            } else if (strcmp(key, "shm_records") == 0) {
+                config->shm_records = atoi(trimmed_value);
+            } else if (strcmp(key, "history_size") == 0) {
+                config->history_size = atoi(trimmed_value);
+            } else if (strcmp(key, "http_port") == 0) {
+                config->http_port = atoi(trimmed_value);
+            } else if (strcmp(key, "http_bind") == 0) {
+                STRCPY_SAFE(config->http_bind, trimmed_value);
+            } else if (strcmp(key, "http_page") == 0) {
+                STRCPY_SAFE(config->http_page, trimmed_value);
             } else if (strcmp(key, "voltage_sensitivity") == 0) {
                 config->voltage_sensitivity = (float)atof(trimmed_value);
             } else if (strcmp(key, "current_sensitivity") == 0) {
@@ -731,45 +639,179 @@ pzem_result_t load_config(const char *config_file, pzem_config_t *config) {
         config->poll_interval_ms = MAX_POLL_INTERVAL;
     }
     
-    if (config->log_buffer_size < 1) {
-        syslog(LOG_WARNING, "Log buffer size too small (%d), setting to 1", config->log_buffer_size);
-        config->log_buffer_size = 1;
+    // Группы регистров задают базовый период сами, короткие запросы позволяют опрос быстрее 200мс
+    int min_interval = MIN_POLL_INTERVAL;
+    if (config->reg_group_count > 0) {
+        if (validate_reg_groups(config) != 0) {
+            syslog(LOG_WARNING, "Register groups ignored, all registers are read every %dms", 
+                   config->poll_interval_ms);
+            config->reg_group_count = 0;
+        } else if (config->reg_group_count > 1) {
+            min_interval = MIN_REG_GROUP_INTERVAL;
+        }
+    }
+    if (config->reg_group_count == 0) {
+        config->reg_groups[0] = (pzem_reg_group_t){0, PZEM_REG_COUNT, config->poll_interval_ms, 1};
+        config->reg_group_count = 1;
+    }
+    
+    // Периоды групп считаются в базовых тиках, адаптация сдвинула бы их все разом,
+    // а poll_interval_min_ms поднял бы базовый период группы выше заданного
+    if (config->poll_adaptive && config->reg_group_count > 1) {
+        syslog(LOG_WARNING, "poll_adaptive is not supported with register groups, disabled");
+        config->poll_adaptive = 0;
+    }
+    if (config->poll_adaptive) {
+        if (config->poll_interval_min_ms < min_interval || config->poll_interval_min_ms > MAX_POLL_INTERVAL) {
+            syslog(LOG_WARNING, "Adaptive min interval out of range (%dms), setting to %dms", 
+                   config->poll_interval_min_ms, min_interval);
+            config->poll_interval_min_ms = min_interval;
+        }
+        if (config->poll_interval_max_ms < config->poll_interval_min_ms || 
+            config->poll_interval_max_ms > MAX_POLL_INTERVAL) {
+            syslog(LOG_WARNING, "Adaptive max interval out of range (%dms), setting to %dms", 
+                   config->poll_interval_max_ms, MAX_POLL_INTERVAL);
+            config->poll_interval_max_ms = MAX_POLL_INTERVAL;
+        }
+        // Стартовый период внутри диапазона адаптации
+        if (config->poll_interval_ms < config->poll_interval_min_ms) {
+            config->poll_interval_ms = config->poll_interval_min_ms;
+        } else if (config->poll_interval_ms > config->poll_interval_max_ms) {
+            config->poll_interval_ms = config->poll_interval_max_ms;
+        }
+        if (config->poll_adaptive_margin < 0 || config->poll_adaptive_margin > 50) {
+            syslog(LOG_WARNING, "Adaptive margin out of range (%d%%), setting to %d%%", 
+                   config->poll_adaptive_margin, DEFAULT_POLL_ADAPTIVE_MARGIN);
+            config->poll_adaptive_margin = DEFAULT_POLL_ADAPTIVE_MARGIN;
+        }
+        if (config->poll_adaptive_hold < 1) {
+            syslog(LOG_WARNING, "Adaptive hold too small (%d), setting to 1", config->poll_adaptive_hold);
+            config->poll_adaptive_hold = 1;
+        }
+    }
+    
+    if (config->modbus_timeout_ms < MIN_MODBUS_TIMEOUT_MS || config->modbus_timeout_ms > MAX_MODBUS_TIMEOUT_MS) {
+        syslog(LOG_WARNING, "Modbus timeout out of range (%dms), setting to %dms", 
+               config->modbus_timeout_ms, DEFAULT_MODBUS_TIMEOUT_MS);
+        config->modbus_timeout_ms = DEFAULT_MODBUS_TIMEOUT_MS;
+    }
+    if (config->modbus_timeout_min_ms < MIN_MODBUS_TIMEOUT_MS || 
+        config->modbus_timeout_min_ms > config->modbus_timeout_ms) {
+        syslog(LOG_WARNING, "Modbus min timeout out of range (%dms), setting to %dms", 
+               config->modbus_timeout_min_ms, MIN_MODBUS_TIMEOUT_MS);
+        config->modbus_timeout_min_ms = MIN_MODBUS_TIMEOUT_MS;
+    }
+    if (config->modbus_timeout_margin_ms < 0) {
+        config->modbus_timeout_margin_ms = 0;
+    }
+    
+    if (config->reconnect_delay_ms < MIN_RECONNECT_DELAY_MS || config->reconnect_delay_ms > MAX_RECONNECT_DELAY_MS) {
+        syslog(LOG_WARNING, "Reconnect delay out of range (%dms), setting to %dms", 
+               config->reconnect_delay_ms, DEFAULT_RECONNECT_DELAY_MS);
+        config->reconnect_delay_ms = DEFAULT_RECONNECT_DELAY_MS;
+    }
+    if (config->reconnect_max_delay_ms < config->reconnect_delay_ms || 
+        config->reconnect_max_delay_ms > MAX_RECONNECT_DELAY_MS) {
+        int max_delay = config->reconnect_delay_ms > DEFAULT_RECONNECT_MAX_DELAY_MS ?
+                        config->reconnect_delay_ms : DEFAULT_RECONNECT_MAX_DELAY_MS;
+        syslog(LOG_WARNING, "Reconnect max delay out of range (%dms), setting to %dms", 
+               config->reconnect_max_delay_ms, max_delay);
+        config->reconnect_max_delay_ms = max_delay;
+    }
+    
+    if (config->log_buffer_size < 0) {
+        syslog(LOG_WARNING, "Log buffer size negative (%d), line limit disabled", config->log_buffer_size);
+        config->log_buffer_size = 0;
     } else if (config->log_buffer_size > MAX_LOG_BUFFER_SIZE) {
         syslog(LOG_WARNING, "Log buffer size too large (%d), setting to %d", 
                config->log_buffer_size, MAX_LOG_BUFFER_SIZE);
         config->log_buffer_size = MAX_LOG_BUFFER_SIZE;
     }
+    
+    if (config->log_buffer_bytes < LOG_ENTRY_SIZE) {
+        syslog(LOG_WARNING, "Log buffer bytes too small (%d), setting to %d", 
+               config->log_buffer_bytes, LOG_ENTRY_SIZE);
+        config->log_buffer_bytes = LOG_ENTRY_SIZE;
+    } else if (config->log_buffer_bytes > MAX_LOG_BUFFER_BYTES) {
+        syslog(LOG_WARNING, "Log buffer bytes too large (%d), setting to %d", 
+               config->log_buffer_bytes, MAX_LOG_BUFFER_BYTES);
+        config->log_buffer_bytes = MAX_LOG_BUFFER_BYTES;
+    }
+    
+    if (config->log_flush_max_age_s < 1) {
+        syslog(LOG_WARNING, "Log flush max age too small (%ds), setting to 1s", config->log_flush_max_age_s);
+        config->log_flush_max_age_s = 1;
+    }
+    
+    if (config->log_queue_size < MIN_LOG_QUEUE_SIZE || config->log_queue_size > MAX_LOG_QUEUE_SIZE) {
+        syslog(LOG_WARNING, "Log queue size out of range (%d), setting to %d", 
+               config->log_queue_size, DEFAULT_LOG_QUEUE_SIZE);
+        config->log_queue_size = DEFAULT_LOG_QUEUE_SIZE;
+    }
+    
+    if (config->log_prealloc_kb < 0) {
+        config->log_prealloc_kb = 0;
+    }
+    
+    if (config->log_sync_interval_s < 1) {
+        syslog(LOG_WARNING, "Log sync interval too small (%ds), setting to 1s", config->log_sync_interval_s);
+        config->log_sync_interval_s = 1;
+    }
+    
+    // Пропущенные каналы SDT передаются пустыми полями, в binary и compressed их нет
+    if (config->log_mode == LOG_MODE_SDT &&
+        (config->log_format == PZEM_FORMAT_BINARY || config->log_format == PZEM_FORMAT_COMPRESSED)) {
+        syslog(LOG_WARNING, "log_mode sdt needs csv or json log_format, using change");
+        config->log_mode = LOG_MODE_CHANGE;
+    }
+    
+    if (config->log_max_silence_s < 0) {
+        config->log_max_silence_s = 0;
+    }
+    
+    // Окна сливаются снизу вверх и выровнены на полночь: каждое делит сутки и кратно предыдущему
+    for (int k = 0; k < config->rollup_count; k++) {
+        int period = config->rollup_periods[k];
+        if (period < 10 || 86400 % period != 0 || (k > 0 && period % config->rollup_periods[k - 1] != 0)) {
+            syslog(LOG_WARNING, "Rollup period %ds must divide a day and be a multiple of the previous one, "
+                   "using %d rollup levels", period, k);
+            config->rollup_count = k;
+            break;
+        }
+    }
+    
+    if (config->pubsub_max_clients < 1 || config->pubsub_max_clients > MAX_PUBSUB_CLIENTS) {
+        syslog(LOG_WARNING, "Subscriber limit out of range (%d), setting to %d", 
+               config->pubsub_max_clients, DEFAULT_PUBSUB_MAX_CLIENTS);
+        config->pubsub_max_clients = DEFAULT_PUBSUB_MAX_CLIENTS;
+    }
+    
+    if (config->pubsub_queue_size < 1 || config->pubsub_queue_size > MAX_PUBSUB_QUEUE_SIZE) {
+        syslog(LOG_WARNING, "Subscriber queue size out of range (%d), setting to %d", 
+               config->pubsub_queue_size, DEFAULT_PUBSUB_QUEUE_SIZE);
+        config->pubsub_queue_size = DEFAULT_PUBSUB_QUEUE_SIZE;
+    }
+    
+    if (config->shm_records < 0 || config->shm_records > MAX_SHM_RECORDS) {
+        syslog(LOG_WARNING, "Shared memory ring size out of range (%d), setting to %d", 
+               config->shm_records, DEFAULT_SHM_RECORDS);
+        config->shm_records = DEFAULT_SHM_RECORDS;
+    }
+    
+    if (config->history_size < 0 || config->history_size > MAX_HISTORY_SIZE) {
+        syslog(LOG_WARNING, "History size out of range (%d), setting to %d", 
+               config->history_size, DEFAULT_HISTORY_SIZE);
+        config->history_size = DEFAULT_HISTORY_SIZE;
+    }
+    
+    if (config->http_port < 0 || config->http_port > 65535) {
+        syslog(LOG_WARNING, "HTTP port out of range (%d), HTTP server disabled", config->http_port);
+        config->http_port = 0;
+    }
 
     return PZEM_SUCCESS;
 }
 
-// Функция для сравнения значений с учетом чувствительности
-int values_changed(const pzem_data_t *current, const pzem_data_t *previous, const pzem_config_t *config) {
-    if (!current || !previous || !config) return 1;
-    
-    if (previous->first_read || current->status != previous->status) return 1;
-    
-    if (CHECK_CHANGE(voltage_A, voltage_sensitivity)) return 1;
-    if (CHECK_CHANGE(voltage_B, voltage_sensitivity)) return 1;
-    if (CHECK_CHANGE(voltage_C, voltage_sensitivity)) return 1;
-    if (CHECK_CHANGE(current_A, current_sensitivity)) return 1;
-    if (CHECK_CHANGE(current_B, current_sensitivity)) return 1;
-    if (CHECK_CHANGE(current_C, current_sensitivity)) return 1;
-    if (CHECK_CHANGE(frequency_A, frequency_sensitivity)) return 1;
-    if (CHECK_CHANGE(frequency_B, frequency_sensitivity)) return 1;
-    if (CHECK_CHANGE(frequency_C, frequency_sensitivity)) return 1;
-    if (CHECK_CHANGE(angleV_B, angleV_sensitivity)) return 1;
-    if (CHECK_CHANGE(angleV_C, angleV_sensitivity)) return 1;
-    if (CHECK_CHANGE(angleI_A, angleI_sensitivity)) return 1;
-    if (CHECK_CHANGE(angleI_B, angleI_sensitivity)) return 1;
-    if (CHECK_CHANGE(angleI_C, angleI_sensitivity)) return 1;
-    if (CHECK_CHANGE(power_A, power_sensitivity)) return 1;
-    if (CHECK_CHANGE(power_B, power_sensitivity)) return 1;
-    if (CHECK_CHANGE(power_C, power_sensitivity)) return 1;
-    
-    return 0;
-}
-
 // Функция инициализации Modbus соединения
 pzem_result_t init_modbus_connection(const pzem_config_t *config) {
     if (!config) return PZEM_ERROR_INVALID_PARAM;
@@ -789,9 +831,14 @@ pzem_result_t init_modbus_connection(const pzem_config_t *config) {
     }
     
     modbus_set_error_recovery(ctx, MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL);
-    modbus_set_response_timeout(ctx, 1, 0);
-    modbus_set_byte_timeout(ctx, 0, 500000);
-    modbus_set_slave(ctx, config->slave_addr);
+    // В авто режиме тайм-аут ответа ограничивает весь кадр, межбайтовый отключен
+    modbus_set_response_timeout(ctx, config->modbus_timeout_ms / 1000, (config->modbus_timeout_ms % 1000) * 1000);
+    if (config->modbus_timeout_auto) {
+        modbus_set_byte_timeout(ctx, 0, 0);
+    } else {
+        modbus_set_byte_timeout(ctx, 0, 500000);
+    }
+    modbus_set_slave(ctx, config->slave_addrs[0]);
     
     if (modbus_connect(ctx) == -1) {
         syslog(LOG_ERR, "Connection failed to %s: %s", config->tty_port, modbus_strerror(errno));
@@ -809,89 +856,54 @@ pzem_result_t init_modbus_connection(const pzem_config_t *config) {
     return PZEM_SUCCESS;
 }
 
-// Функция чтения данных с PZEM
-pzem_result_t read_pzem_data(pzem_data_t *data) {
-    if (!data) return PZEM_ERROR_INVALID_PARAM;
+// Функция чтения данных с PZEM: регистры start..start+count-1, остальные не меняются
+pzem_result_t read_pzem_data(int slave_addr, pzem_data_t *data, int start, int count) {
+    if (!data || start < 0 || count <= 0 || start + count > PZEM_REG_COUNT) return PZEM_ERROR_INVALID_PARAM;
     
+    data->sample.timestamp_ms = get_wall_time_ms();
     if (ctx == NULL) {
         data->status = 2;
         return PZEM_ERROR_MODBUS;
     }
 
-    uint16_t tab_reg[20];
-    int rc = modbus_read_input_registers(ctx, 0x0000, 20, tab_reg);
+    // Контекст общий для всей шины, адрес выставляем перед каждым запросом
+    modbus_set_slave(ctx, slave_addr);
+
+    // Регистры сохраняются как есть, декодирование только по запросу
+    long long start_us = get_time_us();
+    int rc = modbus_read_input_registers(ctx, start, count, data->sample.regs + start);
+    histogram_add(&metrics.modbus_rtt_us, (uint64_t)(get_time_us() - start_us));
     if (rc == -1) {
         data->status = 1;
         return PZEM_ERROR_MODBUS;
     }
 
-    data->voltage_A = lsbVal(tab_reg[0]) / 10.0f;
-    data->voltage_B = lsbVal(tab_reg[1]) / 10.0f;
-    data->voltage_C = lsbVal(tab_reg[2]) / 10.0f;
-    
-    data->current_A = lsbVal(tab_reg[3]) / 100.0f;
-    data->current_B = lsbVal(tab_reg[4]) / 100.0f;
-    data->current_C = lsbVal(tab_reg[5]) / 100.0f;
-    
-    data->frequency_A = lsbVal(tab_reg[6]) / 100.0f;
-    data->frequency_B = lsbVal(tab_reg[7]) / 100.0f;
-    data->frequency_C = lsbVal(tab_reg[8]) / 100.0f;
-
-    data->angleV_B = lsbVal(tab_reg[9]) / 100.0f;
-    data->angleV_C = lsbVal(tab_reg[10]) / 100.0f;
-
-    data->angleI_A = lsbVal(tab_reg[11]) / 100.0f;
-    data->angleI_B = lsbVal(tab_reg[12]) / 100.0f;
-    data->angleI_C = lsbVal(tab_reg[13]) / 100.0f;
-
-    // Мощность: объединяем два 16-битных регистра в 32-битное значение
-    uint32_t power_A = ((uint32_t)tab_reg[15] << 16) | tab_reg[14];
-    uint32_t power_B = ((uint32_t)tab_reg[17] << 16) | tab_reg[16];
-    uint32_t power_C = ((uint32_t)tab_reg[19] << 16) | tab_reg[18];
-    data->power_A = (float)power_A / 10.0f;
-    data->power_B = (float)power_B / 10.0f;
-    data->power_C = (float)power_C / 10.0f;
-    
     data->status = 0;
     return PZEM_SUCCESS;
 }
 
-// Функция чтения с повторными попытками
-pzem_result_t read_pzem_data_with_retry(pzem_data_t *data, int max_retries) {
-    for (int attempt = 0; attempt < max_retries; attempt++) {
-        if (read_pzem_data(data) == PZEM_SUCCESS) {
-            return PZEM_SUCCESS;
-        }
-        if (attempt < max_retries - 1) {
-            usleep(100000 * (attempt + 1));
-        }
-    }
-    return PZEM_ERROR_MODBUS;
-}
-
 // Функция очистки ресурсов
 void cleanup(void) {
 #ifdef DEBUG
     syslog(LOG_DEBUG, "Cleanup started");
 #endif
     
-    if (log_buffer.buffer != NULL) {
-#ifdef DEBUG
-        syslog(LOG_DEBUG, "Flushing log buffer (%d records)", log_buffer.size);
-#endif
-        flush_log_buffer(&log_buffer);
-        free_log_buffer(&log_buffer);
+    // Незаписанные точки swinging door и открытые окна сводок в очередь,
+    // поток записи дописывает ее и буферы перед остановкой
+    for (int i = 0; i < device_count; i++) {
+        flush_device_sdt(&devices[i]);
+        rollup_flush(&devices[i]);
     }
+    log_writer_stop(&log_writer);
     
-    cleanup_fifo(fifo_path);
-    
-    if (ctx != NULL) {
-        modbus_close(ctx);
-        modbus_free(ctx);
-        ctx = NULL;
-        syslog(LOG_INFO, "Modbus connection closed");
+    for (int i = 0; i < device_count; i++) {
+        pzem_device_t *dev = &devices[i];
+        free_log_buffer(&dev->log_buffer);
+        rollup_free(dev, &global_config);
     }
     
+    close_modbus_connection();
+    
     print_metrics(&metrics);
     
 #ifdef DEBUG
@@ -899,28 +911,75 @@ void cleanup(void) {
 #endif
 }
 
-// Функция безопасного переподключения
-void safe_reconnect(const pzem_config_t *config) {
-    syslog(LOG_WARNING, "Multiple errors detected, attempting reconnect...");
-    cleanup();
-    
-    if (log_buffer.buffer == NULL) {
-        if (init_log_buffer(&log_buffer, global_config.log_buffer_size, global_config.log_dir) != PZEM_SUCCESS) {
-            syslog(LOG_ERR, "Failed to reinitialize log buffer");
-        }
+// Закрытие Modbus соединения; буферы, сокеты и метрики не трогаются
+void close_modbus_connection(void) {
+    if (ctx != NULL) {
+        modbus_close(ctx);
+        modbus_free(ctx);
+        ctx = NULL;
+        syslog(LOG_INFO, "Modbus connection closed");
     }
+}
+
+// Инициализация устройств шины: имена и буферы логов
+pzem_result_t init_devices(const pzem_config_t *config) {
+    if (!config) return PZEM_ERROR_INVALID_PARAM;
     
-    usleep(1000000);
-    if (init_modbus_connection(config) == PZEM_SUCCESS) {
-        syslog(LOG_INFO, "Reconnected successfully");
+    device_count = 0;
+    for (int i = 0; i < config->slave_count; i++) {
+        pzem_device_t *dev = &devices[device_count];
+        memset(dev, 0, sizeof(*dev));
+        dev->slave_addr = config->slave_addrs[i];
+        
+        // Одно устройство сохраняет прежние имена лога и сокета
+        if (config->slave_count == 1) {
+            snprintf(dev->name, sizeof(dev->name), "%s", config_name);
+        } else {
+            snprintf(dev->name, sizeof(dev->name), "%.50s_%d", config_name, dev->slave_addr);
+        }
+        dev->pubsub.listen.fd = -1;
+        
+        if (init_log_buffer(&dev->log_buffer, config, dev->name) != PZEM_SUCCESS) {
+            syslog(LOG_ERR, "Failed to initialize log buffer for %s", dev->name);
+            return PZEM_ERROR_MEMORY;
+        }
+        
+        // Проверяем доступность лог-файла, дескриптор остается открытым
+        char log_path[512];
+        time_t now = time(NULL);
+        get_log_file_path(log_path, sizeof(log_path), config->log_dir, dev->name, output_format_ext(config->log_format),
+                          now);
+        if (log_buffer_open_file(&dev->log_buffer, now) != PZEM_SUCCESS) {
+            syslog(LOG_ERR, "Cannot access log file '%s'", log_path);
+        } else {
+            syslog(LOG_INFO, "Log file accessible: %s", log_path);
+        }
+        
+        if (history_init(&dev->history, config->history_size) != PZEM_SUCCESS) {
+            return PZEM_ERROR_MEMORY;
+        }
+        if (rollup_init(dev, config) != PZEM_SUCCESS) {
+            return PZEM_ERROR_MEMORY;
+        }
+        
+        // Тайм-ауты групп начинают с настроенного и подстраиваются по ответам
+        for (int g = 0; g < config->reg_group_count; g++) {
+            dev->rtt[g].timeout_us = (uint32_t)config->modbus_timeout_ms * 1000;
+        }
+        
+        initialize_data_structures(&dev->current, &dev->previous);
+        device_count++;
     }
+    
+    return PZEM_SUCCESS;
 }
 
 // Инициализация системы
 pzem_result_t initialize_system(const char *config_file) {
     extract_config_name(config_file);
+    STRCPY_SAFE(config_path, config_file);
     
-    char syslog_ident[128];
+    static char syslog_ident[128];
     snprintf(syslog_ident, sizeof(syslog_ident), "pzem3-%s", config_name);
     service_name = syslog_ident;
     
@@ -928,14 +987,6 @@ pzem_result_t initialize_system(const char *config_file) {
     setup_signal_handlers();
     
     syslog(LOG_INFO, "PZEM-6L24 Monitor v%s starting with config: %s", version, config_file);
-
-    // Создаем FIFO
-    snprintf(fifo_path, sizeof(fifo_path), "/tmp/pzem3_data_%s", config_name);
-    if (init_data_fifo(fifo_path) != 0) {
-        syslog(LOG_WARNING, "Failed to create data FIFO, data broadcasting disabled");
-    } else {
-        syslog(LOG_INFO, "Data broadcasting enabled via FIFO: %s", fifo_path);
-    }
     
     if (load_config(config_file, &global_config) != PZEM_SUCCESS) {
         syslog(LOG_ERR, "Failed to load configuration");
@@ -947,25 +998,21 @@ pzem_result_t initialize_system(const char *config_file) {
         return PZEM_ERROR_CONFIG;
     }
     
+    // Чувствительность и пороги в единицах регистров для сравнения без float
+    build_channel_limits(&global_config, channel_limits);
+    
     if (create_directory_if_not_exists(global_config.log_dir) != 0) {
         syslog(LOG_ERR, "Failed to create log directory");
         return PZEM_ERROR_IO;
     }
     
-    if (init_log_buffer(&log_buffer, global_config.log_buffer_size, global_config.log_dir) != PZEM_SUCCESS) {
-        syslog(LOG_ERR, "Failed to initialize log buffer");
+    if (init_devices(&global_config) != PZEM_SUCCESS) {
         return PZEM_ERROR_MEMORY;
     }
     
-    // Проверяем доступность лог-файла
-    char log_path[512];
-    get_log_file_path(log_path, sizeof(log_path), global_config.log_dir);
-    FILE *test_file = fopen(log_path, "a");
-    if (test_file == NULL) {
-        syslog(LOG_ERR, "Cannot access log file '%s': %s", log_path, strerror(errno));
-    } else {
-        fclose(test_file);
-        syslog(LOG_INFO, "Log file accessible: %s", log_path);
+    if (log_writer_start(&log_writer, &global_config) != PZEM_SUCCESS) {
+        syslog(LOG_ERR, "Failed to start log writer");
+        return PZEM_ERROR_IO;
     }
 
     if (init_modbus_connection(&global_config) != PZEM_SUCCESS) {
@@ -973,8 +1020,40 @@ pzem_result_t initialize_system(const char *config_file) {
         return PZEM_ERROR_MODBUS;
     }
 
+    if (scheduler_init(&scheduler, global_config.poll_interval_ms, global_config.poll_align) != PZEM_SUCCESS) {
+        syslog(LOG_ERR, "Failed to initialize poll scheduler");
+        return PZEM_ERROR_IO;
+    }
+    
+    // Сокеты данных живут все время работы, переподключение Modbus их не трогает
+    for (int i = 0; i < device_count; i++) {
+        pzem_device_t *dev = &devices[i];
+        char path[sizeof(dev->pubsub.path)];
+        snprintf(path, sizeof(path), PZEM_SOCKET_PATH, dev->name);
+        if (pubsub_init(&dev->pubsub, &scheduler, path, global_config.pubsub_max_clients,
+                        global_config.pubsub_queue_size) != PZEM_SUCCESS) {
+            syslog(LOG_WARNING, "Failed to create data socket, data broadcasting disabled for %s", dev->name);
+        } else {
+            syslog(LOG_INFO, "Data broadcasting enabled via socket: %s", path);
+        }
+    }
+    
+    if (global_config.shm_records > 0) {
+        if (pzem_shm_open(&shm_ring, config_name, global_config.shm_records) != PZEM_SUCCESS) {
+            syslog(LOG_WARNING, "Shared memory ring disabled");
+        } else {
+            syslog(LOG_INFO, "Shared memory ring: /dev/shm%s, %d records", shm_ring.name, global_config.shm_records);
+        }
+    }
+    
+    if (http_init(&http_server, &scheduler, &global_config) != PZEM_SUCCESS) {
+        syslog(LOG_WARNING, "HTTP server disabled");
+    }
+
     // Инициализируем метрики
     metrics.start_time = get_time_ms();
+    link_init(&bus_link);
+    metrics.poll_interval_ms = global_config.poll_interval_ms;
     
     return PZEM_SUCCESS;
 }
@@ -991,92 +1070,491 @@ void initialize_data_structures(pzem_data_t *current, pzem_data_t *previous) {
     previous->status = 2;
     
     // Инициализация состояний
-    const char default_state = 'N';
-    current->voltage_state_A = default_state;
-    current->voltage_state_B = default_state;
-    current->voltage_state_C = default_state;
-    current->current_state_A = default_state;
-    current->current_state_B = default_state;
-    current->current_state_C = default_state;
-    current->frequency_state_A = default_state;
-    current->frequency_state_B = default_state;
-    current->frequency_state_C = default_state;
-    current->angleV_state_B = default_state;
-    current->angleV_state_C = default_state;
-    current->angleI_state_A = default_state;
-    current->angleI_state_B = default_state;
-    current->angleI_state_C = default_state;
+    memset(current->state, 'N', sizeof(current->state));
     
     // Копируем в previous
     *previous = *current;
 }
 
-// Обработка одной итерации
-void process_iteration(pzem_data_t *current, pzem_data_t *previous) {
-    if (!current || !previous) return;
+// Тайм-аут = p99 последних удачных запросов * 1.5 + запас, в пределах настроек.
+// Пока ответов мало, берем с тройным запасом, как TCP для первого RTT
+static void rtt_update_timeout(pzem_rtt_t *rtt) {
+    uint32_t sorted[PZEM_RTT_WINDOW];
+    unsigned int n = rtt->count;
+    memcpy(sorted, rtt->samples_us, n * sizeof(sorted[0]));
+    for (unsigned int i = 1; i < n; i++) {
+        uint32_t v = sorted[i];
+        unsigned int j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
     
-    long long iteration_start = get_time_ms();
+    uint64_t p99 = sorted[(n - 1) * 99 / 100];
+    uint64_t timeout = (n < PZEM_RTT_UPDATE_EVERY ? p99 * 3 : p99 * 3 / 2) + 
+                       (uint64_t)global_config.modbus_timeout_margin_ms * 1000;
+    uint64_t min = (uint64_t)global_config.modbus_timeout_min_ms * 1000;
+    uint64_t max = (uint64_t)global_config.modbus_timeout_ms * 1000;
+    rtt->timeout_us = (uint32_t)(timeout < min ? min : timeout > max ? max : timeout);
+}
+
+// Время удачного запроса; тайм-аут пересчитывается раз в несколько ответов
+static void rtt_add(pzem_rtt_t *rtt, long long rtt_us) {
+    if (!global_config.modbus_timeout_auto) return;
+    
+    rtt->samples_us[rtt->head] = rtt_us > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt_us;
+    rtt->head = (rtt->head + 1) % PZEM_RTT_WINDOW;
+    if (rtt->count < PZEM_RTT_WINDOW) rtt->count++;
+    rtt->timeouts = 0;
+    if (++rtt->since_update >= PZEM_RTT_UPDATE_EVERY || rtt->count < PZEM_RTT_UPDATE_EVERY) {
+        rtt->since_update = 0;
+        rtt_update_timeout(rtt);
+    }
+}
+
+// Ответ не пришел вовремя. Одиночная потеря кадра на зашумленной линии - не повод
+// ждать дольше, а при повторных тайм-аутах подряд тайм-аут удваивается до верхнего предела
+static void rtt_expired(pzem_rtt_t *rtt) {
+    if (!global_config.modbus_timeout_auto || ++rtt->timeouts < 2) return;
+    
+    uint64_t timeout = (uint64_t)rtt->timeout_us * 2;
+    uint64_t max = (uint64_t)global_config.modbus_timeout_ms * 1000;
+    rtt->timeout_us = (uint32_t)(timeout > max ? max : timeout);
+}
+
+// Пределы тайм-аута изменились: пересчет по уже накопленным ответам
+static void rtt_retune(pzem_rtt_t *rtt) {
+    rtt->timeouts = 0;
+    rtt->since_update = 0;
+    if (global_config.modbus_timeout_auto && rtt->count > 0) {
+        rtt_update_timeout(rtt);
+    } else {
+        rtt->timeout_us = (uint32_t)global_config.modbus_timeout_ms * 1000;
+    }
+}
+
+// Группы регистров, у которых подошел срок, ставятся в ожидание чтения.
+// Регистры остальных групп остаются от прошлых чтений, измерение собирается из них целиком
+static void mark_due_groups(pzem_device_t *dev) {
+    for (int g = 0; g < global_config.reg_group_count; g++) {
+        unsigned int bit = 1u << g;
+        if (!(dev->groups_read & bit) || 
+            poll_tick - dev->group_tick[g] >= (unsigned long long)global_config.reg_groups[g].every) {
+            dev->pending_groups |= bit;
+            dev->group_tick[g] = poll_tick;
+        }
+    }
+}
+
+// Чтение ожидающих групп по очереди, прочитанные снимаются с ожидания.
+// Неудачная группа и следующие за ней остаются для повтора
+static pzem_result_t read_pending_groups(pzem_device_t *dev) {
+    for (int g = 0; g < global_config.reg_group_count; g++) {
+        unsigned int bit = 1u << g;
+        if (!(dev->pending_groups & bit)) continue;
+        
+        const pzem_reg_group_t *group = &global_config.reg_groups[g];
+        pzem_rtt_t *rtt = &dev->rtt[g];
+        // Группа еще без ответов начинает с оценки шины, а не с верхнего предела,
+        // пока тайм-ауты подряд не перевели ее на удвоение
+        if (rtt->count == 0 && rtt->timeouts < 2 && bus_rtt.count > 0 &&
+            bus_rtt.timeout_us < rtt->timeout_us) {
+            rtt->timeout_us = bus_rtt.timeout_us;
+        }
+        if (ctx != NULL) {
+            modbus_set_response_timeout(ctx, rtt->timeout_us / 1000000, rtt->timeout_us % 1000000);
+        }
+        
+        errno = 0;
+        long long start_us = get_time_us();
+        pzem_result_t result = read_pzem_data(dev->slave_addr, &dev->current, group->start, group->count);
+        if (result != PZEM_SUCCESS) {
+            if (errno == ETIMEDOUT) {
+                rtt_expired(rtt);
+            }
+            return result;
+        }
+        long long rtt_us = get_time_us() - start_us;
+        rtt_add(rtt, rtt_us);
+        rtt_add(&bus_rtt, rtt_us);
+        dev->pending_groups &= ~bit;
+        dev->groups_read |= bit;
+    }
+    return PZEM_SUCCESS;
+}
+
+// Итог чтения устройства в цикле: измерение уходит в обработку
+static int finish_device_read(pzem_device_t *dev, pzem_result_t result) {
+    histogram_add(&metrics.modbus_attempts, (uint64_t)dev->attempts);
+    dev->attempts = 0;
+    dev->retry_pending = 0;
+    dev->pending_groups = 0;
+    
+    int failed = process_iteration(dev, result);
+    cycle_failed += failed;
+    return failed;
+}
+
+// Попытка чтения устройства. Неудача до исчерпания попыток не ждет на месте,
+// а откладывает повтор в цикл событий: шина и сокеты свободны, пока линия успокаивается
+static void attempt_device_read(pzem_device_t *dev, long long *modbus_time) {
     long long modbus_start = get_time_ms();
+    pzem_result_t result = read_pending_groups(dev);
+    if (modbus_time) {
+        *modbus_time += get_time_ms() - modbus_start;
+    }
+    dev->attempts++;
+    
+    if (result != PZEM_SUCCESS && dev->attempts < MAX_RETRIES) {
+        dev->retry_pending = 1;
+        metrics.retries++;
+        scheduler_retry_after(&scheduler, MODBUS_RETRY_DELAY_MS * dev->attempts);
+        return;
+    }
+    finish_device_read(dev, result);
+}
+
+// Соединение закрыто: каждое устройство получает измерение с ошибкой порта,
+// чтобы лог и подписчики видели начало простоя
+void mark_devices_offline(void) {
+    cycle_failed = 0;
+    for (int i = 0; i < device_count; i++) {
+        pzem_device_t *dev = &devices[i];
+        flush_device_sdt(dev);
+        dev->pending_groups = 0;
+        dev->attempts = 0;
+        dev->retry_pending = 0;
+        dev->current.status = 2;
+        dev->current.sample.timestamp_ms = get_wall_time_ms();
+        process_iteration(dev, PZEM_ERROR_MODBUS);
+    }
+}
+
+// Чтение групп регистров начинается заново, измерение и состояния порогов остаются
+static void restart_group_reads(pzem_device_t *dev) {
+    dev->groups_read = 0;
+    dev->pending_groups = 0;
+    dev->attempts = 0;
+    dev->retry_pending = 0;
+}
+
+// Сброс чтения устройства после переподключения: все группы читаются заново
+void reset_device_reads(pzem_device_t *dev) {
+    if (!dev) return;
+    
+    initialize_data_structures(&dev->current, &dev->previous);
+    flush_device_sdt(dev);
+    restart_group_reads(dev);
+}
+
+// Строка измерения подписчикам, в историю и в лог
+static void log_measurement(pzem_device_t *dev, const pzem_data_t *data) {
+    // Каждый формат кодируется один раз и только если он кому-то нужен
+    pzem_encode_cache_t encoded;
+    encode_cache_init(&encoded, data, dev->slave_addr);
+    size_t len;
+    
+    // Рассылаем подписчикам сокета
+    if (dev->pubsub.client_count > 0) {
+        const char *entry = encode_cache_get(&encoded, global_config.pubsub_format, &len);
+        pubsub_publish(&dev->pubsub, entry, len);
+    }
+    
+    // История для /range и поток /live встроенного HTTP сервера
+    history_add(&dev->history, data);
+    if (http_server.streams > 0) {
+        const char *entry = encode_cache_get(&encoded, PZEM_FORMAT_CSV, &len);
+        http_publish(&http_server, (int)(dev - devices), entry, len);
+    }
+    
+    // Передаем строку потоку записи
+    const char *log_entry = encode_cache_get(&encoded, global_config.log_format, &len);
+    if (log_writer_submit(&log_writer, (int)(dev - devices), 0, data->sample.timestamp_ms,
+                          log_entry, len) != PZEM_SUCCESS) {
+#ifdef DEBUG
+        syslog(LOG_DEBUG, "Log queue full, entry dropped");
+#endif
+    }
+}
+
+// Swinging door: незаписанные концы отрезков в лог, следующее измерение пишется целиком
+void flush_device_sdt(pzem_device_t *dev) {
+    pzem_data_t row;
+    if (sdt_flush(&dev->sdt, &row)) {
+        log_measurement(dev, &row);
+    }
+}
+
+// Обработка итога чтения устройства: пороги, лог и подписчики
+int process_iteration(pzem_device_t *dev, pzem_result_t read_result) {
+    if (!dev) return 1;
     
-    pzem_result_t read_result = read_pzem_data_with_retry(current, MAX_RETRIES);
-    long long modbus_time = get_time_ms() - modbus_start;
+    pzem_data_t *current = &dev->current;
+    pzem_data_t *previous = &dev->previous;
     
-    int had_error = (read_result != PZEM_SUCCESS);
+    dev->reads++;
+    dev->read_errors += read_result != PZEM_SUCCESS;
+    long long processing_start_us = get_time_us();
     
     if (read_result == PZEM_SUCCESS) {
-        update_threshold_states(current, &global_config);
+        update_threshold_states(current, channel_limits);
         if (current->first_read) {
-            if (current->angleV_B < 200 && current->angleV_B > 100 && current->angleV_C > 200) {
+            float angleV_B = pzem_channel_value(&current->sample, PZEM_CH_ANGLEV_B);
+            float angleV_C = pzem_channel_value(&current->sample, PZEM_CH_ANGLEV_C);
+            if (angleV_B < 200 && angleV_B > 100 && angleV_C > 200) {
                 current->rotaryP = 'R';
             } else {
                 current->rotaryP = 'L';
             }
-            syslog(LOG_INFO, "The order of rotation of the phases (L - reverse, R - forward): %c", current->rotaryP);
+            syslog(LOG_INFO, "%s: the order of rotation of the phases (L - reverse, R - forward): %c", 
+                   dev->name, current->rotaryP);
         }
     }
 
-    int data_changed = values_changed(current, previous, &global_config);
+    // Каждое измерение, изменилось оно или нет, уходит в разделяемую память и в сводки
+    pzem_shm_publish(&shm_ring, dev->slave_addr, current);
+    rollup_add(dev, current);
+
+    int data_changed = values_changed(current, previous, channel_limits);
     int states_changed = threshold_states_changed(current, previous);
+    
+    // Сигнал двигается или подошел к порогам - адаптивный опрос ускоряется
+    if (data_changed || states_changed || 
+        (global_config.poll_adaptive && near_thresholds(current, channel_limits))) {
+        poll_activity = 1;
+    }
 
-    if (data_changed || states_changed) {
-        char log_entry[256];
-        prepare_log_entry(log_entry, sizeof(log_entry), current);
-        
-        // Отправляем в FIFO
-        if (write_to_fifo(fifo_path, log_entry) != 0) {
-#ifdef DEBUG
-            syslog(LOG_DEBUG, "Failed to write to FIFO (no readers?)");
-#endif
+    if (global_config.log_mode == LOG_MODE_SDT) {
+        // Строки пишет swinging door, previous - просто прошлое измерение для адаптивного опроса
+        pzem_data_t rows[2];
+        int count = sdt_update(&dev->sdt, current, channel_limits,
+                               global_config.log_max_silence_s * 1000LL, rows);
+        for (int i = 0; i < count; i++) {
+            log_measurement(dev, &rows[i]);
         }
         
-        // Добавляем в буфер логов
-        if (add_to_log_buffer(&log_buffer, log_entry) != PZEM_SUCCESS) {
-#ifdef DEBUG
-            syslog(LOG_DEBUG, "Failed to add to log buffer");
-#endif
-        }
+        *previous = *current;
+        previous->first_read = 0;
+        current->first_read = 0;
+    } else if (data_changed || states_changed) {
+        log_measurement(dev, current);
 
         *previous = *current;
         previous->first_read = 0;
         current->first_read = 0;
     }
+    
+    histogram_add(&metrics.processing_us, (uint64_t)(get_time_us() - processing_start_us));
+    return read_result != PZEM_SUCCESS;
+}
+
+// Адаптивный период: минимальный при активности, в тишине удваивается до максимума
+static void adapt_poll_interval(int active) {
+    static int quiet_cycles = 0;
+    int interval = metrics.poll_interval_ms;
+    
+    if (active) {
+        quiet_cycles = 0;
+        interval = global_config.poll_interval_min_ms;
+    } else if (++quiet_cycles >= global_config.poll_adaptive_hold) {
+        interval = interval > global_config.poll_interval_max_ms / 2 ? 
+                   global_config.poll_interval_max_ms : interval * 2;
+    }
+    
+    if (interval != metrics.poll_interval_ms) {
+#ifdef DEBUG
+        syslog(LOG_DEBUG, "Poll interval %dms -> %dms", metrics.poll_interval_ms, interval);
+#endif
+        metrics.poll_interval_ms = interval;
+        scheduler_set_interval(&scheduler, interval);
+    }
+}
 
-    // Сбрасываем буфер если он полный
-    if (should_flush_buffer(&log_buffer)) {
-        flush_log_buffer(&log_buffer);
+// Один цикл опроса: все устройства шины подряд. Неудачные чтения повторяются
+// из цикла событий, поэтому возвращается число устройств, чтение которых
+// завершилось неудачей после всех попыток с начала прошлого цикла
+int poll_cycle(void) {
+    long long iteration_start = get_time_ms();
+    long long modbus_time = 0;
+    int failed = cycle_failed;
+    cycle_failed = 0;
+    
+    // Регулярность опроса: фактический интервал между началами циклов
+    long long cycle_us = get_time_us();
+    if (metrics.last_cycle_us != 0) {
+        histogram_add(&metrics.interval_us, (uint64_t)(cycle_us - metrics.last_cycle_us));
     }
+    metrics.last_cycle_us = cycle_us;
+    
+    // Повтор, не успевший до нового периода, продолжает попытки в этом цикле
+    for (int i = 0; i < device_count && keep_running; i++) {
+        devices[i].retry_pending = 0;
+        mark_due_groups(&devices[i]);
+        attempt_device_read(&devices[i], &modbus_time);
+    }
+    poll_tick++;
+    // Изменения, найденные повторами, учитываются в следующем цикле
+    if (global_config.poll_adaptive) {
+        adapt_poll_interval(poll_activity);
+    }
+    poll_activity = 0;
     
     long long iteration_time = get_time_ms() - iteration_start;
-    update_metrics(&metrics, iteration_time, modbus_time, had_error);
+    update_metrics(&metrics, iteration_time, modbus_time, failed);
     
-    // Регулируем время сна
-    int16_t sleep_time = global_config.poll_interval_ms - (int16_t)iteration_time;
-    if (sleep_time > 0) {
-        usleep((useconds_t)(sleep_time * 1000));
-    } else {
+    if (iteration_time > metrics.poll_interval_ms) {
         syslog(LOG_ALERT, "Attention! Processing time (%lldms) exceeds poll interval (%dms)", 
-               iteration_time, global_config.poll_interval_ms);
+               iteration_time, metrics.poll_interval_ms);
+    }
+    
+    return failed;
+}
+
+// Повтор неудачных чтений текущего цикла по таймеру планировщика
+void retry_cycle(void) {
+    long long modbus_time = 0;
+    
+    for (int i = 0; i < device_count && keep_running; i++) {
+        pzem_device_t *dev = &devices[i];
+        if (dev->retry_pending) {
+            dev->retry_pending = 0;
+            attempt_device_read(dev, &modbus_time);
+        }
+    }
+    metrics.modbus_time_total += modbus_time;
+}
+
+// Параметры, которые применяются только при запуске: файлы логов, сокеты, HTTP,
+// разделяемая память и состав шины. Изменения в них ждут перезапуска
+static void keep_restart_settings(pzem_config_t *config, const pzem_config_t *current) {
+#define KEEP_SETTING(field) \
+    if (config->field != current->field) { \
+        syslog(LOG_WARNING, "Reload: %s change requires restart, keeping current value", #field); \
+        config->field = current->field; \
+    }
+#define KEEP_STRING(field) \
+    if (strcmp(config->field, current->field) != 0) { \
+        syslog(LOG_WARNING, "Reload: %s change requires restart, keeping current value", #field); \
+        STRCPY_SAFE(config->field, current->field); \
+    }
+    KEEP_SETTING(poll_align);
+    KEEP_STRING(log_dir);
+    KEEP_SETTING(log_buffer_size);
+    KEEP_SETTING(log_buffer_bytes);
+    KEEP_SETTING(log_flush_max_age_s);
+    KEEP_SETTING(log_queue_size);
+    KEEP_SETTING(log_prealloc_kb);
+    KEEP_SETTING(log_sync);
+    KEEP_SETTING(log_sync_interval_s);
+    KEEP_SETTING(log_format);
+    KEEP_SETTING(pubsub_format);
+    KEEP_SETTING(pubsub_max_clients);
+    KEEP_SETTING(pubsub_queue_size);
+    KEEP_SETTING(shm_records);
+    KEEP_SETTING(history_size);
+    if (config->rollup_count != current->rollup_count ||
+        memcmp(config->rollup_periods, current->rollup_periods, sizeof(config->rollup_periods)) != 0) {
+        syslog(LOG_WARNING, "Reload: rollup_periods change requires restart, keeping current value");
+        config->rollup_count = current->rollup_count;
+        memcpy(config->rollup_periods, current->rollup_periods, sizeof(config->rollup_periods));
+    }
+    KEEP_SETTING(http_port);
+    KEEP_STRING(http_bind);
+    KEEP_STRING(http_page);
+#undef KEEP_SETTING
+#undef KEEP_STRING
+    
+    // От адресов зависят имена логов и сокетов. Единственное устройство называется
+    // по конфигурации, поэтому его адрес меняется на ходу, а состав шины - нет
+    int same = config->slave_count == current->slave_count;
+    for (int i = 0; same && current->slave_count > 1 && i < current->slave_count; i++) {
+        same = config->slave_addrs[i] == current->slave_addrs[i];
+    }
+    if (!same) {
+        syslog(LOG_WARNING, "Reload: device list change requires restart, keeping current devices");
+        memcpy(config->slave_addrs, current->slave_addrs, sizeof(config->slave_addrs));
+        config->slave_count = current->slave_count;
+        config->slave_addr = current->slave_addr;
+    }
+}
+
+// Перечитывание конфигурации по SIGHUP, вызывается между циклами опроса.
+// Новая конфигурация проверяется целиком и только потом подменяет текущую.
+// Измерения, буферы логов и подписчики остаются, строки first_read не появляются;
+// Modbus переподключается только при смене адреса шины
+pzem_result_t reload_config(void) {
+    pzem_config_t config;
+    char current_type = device_type;
+    
+    syslog(LOG_INFO, "Reloading configuration from %s", config_path);
+    if (load_config(config_path, &config) != PZEM_SUCCESS ||
+        validate_config(&config) != PZEM_SUCCESS) {
+        device_type = current_type;
+        syslog(LOG_ERR, "Configuration reload failed, keeping current settings");
+        return PZEM_ERROR_CONFIG;
+    }
+    keep_restart_settings(&config, &global_config);
+    
+    int bus_changed = device_type != current_type || config.baudrate != global_config.baudrate ||
+                      strcmp(config.tty_port, global_config.tty_port) != 0;
+    int groups_changed = config.reg_group_count != global_config.reg_group_count ||
+                         memcmp(config.reg_groups, global_config.reg_groups, sizeof(config.reg_groups)) != 0;
+    int timeouts_changed = config.modbus_timeout_ms != global_config.modbus_timeout_ms ||
+                           config.modbus_timeout_auto != global_config.modbus_timeout_auto ||
+                           config.modbus_timeout_min_ms != global_config.modbus_timeout_min_ms ||
+                           config.modbus_timeout_margin_ms != global_config.modbus_timeout_margin_ms;
+    int log_mode_changed = config.log_mode != global_config.log_mode;
+    
+    // Поток записи global_config не читает - у него снимок с запуска, подмена безопасна
+    global_config = config;
+    build_channel_limits(&global_config, channel_limits);
+    
+    // Время ответа другой шины не годится, новые группы меряются с нуля
+    if (bus_changed) {
+        memset(&bus_rtt, 0, sizeof(bus_rtt));
+    }
+    if (bus_changed || timeouts_changed) {
+        rtt_retune(&bus_rtt);
+    }
+    for (int i = 0; i < device_count; i++) {
+        pzem_device_t *dev = &devices[i];
+        int addr_changed = dev->slave_addr != global_config.slave_addrs[i];
+        if (addr_changed) {
+            syslog(LOG_INFO, "Device %s address %d -> %d", dev->name, dev->slave_addr, global_config.slave_addrs[i]);
+            dev->slave_addr = global_config.slave_addrs[i];
+        }
+        if (bus_changed || groups_changed || addr_changed) {
+            restart_group_reads(dev);
+            memset(dev->rtt, 0, sizeof(dev->rtt));
+        }
+        if (bus_changed || groups_changed || addr_changed || timeouts_changed) {
+            for (int g = 0; g < global_config.reg_group_count; g++) {
+                rtt_retune(&dev->rtt[g]);
+            }
+        }
+        // Первое измерение после смены режима пишется целиком
+        if (log_mode_changed) {
+            flush_device_sdt(dev);
+        }
     }
+    
+    // Период начинается с настроенного, адаптация продолжит от него
+    metrics.poll_interval_ms = global_config.poll_interval_ms;
+    scheduler_set_interval(&scheduler, global_config.poll_interval_ms);
+    
+    if (bus_changed) {
+        cycle_failed = 0;
+        link_restart(&bus_link);
+    } else if (timeouts_changed && ctx != NULL) {
+        modbus_set_byte_timeout(ctx, 0, global_config.modbus_timeout_auto ? 0 : 500000);
+    }
+    
+    syslog(LOG_INFO, "Configuration reloaded: interval=%dms, %d register groups%s", 
+           global_config.poll_interval_ms, global_config.reg_group_count, 
+           bus_changed ? ", Modbus device changed" : "");
+    return PZEM_SUCCESS;
 }
 
 // Обновление метрик
@@ -1103,9 +1581,46 @@ void print_metrics(const performance_metrics_t *metrics) {
     double error_rate = (double)metrics->error_count / metrics->total_iterations * 100.0;
     
     syslog(LOG_INFO, "Performance metrics: total_time=%lldms, iterations=%lld, "
-           "avg_iteration=%.2fms, avg_modbus=%.2fms, max_iteration=%lldms, error_rate=%.2f%%",
+           "avg_iteration=%.2fms, avg_modbus=%.2fms, max_iteration=%lldms, error_rate=%.2f%%, "
+           "missed_deadlines=%lld, poll_interval=%dms",
            total_time, metrics->total_iterations, avg_iteration, avg_modbus,
-           metrics->max_iteration_time, error_rate);
+           metrics->max_iteration_time, error_rate, metrics->missed_deadlines, metrics->poll_interval_ms);
+    
+    // Распределения задержек: оценки квантилей по корзинам, мкс
+    const struct {
+        const char *name;
+        const pzem_histogram_t *hist;
+    } hists[] = {
+        {"modbus_rtt_us", &metrics->modbus_rtt_us},
+        {"modbus_attempts", &metrics->modbus_attempts},
+        {"processing_us", &metrics->processing_us},
+        {"flush_us", &metrics->flush_us},
+        {"interval_us", &metrics->interval_us}
+    };
+    for (size_t i = 0; i < sizeof(hists) / sizeof(hists[0]); i++) {
+        const pzem_histogram_t *h = hists[i].hist;
+        unsigned long long count = atomic_load(&h->count);
+        if (count == 0) continue;
+        syslog(LOG_INFO, "Histogram %s: count=%llu, avg=%llu, p50<=%llu, p90<=%llu, p99<=%llu, max=%llu",
+               hists[i].name, count, atomic_load(&h->sum) / count,
+               (unsigned long long)histogram_quantile(h, 0.5), (unsigned long long)histogram_quantile(h, 0.9),
+               (unsigned long long)histogram_quantile(h, 0.99), atomic_load(&h->max));
+    }
+    
+    const log_queue_t *queue = &log_writer.queue;
+    if (queue->slots != NULL) {
+        syslog(LOG_INFO, "Log queue: depth=%u/%u, max_depth=%u, enqueued=%llu, dropped=%llu, write_dropped=%llu",
+               log_queue_depth(queue), queue->capacity, atomic_load(&queue->max_depth),
+               atomic_load(&queue->enqueued), atomic_load(&queue->dropped), atomic_load(&queue->write_dropped));
+    }
+    
+    for (int i = 0; i < device_count; i++) {
+        const pubsub_server_t *srv = &devices[i].pubsub;
+        if (srv->clients != NULL) {
+            syslog(LOG_INFO, "Subscribers %s: clients=%d/%d, published=%llu, dropped=%llu",
+                   devices[i].name, srv->client_count, srv->max_clients, srv->published, srv->dropped);
+        }
+    }
 }
 
 // Безопасное освобождение памяти
@@ -1115,61 +1630,3 @@ void safe_free(void **ptr) {
         *ptr = NULL;
     }
 }
-
-int main(int argc, char *argv[]) {
-    const char *config_file = (argc > 1) ? argv[1] : "/etc/pzem3/default.conf";
-    
-    pzem_data_t current_data, previous_data;
-    
-    if (initialize_system(config_file) != PZEM_SUCCESS) {
-        closelog();
-        return 1;
-    }
-    
-    initialize_data_structures(&current_data, &previous_data);
-    
-    // Логируем информацию о конфигурации
-    char thresholds[128] = "";
-    if (global_config.voltage_high_alarm > 0) strcat(thresholds, "V");
-    if (global_config.current_high_alarm > 0) strcat(thresholds, "I");
-    if (global_config.frequency_high_alarm > 0) strcat(thresholds, "Z");
-    if (global_config.angleV_high_alarm > 0) strcat(thresholds, "Av");
-    if (global_config.angleI_high_alarm > 0) strcat(thresholds, "Ai");
-    
-    if (device_type == 'U') {
-        syslog(LOG_INFO, "Config: UART %s@%d, addr=%d, interval=%dms, thresholds=%s", 
-               global_config.tty_port, global_config.baudrate, global_config.slave_addr, 
-               global_config.poll_interval_ms, thresholds);
-    } else {
-        syslog(LOG_INFO, "Config: TCP %s:%d, addr=%d, interval=%dms, thresholds=%s", 
-               global_config.tty_port, global_config.baudrate, global_config.slave_addr, 
-               global_config.poll_interval_ms, thresholds);
-    }
-    
-    syslog(LOG_INFO, "Monitoring started for config: %s", config_name);
-    
-    int error_count = 0;
-    const int max_error_count = 10;
-    
-    while (keep_running) {
-        process_iteration(&current_data, &previous_data);
-        
-        if (current_data.status != 0) {
-            error_count++;
-            if (error_count > max_error_count) {
-                safe_reconnect(&global_config);
-                error_count = 0;
-                // Переинициализируем структуры данных после переподключения
-                initialize_data_structures(&current_data, &previous_data);
-            }
-        } else {
-            error_count = 0;
-        }
-    }
-    
-    syslog(LOG_INFO, "Monitoring stopped for config: %s", config_name);
-    cleanup();
-    closelog();
-    
-    return 0;
-}
\ No newline at end of file
@@ -25,7 +25,7 @@ THE SOFTWARE.
 
 #include <stdio.h>
 #include <errno.h>
-#include <modbus/modbus.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
@@ -36,13 +36,73 @@ THE SOFTWARE.
 #include <syslog.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
-#define PZEM_FIFO_PATH "/tmp/pzem3_data_%s"
+#include "pzem_shm.h"
+#include "pzem_wire.h"
+#include "pzem_pzb.h"
+
+#define PZEM_SOCKET_PATH "/tmp/pzem3_data_%s.sock"
 #define MAX_RETRIES 3
+#define MODBUS_RETRY_DELAY_MS 10
+#define DEFAULT_MODBUS_TIMEOUT_MS 1000
+#define DEFAULT_MODBUS_TIMEOUT_MIN_MS 20
+#define DEFAULT_MODBUS_TIMEOUT_MARGIN_MS 30
+#define MIN_MODBUS_TIMEOUT_MS 5
+#define MAX_MODBUS_TIMEOUT_MS 10000
+#define PZEM_RTT_WINDOW 64
+#define PZEM_RTT_UPDATE_EVERY 8
+#define SCHEDULER_RETRY -2
+#define SCHEDULER_WAKEUP -3
+#define LINK_MAX_SILENT_CYCLES 10
+#define DEFAULT_RECONNECT_DELAY_MS 1000
+#define DEFAULT_RECONNECT_MAX_DELAY_MS 60000
+#define MIN_RECONNECT_DELAY_MS 100
+#define MAX_RECONNECT_DELAY_MS 600000
 #define DEFAULT_POLL_INTERVAL 500
-#define MAX_LOG_BUFFER_SIZE 25
+#define MAX_LOG_BUFFER_SIZE 10000
+#define DEFAULT_LOG_BUFFER_BYTES 4096
+#define MAX_LOG_BUFFER_BYTES (1024 * 1024)
+#define DEFAULT_LOG_FLUSH_MAX_AGE 60
+#define LOG_OPEN_RETRY_MS 5000           // повтор открытия файла лога после ошибки
+#define LOG_ERROR_INTERVAL_MS 60000      // ошибка открытия в syslog не чаще
+#define DEFAULT_LOG_MAX_SILENCE 300
+#define PZEM_MAX_ROLLUPS 3
+#define ROLLUP_ENTRY_SIZE 1024
+#define LOG_ENTRY_SIZE 256
+#define ROLLUP_BUFFER_MIN_BYTES (4 * ROLLUP_ENTRY_SIZE)
+#define DEFAULT_LOG_QUEUE_SIZE 256
+#define MIN_LOG_QUEUE_SIZE 16
+#define MAX_LOG_QUEUE_SIZE 65536
+#define DEFAULT_PUBSUB_MAX_CLIENTS 16
+#define MAX_PUBSUB_CLIENTS 256
+#define DEFAULT_PUBSUB_QUEUE_SIZE 64
+#define MAX_PUBSUB_QUEUE_SIZE 4096
+#define DEFAULT_HISTORY_SIZE 4096
+#define MAX_HISTORY_SIZE (1024 * 1024)
+#define DEFAULT_HTTP_PAGE "/usr/local/share/pzem3/graph.html"
+#define HTTP_MAX_CONNS 16
+#define HTTP_REQUEST_MAX 2048
+#define HTTP_CHUNK_SIZE 16384
+#define HTTP_SSE_BACKLOG (64 * 1024)
+#define DEFAULT_SHM_RECORDS 1024
+#define MAX_SHM_RECORDS (1024 * 1024)
 #define MIN_POLL_INTERVAL 200
 #define MAX_POLL_INTERVAL 10000
+#define DEFAULT_POLL_INTERVAL_MAX 5000
+#define DEFAULT_POLL_ADAPTIVE_MARGIN 10
+#define DEFAULT_POLL_ADAPTIVE_HOLD 10
+#define PZEM_MAX_DEVICES 32
+#define PZEM_REG_COUNT 20
+#define PZEM_MAX_REG_GROUPS 8
+#define MIN_REG_GROUP_INTERVAL 50
+#define PZEM_FORMAT_COUNT 3
+#define PZEM_CHANNEL_COUNT 17
+#define PZEM_STATE_COUNT 14
 
 // Макросы для безопасного копирования строк
 #define STRCPY_SAFE(dest, src) do { \
@@ -67,14 +127,78 @@ typedef enum {
     PZEM_ERROR_INVALID_PARAM = -5
 } pzem_result_t;
 
+// Политика синхронизации лог-файлов на носитель
+typedef enum {
+    LOG_SYNC_NONE = 0,      // только page cache
+    LOG_SYNC_BATCH,         // fdatasync после каждой пачки
+    LOG_SYNC_PERIODIC       // fdatasync не чаще log_sync_interval_s
+} log_sync_mode_t;
+
+// Какие измерения попадают в лог
+typedef enum {
+    LOG_MODE_CHANGE = 0,    // строка целиком, если хоть один канал сдвинулся больше *_sensitivity
+    LOG_MODE_SDT            // swinging door по каналам, погрешность восстановления <= *_sensitivity
+} log_mode_t;
+
+// Формат вывода измерений для лога и подписчиков
+typedef enum {
+    PZEM_FORMAT_CSV = 0,
+    PZEM_FORMAT_BINARY,
+    PZEM_FORMAT_JSON,
+    PZEM_FORMAT_COMPRESSED          // только лог: блоки собирает поток записи из binary
+} pzem_format_t;
+
+// Группа регистров со своим периодом опроса
+typedef struct {
+    int start;                           // первый регистр
+    int count;
+    int interval_ms;
+    int every;                           // читать раз в every циклов базового периода
+} pzem_reg_group_t;
+
 // Структура для хранения конфигурации
 typedef struct {
     char tty_port[64];
     int baudrate;
     int slave_addr;
+    int slave_addrs[PZEM_MAX_DEVICES];   // все адреса устройств на шине
+    int slave_count;
     int poll_interval_ms;
+    int poll_align;                      // выравнивать опрос на границы периода по часам
+    int poll_adaptive;                   // период опроса по активности сигнала
+    int poll_interval_min_ms;            // период при изменениях и у порогов
+    int poll_interval_max_ms;            // предел замедления в тишине
+    int poll_adaptive_margin;            // близость к *_warning, % ширины нормальной зоны
+    int poll_adaptive_hold;              // спокойных циклов до начала замедления
+    int modbus_timeout_ms;               // тайм-аут ответа, в авто режиме - начальный и верхний предел
+    int modbus_timeout_auto;             // тайм-аут по измеренному времени ответа
+    int modbus_timeout_min_ms;
+    int modbus_timeout_margin_ms;        // запас к p99 времени ответа
+    int reconnect_delay_ms;              // первая пауза перед переподключением
+    int reconnect_max_delay_ms;          // предел роста паузы
+    pzem_reg_group_t reg_groups[PZEM_MAX_REG_GROUPS];  // по возрастанию start, покрывают все регистры
+    int reg_group_count;
     char log_dir[256];
-    int log_buffer_size;
+    int log_buffer_size;                 // сброс по числу строк, 0 - только по размеру
+    int log_buffer_bytes;                // размер буфера логов в байтах
+    int log_flush_max_age_s;             // максимальное время строки в буфере
+    int log_queue_size;                  // очередь строк к потоку записи
+    int log_prealloc_kb;                 // преаллокация лог-файла блоками, 0 - выключено
+    log_sync_mode_t log_sync;
+    int log_sync_interval_s;
+    log_mode_t log_mode;
+    int log_max_silence_s;               // sdt: канал пишется хотя бы так часто, 0 - без ограничения
+    int rollup_periods[PZEM_MAX_ROLLUPS];  // окна сводок в секундах, каждое кратно предыдущему
+    int rollup_count;                    // 0 - сводки выключены
+    pzem_format_t log_format;
+    pzem_format_t pubsub_format;
+    int pubsub_max_clients;              // подписчиков на сокет устройства
+    int pubsub_queue_size;               // строк в очереди каждого подписчика
+    int shm_records;                     // записей в кольце разделяемой памяти, 0 - выключено
+    int history_size;                    // измерений в памяти на устройство для /range
+    int http_port;                       // встроенный HTTP сервер, 0 - выключен
+    char http_bind[64];
+    char http_page[256];                 // страница графиков для "/"
     
     // Чувствительность изменений
     float voltage_sensitivity;
@@ -111,66 +235,406 @@ typedef struct {
     float frequency_low_alarm;
 } pzem_config_t;
 
+// Каналы измерений, порядок совпадает с порядком полей в CSV
+typedef enum {
+    PZEM_CH_VOLTAGE_A = 0,
+    PZEM_CH_VOLTAGE_B,
+    PZEM_CH_VOLTAGE_C,
+    PZEM_CH_CURRENT_A,
+    PZEM_CH_CURRENT_B,
+    PZEM_CH_CURRENT_C,
+    PZEM_CH_FREQUENCY_A,
+    PZEM_CH_FREQUENCY_B,
+    PZEM_CH_FREQUENCY_C,
+    PZEM_CH_ANGLEV_B,
+    PZEM_CH_ANGLEV_C,
+    PZEM_CH_ANGLEI_A,
+    PZEM_CH_ANGLEI_B,
+    PZEM_CH_ANGLEI_C,
+    PZEM_CH_POWER_A,
+    PZEM_CH_POWER_B,
+    PZEM_CH_POWER_C
+} pzem_channel_id_t;
+
+// Группы каналов с общей чувствительностью и порогами
+typedef enum {
+    PZEM_GROUP_VOLTAGE = 0,
+    PZEM_GROUP_CURRENT,
+    PZEM_GROUP_FREQUENCY,
+    PZEM_GROUP_ANGLEV,
+    PZEM_GROUP_ANGLEI,
+    PZEM_GROUP_POWER
+} pzem_group_t;
+
+// Описание канала: где лежит в регистрах и как декодируется
+typedef struct {
+    const char *name;
+    uint8_t reg;            // первый регистр
+    uint8_t wide;           // 32-битное значение из двух регистров (мощность)
+    uint16_t scale;         // значение = регистр / scale
+    uint8_t decimals;
+    uint8_t group;
+} pzem_channel_t;
+
+// Сырой снимок регистров, значения декодируются только по запросу
+typedef struct {
+    uint16_t regs[PZEM_REG_COUNT];
+    long long timestamp_ms;          // время чтения, мс от эпохи
+} pzem_sample_t;
+
 // Структура для хранения данных
 typedef struct {
-    float voltage_A;
-    float voltage_B;
-    float voltage_C;
-    float current_A;
-    float current_B;
-    float current_C;
-    float frequency_A;
-    float frequency_B;
-    float frequency_C;
-    float angleV_B;
-    float angleV_C;
-    float angleI_A;
-    float angleI_B;
-    float angleI_C;
-    float power_A;
-    float power_B;
-    float power_C;
+    pzem_sample_t sample;
     int status;
     int first_read;
-    
-    // Состояния порогов
-    char voltage_state_A;
-    char voltage_state_B;
-    char voltage_state_C;
-    char current_state_A;
-    char current_state_B;
-    char current_state_C;
-    char frequency_state_A;
-    char frequency_state_B;
-    char frequency_state_C;
-    char angleV_state_B;
-    char angleV_state_C;
-    char angleI_state_A;
-    char angleI_state_B;
-    char angleI_state_C;
+    char state[PZEM_STATE_COUNT];    // состояния порогов H/L/N каналов 0-13
     char rotaryP;
+    uint32_t omit;                   // биты каналов без значения в строке лога (SDT)
 } pzem_data_t;
 
-// Структура для порогов
+// Измерение, закодированное в запрошенных форматах (каждый - не больше одного раза)
+typedef struct {
+    const pzem_data_t *data;
+    int slave_addr;
+    unsigned int ready;                      // биты уже закодированных форматов
+    size_t len[PZEM_FORMAT_COUNT];
+    char buf[PZEM_FORMAT_COUNT][LOG_ENTRY_SIZE];
+} pzem_encode_cache_t;
+
+// Чувствительность и пороги канала в единицах регистра
+typedef struct {
+    int32_t deadband;                // изменение больше deadband считается новым значением
+    int enabled;                     // пороги заданы
+    int32_t high_alarm;              // value >= high_alarm -> H
+    int32_t high_warning;            // H держится пока value > high_warning
+    int32_t low_warning;             // L держится пока value < low_warning
+    int32_t low_alarm;               // value <= low_alarm -> L
+    int32_t near_high;               // value >= near_high - рядом с high_warning
+    int32_t near_low;                // value <= near_low - рядом с low_warning
+} pzem_channel_limits_t;
+
+// Swinging door одного канала: последняя записанная точка и коридор наклонов
+// прямых из нее, проходящих не дальше deadband от всех измерений после нее
 typedef struct {
-    float high_alarm;
-    float high_warning;
-    float low_warning;
-    float low_alarm;
-} threshold_config_t;
+    long long t0;
+    int32_t v0;
+    double slope_min;
+    double slope_max;
+} pzem_sdt_channel_t;
 
-// Структура для буферизации логов
 typedef struct {
-    char **buffer;
-    int size;
-    int capacity;
-    int read_index;
-    int write_index;
-    pthread_mutex_t mutex;
+    int primed;                      // есть предыдущее измерение
+    pzem_data_t last;                // предыдущее измерение - кандидат в конец отрезков
+    pzem_sdt_channel_t ch[PZEM_CHANNEL_COUNT];
+} pzem_sdt_t;
+
+// Сжатый блок лога в процессе сборки (формат в pzem_pzb.h)
+typedef struct {
+    uint8_t *block;                  // заголовок блока, данные следом; NULL - блок не открыт
+    size_t limit;                    // предел данных блока в байтах
+    size_t bits;                     // записано бит данных
+    unsigned int count;
+    int slave_addr;
+    long long first_ms;
+    long long last_ms;
+    long long last_delta;            // прошлый интервал для delta-of-delta
+    int status;
+    char state[PZEM_STATE_COUNT];
+    uint32_t values[PZEM_CHANNEL_COUNT];  // последние удачные значения каналов
+} pzb_encoder_t;
+
+// Чтение одного сжатого блока
+typedef struct {
+    const uint8_t *data;             // данные блока после заголовка
+    size_t size;
+    size_t bit;
+    unsigned int left;               // непрочитанных измерений
+    unsigned int index;
+    int slave_addr;
+    long long last_ms;
+    long long last_delta;
+    int status;
+    char state[PZEM_STATE_COUNT];
+    uint32_t values[PZEM_CHANNEL_COUNT];
+} pzb_decoder_t;
+
+// Структура для буферизации логов: строки подряд в одном блоке памяти
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+    size_t entry_max;               // самая длинная строка потока - запас перед сбросом
+    int lines;
+    int max_lines;
+    long long first_entry_ms;       // время попадания в буфер самой старой строки
+    time_t batch_day_start;         // сутки строк пачки - в их файл пачка и пишется
+    time_t batch_day_end;
+    long long max_age_ms;
     char log_dir[256];
     char config_name[64];
+    const char *file_ext;
+    
+    // Открытый файл лога: сутки [day_start, day_end) по локальному времени
+    int fd;
+    time_t day_start;
+    time_t day_end;
+    off_t file_size;
+    off_t alloc_end;                // конец преаллоцированной области
+    off_t prealloc_bytes;
+    log_sync_mode_t sync_mode;
+    long long sync_interval_ms;
+    long long last_sync_ms;
+    int unsynced;
+    
+    // Файл не открывается: следующая попытка не раньше retry_ms
+    long long retry_ms;
+    long long error_logged_ms;
+    unsigned int open_failures;
+    unsigned long long lost_lines;          // отброшено за время ошибки
+    
+    // Сжатый лог: в data закрытые блоки и открытый блок в конце
+    int compressed;
+    size_t block_start;
+    pzb_encoder_t pzb;
 } log_buffer_t;
 
+// Окно сводки: min/max/сумма по каналам и время в состояниях порогов
+typedef struct {
+    int open;
+    long long start_ms;
+    uint32_t samples;                // удачных измерений
+    uint32_t errors;                 // ошибок чтения
+    uint32_t min[PZEM_CHANNEL_COUNT];
+    uint32_t max[PZEM_CHANNEL_COUNT];
+    uint64_t sum[PZEM_CHANNEL_COUNT];
+    uint32_t state_ms[PZEM_STATE_COUNT][3];  // время в N, H, L
+} pzem_rollup_window_t;
+
+// Сводки устройства: окна уровней от мелкого к крупному и их файлы
+typedef struct {
+    pzem_rollup_window_t win[PZEM_MAX_ROLLUPS];
+    int has_last;                    // прошлое измерение удачное, его состояния держатся до следующего
+    long long last_ms;
+    char last_state[PZEM_STATE_COUNT];
+    log_buffer_t buffer[PZEM_MAX_ROLLUPS];
+} pzem_rollup_t;
+
+// Ячейка очереди строк лога
+typedef struct {
+    int device;
+    int stream;                      // 0 - лог измерений, 1.. - уровни сводок
+    long long time_ms;               // метка времени строки, по ней выбирается файл суток
+    uint16_t len;
+    uint8_t more;                    // строка продолжается в следующей ячейке
+    char line[LOG_ENTRY_SIZE];
+} log_slot_t;
+
+// Кольцевая очередь один писатель / один читатель без блокировок
+typedef struct {
+    log_slot_t *slots;
+    unsigned int capacity;                      // степень двойки
+    atomic_uint head;                           // пишет поток опроса
+    atomic_uint tail;                           // пишет поток записи
+    atomic_ullong enqueued;
+    atomic_ullong dropped;
+    atomic_ullong write_dropped;                // строки пачек, отброшенных без файла лога
+    atomic_uint max_depth;
+} log_queue_t;
+
+// Поток записи логов на диск
+typedef struct {
+    log_queue_t queue;
+    sem_t items;
+    pthread_t thread;
+    atomic_int running;
+    // Снимок конфигурации на момент запуска: global_config поток записи не читает,
+    // его подменяет перечитывание по SIGHUP
+    int devices;
+    int streams;                                // лог измерений и уровни сводок
+    char joined[ROLLUP_ENTRY_SIZE];             // строка, собранная из нескольких ячеек
+} log_writer_t;
+
+// Дескриптор, обслуживаемый циклом событий планировщика
+typedef struct pzem_watch pzem_watch_t;
+struct pzem_watch {
+    int fd;
+    void (*cb)(pzem_watch_t *watch, uint32_t events);
+    void *data;
+};
+
+// Планировщик опроса на абсолютных дедлайнах
+typedef struct {
+    int epoll_fd;
+    int timer_fd;
+    clockid_t clock_id;
+    int align;
+    long long interval_ns;
+    long long next_ns;         // следующий дедлайн
+    long long missed;          // пропущенные периоды
+    pzem_watch_t wakeup;       // eventfd для пробуждения по сигналу
+    int woken;                 // eventfd сработал - ожидание прерывается
+    long long retry_ns;        // отложенный повтор чтения, 0 - не запланирован
+} pzem_scheduler_t;
+
+// Строка в очереди подписчика
+typedef struct {
+    char line[LOG_ENTRY_SIZE];
+    uint16_t len;
+} pubsub_msg_t;
+
+typedef struct pubsub_server pubsub_server_t;
+
+// Подписчик: своя очередь, при переполнении теряются самые старые строки
+typedef struct {
+    pzem_watch_t watch;
+    pubsub_server_t *server;
+    pubsub_msg_t *queue;
+    unsigned int head;
+    unsigned int count;
+    char pending[LOG_ENTRY_SIZE];    // строка, отправленная не целиком
+    size_t pending_len;
+    size_t pending_off;
+    uint32_t events;
+    unsigned long long dropped;
+} pubsub_client_t;
+
+// Сервер публикации данных устройства через Unix-сокет
+struct pubsub_server {
+    pzem_watch_t listen;
+    pzem_scheduler_t *sched;
+    char path[108];
+    pubsub_client_t *clients;
+    int max_clients;
+    int client_count;
+    unsigned int queue_size;
+    unsigned long long published;
+    unsigned long long dropped;
+};
+
+// Кольцо измерений в разделяемой памяти (сторона демона)
+typedef struct {
+    pzem_shm_header_t *hdr;
+    size_t size;
+    char name[96];
+    uint64_t next;                   // номер следующего измерения
+} pzem_shm_t;
+
+// Измерение в истории
+typedef struct {
+    pzem_sample_t sample;
+    char state[PZEM_STATE_COUNT];
+    uint8_t status;
+} pzem_history_entry_t;
+
+// Кольцо последних записанных измерений устройства
+typedef struct {
+    pzem_history_entry_t *entries;
+    unsigned int capacity;
+    unsigned int count;
+    unsigned int head;               // позиция следующей записи
+} pzem_history_t;
+
+// Время ответа устройства на запрос группы регистров и тайм-аут по нему
+typedef struct {
+    uint32_t samples_us[PZEM_RTT_WINDOW];  // последние удачные запросы
+    unsigned int count;
+    unsigned int head;
+    unsigned int since_update;
+    unsigned int timeouts;           // тайм-аутов подряд
+    uint32_t timeout_us;             // текущий тайм-аут ответа
+} pzem_rtt_t;
+
+// Структура устройства на шине (своё состояние, лог и сокет данных)
+typedef struct {
+    int slave_addr;
+    char name[64];
+    pzem_data_t current;
+    pzem_data_t previous;
+    log_buffer_t log_buffer;
+    pubsub_server_t pubsub;
+    pzem_history_t history;
+    pzem_sdt_t sdt;
+    pzem_rollup_t rollup;
+    unsigned long long reads;
+    unsigned long long read_errors;
+    unsigned long long group_tick[PZEM_MAX_REG_GROUPS];  // цикл последнего чтения группы
+    unsigned int groups_read;        // биты групп, прочитанных после старта или переподключения
+    unsigned int pending_groups;     // биты групп, ждущих чтения в текущем цикле
+    pzem_rtt_t rtt[PZEM_MAX_REG_GROUPS];
+    int attempts;                    // попыток чтения в текущем цикле
+    int retry_pending;               // повтор отложен в цикл событий
+} pzem_device_t;
+
+// Состояние соединения с шиной
+typedef enum {
+    PZEM_LINK_CONNECTED = 0,
+    PZEM_LINK_BACKOFF,                   // пауза перед следующей попыткой
+    PZEM_LINK_RECONNECTING
+} pzem_link_state_t;
+
+typedef struct {
+    pzem_link_state_t state;
+    int silent_cycles;                   // циклов подряд без ответа всей шины
+    int attempts;                        // неудачных попыток переподключения подряд
+    long long retry_at_ms;               // время следующей попытки
+    long long down_since_ms;
+    unsigned int seed;                   // разброс паузы
+} pzem_link_t;
+
+typedef struct http_server http_server_t;
+typedef struct http_conn http_conn_t;
+
+typedef enum {
+    HTTP_CONN_READING = 0,           // ждем заголовки запроса
+    HTTP_CONN_WRITING,               // отдаем ответ, затем закрываем
+    HTTP_CONN_STREAMING              // поток SSE /live
+} http_conn_state_t;
+
+// Соединение HTTP: ответ собирается частями по мере готовности сокета
+struct http_conn {
+    pzem_watch_t watch;
+    http_server_t *server;
+    http_conn_state_t state;
+    char request[HTTP_REQUEST_MAX];
+    size_t request_len;
+    char *out;
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    int (*produce)(http_conn_t *conn);   // следующая часть ответа, 0 - ответ закончен
+    int device;
+    pzem_format_t format;
+    pzem_history_entry_t *range;         // копия диапазона истории для /range
+    unsigned int range_count;
+    unsigned int range_pos;
+    int range_column;
+    long long accepted_ms;
+    uint32_t events;
+};
+
+// Встроенный HTTP сервер на цикле событий планировщика
+struct http_server {
+    pzem_watch_t listen;
+    pzem_scheduler_t *sched;
+    http_conn_t conns[HTTP_MAX_CONNS];
+    char *page;
+    size_t page_len;
+    int streams;                     // открытых потоков /live
+    unsigned long long requests;
+    unsigned long long sse_dropped;
+};
+
+// Гистограмма с логарифмическими корзинами: корзина i - значения до 2^i включительно,
+// последняя - все что больше. Один писатель, читать можно из любого потока.
+#define PZEM_HIST_BUCKETS 28
+
+typedef struct {
+    atomic_ullong buckets[PZEM_HIST_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+} pzem_histogram_t;
+
 // Структура для метрик производительности
 typedef struct {
     long long total_iterations;
@@ -178,68 +642,191 @@ typedef struct {
     long long modbus_time_total;
     long long processing_time_total;
     long long max_iteration_time;
+    long long missed_deadlines;
+    long long reconnects;
+    long long retries;                   // отложенные повторы чтения
+    long long link_down_ms;              // суммарное время без соединения
     long long start_time;
+    
+    // Распределения в микросекундах
+    pzem_histogram_t modbus_rtt_us;      // один запрос Modbus
+    pzem_histogram_t modbus_attempts;    // попыток на одно чтение
+    pzem_histogram_t processing_us;      // обработка измерения после чтения
+    pzem_histogram_t flush_us;           // запись пачки в файл (поток записи)
+    pzem_histogram_t interval_us;        // между началами циклов опроса
+    long long last_cycle_us;
+    int poll_interval_ms;                // текущий период опроса (меняется в адаптивном режиме)
 } performance_metrics_t;
 
 // Глобальные переменные
-extern modbus_t *ctx;
+// Контекст libmodbus (modbus_t): заголовок libmodbus подключает только демон,
+// утилиты с этим заголовком собираются без libmodbus-dev
+extern struct _modbus *ctx;
 extern volatile sig_atomic_t keep_running;
-extern log_buffer_t log_buffer;
+extern volatile sig_atomic_t dump_metrics;
+extern volatile sig_atomic_t reload_requested;
+extern pzem_device_t devices[PZEM_MAX_DEVICES];
+extern int device_count;
 extern pzem_config_t global_config;
 extern char *service_name;
 extern char config_name[64];
-extern char fifo_path[256];
 extern char device_type;
 extern performance_metrics_t metrics;
+extern pzem_scheduler_t scheduler;
+extern log_writer_t log_writer;
+extern pzem_shm_t shm_ring;
+extern http_server_t http_server;
+extern pzem_link_t bus_link;
+extern const pzem_channel_t pzem_channels[PZEM_CHANNEL_COUNT];
+extern pzem_channel_limits_t channel_limits[PZEM_CHANNEL_COUNT];
 
 // Функции конфигурации
 pzem_result_t load_config(const char *config_file, pzem_config_t *config);
 int create_directory_if_not_exists(const char *path);
 pzem_result_t validate_config(const pzem_config_t *config);
 void extract_config_name(const char *config_path);
+int parse_slave_list(const char *value, int *addrs, int max_count);
+int parse_reg_group(const char *value, pzem_reg_group_t *group);
+pzem_result_t reload_config(void);
 
-// Функции для FIFO
-int init_data_fifo(const char *fifo_path);
-int write_to_fifo(const char *fifo_path, const char *data);
-void cleanup_fifo(const char *fifo_path);
+// Публикация данных подписчикам
+pzem_result_t pubsub_init(pubsub_server_t *srv, pzem_scheduler_t *sched, const char *path,
+                          int max_clients, int queue_size);
+void pubsub_publish(pubsub_server_t *srv, const char *line, size_t len);
+void pubsub_close(pubsub_server_t *srv);
+
+// История измерений в памяти
+pzem_result_t history_init(pzem_history_t *hist, int capacity);
+void history_free(pzem_history_t *hist);
+void history_add(pzem_history_t *hist, const pzem_data_t *data);
+const pzem_history_entry_t *history_at(const pzem_history_t *hist, unsigned int index);
+unsigned int history_lower_bound(const pzem_history_t *hist, long long timestamp_ms);
+
+// Сводки по окнам времени
+pzem_result_t rollup_init(pzem_device_t *dev, const pzem_config_t *config);
+void rollup_free(pzem_device_t *dev, const pzem_config_t *config);
+void rollup_add(pzem_device_t *dev, const pzem_data_t *data);
+void rollup_flush(pzem_device_t *dev);
+int parse_rollup_periods(const char *value, int *periods, int max_count);
+
+// Встроенный HTTP сервер
+pzem_result_t http_init(http_server_t *srv, pzem_scheduler_t *sched, const pzem_config_t *config);
+void http_publish(http_server_t *srv, int device, const char *line, size_t len);
+void http_close(http_server_t *srv);
+int http_printf(http_conn_t *conn, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Метрики Prometheus для /metrics и гистограммы задержек
+void metrics_render(http_conn_t *conn);
+void histogram_add(pzem_histogram_t *hist, uint64_t value);
+uint64_t histogram_quantile(const pzem_histogram_t *hist, double q);
+
+// Кольцо измерений в разделяемой памяти
+pzem_result_t pzem_shm_open(pzem_shm_t *shm, const char *name, int capacity);
+void pzem_shm_publish(pzem_shm_t *shm, int slave_addr, const pzem_data_t *data);
+void pzem_shm_close(pzem_shm_t *shm);
 
 // Функции работы с логами
-pzem_result_t init_log_buffer(log_buffer_t *buffer, int initial_capacity, const char *log_dir);
-pzem_result_t add_to_log_buffer(log_buffer_t *buffer, const char *log_entry);
+pzem_result_t init_log_buffer(log_buffer_t *buffer, const pzem_config_t *config, const char *name);
+pzem_result_t log_buffer_open_file(log_buffer_t *buffer, time_t when);
+pzem_result_t add_to_log_buffer(log_buffer_t *buffer, const char *log_entry, size_t len, time_t when);
 pzem_result_t flush_log_buffer(log_buffer_t *buffer);
 void free_log_buffer(log_buffer_t *buffer);
 long long get_time_ms(void);
+long long get_time_us(void);
+long long get_wall_time_ms(void);
 void get_current_date(char *date_str, size_t size);
 void get_current_time(char *time_str, size_t size);
-void get_log_file_path(char *path, size_t size, const char *log_dir);
-void prepare_log_entry(char *log_entry, size_t size, const pzem_data_t *data);
+void get_log_file_path(char *path, size_t size, const char *log_dir, const char *name, const char *ext,
+                       time_t when);
 int should_flush_buffer(const log_buffer_t *buffer);
+long long log_buffer_deadline(const log_buffer_t *buffer);
+
+// Декодирование и форматирование
+uint32_t pzem_channel_raw(const pzem_sample_t *sample, int channel);
+float pzem_channel_value(const pzem_sample_t *sample, int channel);
+void pzem_channel_set_raw(pzem_sample_t *sample, int channel, uint32_t raw);
+size_t format_csv_entry(char *out, size_t size, const pzem_data_t *data, time_t t);
+size_t prepare_log_entry(char *log_entry, size_t size, const pzem_data_t *data);
+size_t format_channel_value(char *out, const pzem_sample_t *sample, int channel);
+size_t format_json_entry(char *out, size_t size, const pzem_data_t *data, int slave_addr);
+size_t format_binary_entry(char *out, size_t size, const pzem_data_t *data, int slave_addr);
+int parse_binary_entry(const char *in, size_t len, pzem_data_t *data, int *slave_addr);
+size_t format_rollup_entry(char *out, size_t size, const pzem_rollup_window_t *w, int period_s);
+int parse_output_format(const char *value);
+
+// Разбор строк CSV лога (инструменты и бенчмарки)
+int parse_csv_entry(const char *line, pzem_data_t *data);
+const char *output_format_ext(pzem_format_t format);
+void encode_cache_init(pzem_encode_cache_t *cache, const pzem_data_t *data, int slave_addr);
+const char *encode_cache_get(pzem_encode_cache_t *cache, pzem_format_t format, size_t *len);
+
+// Сжатые блоки лога
+void pzb_begin(pzb_encoder_t *enc, uint8_t *block, size_t capacity, int slave_addr);
+int pzb_add(pzb_encoder_t *enc, const pzem_data_t *data);
+size_t pzb_size(const pzb_encoder_t *enc);
+size_t pzb_finish(pzb_encoder_t *enc);
+long pzb_open(pzb_decoder_t *dec, const uint8_t *buf, size_t len);
+int pzb_next(pzb_decoder_t *dec, pzem_data_t *data);
+
+// Поток записи логов
+pzem_result_t log_writer_start(log_writer_t *writer, const pzem_config_t *config);
+pzem_result_t log_writer_submit(log_writer_t *writer, int device, int stream, long long time_ms,
+                                const char *log_entry, size_t len);
+void log_writer_stop(log_writer_t *writer);
+void log_writer_free(log_writer_t *writer);
+unsigned int log_queue_depth(const log_queue_t *queue);
 
 // Функции Modbus
 pzem_result_t init_modbus_connection(const pzem_config_t *config);
-pzem_result_t read_pzem_data(pzem_data_t *data);
-pzem_result_t read_pzem_data_with_retry(pzem_data_t *data, int max_retries);
+pzem_result_t read_pzem_data(int slave_addr, pzem_data_t *data, int start, int count);
 void cleanup(void);
-void safe_reconnect(const pzem_config_t *config);
+void close_modbus_connection(void);
+void mark_devices_offline(void);
 
 // Функции обработки данных
-float lsbVal(uint16_t dat);
-int values_changed(const pzem_data_t *current, const pzem_data_t *previous, const pzem_config_t *config);
-void update_threshold_state(float value, char* state, const threshold_config_t* config);
-void update_threshold_states(pzem_data_t *data, const pzem_config_t *config);
+void build_channel_limits(const pzem_config_t *config, pzem_channel_limits_t *limits);
+int values_changed(const pzem_data_t *current, const pzem_data_t *previous, const pzem_channel_limits_t *limits);
+void update_threshold_state(int32_t value, char *state, const pzem_channel_limits_t *limits);
+void update_threshold_states(pzem_data_t *data, const pzem_channel_limits_t *limits);
 int threshold_states_changed(const pzem_data_t *current, const pzem_data_t *previous);
+int near_thresholds(const pzem_data_t *data, const pzem_channel_limits_t *limits);
+int sdt_flush(pzem_sdt_t *sdt, pzem_data_t *row);
+int sdt_update(pzem_sdt_t *sdt, const pzem_data_t *current, const pzem_channel_limits_t *limits,
+               long long max_silence_ms, pzem_data_t rows[2]);
 pzem_result_t validate_thresholds(const pzem_config_t *config);
 
 // Сигналы и инициализация
 void signal_handler(int sig);
 void setup_signal_handlers(void);
 pzem_result_t initialize_system(const char *config_file);
+pzem_result_t init_devices(const pzem_config_t *config);
 void initialize_data_structures(pzem_data_t *current, pzem_data_t *previous);
-void process_iteration(pzem_data_t *current, pzem_data_t *previous);
+void reset_device_reads(pzem_device_t *dev);
+void flush_device_sdt(pzem_device_t *dev);
+int process_iteration(pzem_device_t *dev, pzem_result_t read_result);
+int poll_cycle(void);
+void retry_cycle(void);
+
+// Соединение с шиной
+void link_init(pzem_link_t *link);
+void link_cycle_done(pzem_link_t *link, int failed);
+int link_poll(pzem_link_t *link);
+void link_restart(pzem_link_t *link);
 void update_metrics(performance_metrics_t *metrics, long long iteration_time, 
                    long long modbus_time, int had_error);
 void print_metrics(const performance_metrics_t *metrics);
 
+// Планировщик и цикл событий
+pzem_result_t scheduler_init(pzem_scheduler_t *sched, int interval_ms, int align);
+void scheduler_set_interval(pzem_scheduler_t *sched, int interval_ms);
+int scheduler_add_watch(pzem_scheduler_t *sched, pzem_watch_t *watch, uint32_t events);
+int scheduler_mod_watch(pzem_scheduler_t *sched, pzem_watch_t *watch, uint32_t events);
+void scheduler_del_watch(pzem_scheduler_t *sched, pzem_watch_t *watch);
+void scheduler_wakeup(pzem_scheduler_t *sched);
+void scheduler_retry_after(pzem_scheduler_t *sched, int delay_ms);
+int scheduler_wait(pzem_scheduler_t *sched);
+void scheduler_close(pzem_scheduler_t *sched);
+
 // Утилиты
 void safe_free(void **ptr);
 
@@ -0,0 +1,293 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Раздача строк данных подписчикам через Unix-сокет.
+// Соединения держатся открытыми, у каждого клиента своя ограниченная очередь:
+// при переполнении отбрасываются самые старые строки, опрос никогда не ждет клиента.
+
+#define _GNU_SOURCE
+#include "pzem_monitor.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void pubsub_client_close(pubsub_client_t *client) {
+    pubsub_server_t *srv = client->server;
+    
+    if (client->watch.fd >= 0) {
+        scheduler_del_watch(srv->sched, &client->watch);
+        close(client->watch.fd);
+        client->watch.fd = -1;
+        srv->client_count--;
+    }
+    free(client->queue);
+    client->queue = NULL;
+    client->count = 0;
+    client->pending_len = 0;
+    client->pending_off = 0;
+}
+
+// Интерес к EPOLLOUT только пока есть что дописывать
+static void pubsub_client_update_events(pubsub_client_t *client) {
+    uint32_t events = EPOLLIN;
+    if (client->pending_off < client->pending_len || client->count > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != client->events) {
+        client->events = events;
+        scheduler_mod_watch(client->server->sched, &client->watch, events);
+    }
+}
+
+// Дописываем недописанное и очередь. Возвращает -1 если клиент отвалился.
+static int pubsub_client_flush(pubsub_client_t *client) {
+    for (;;) {
+        while (client->pending_off < client->pending_len) {
+            ssize_t n = send(client->watch.fd, client->pending + client->pending_off,
+                             client->pending_len - client->pending_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                return -1;
+            }
+            client->pending_off += (size_t)n;
+        }
+        
+        if (client->count == 0) return 0;
+        
+        // Следующая строка из очереди становится текущей
+        pubsub_msg_t *msg = &client->queue[client->head];
+        memcpy(client->pending, msg->line, msg->len);
+        client->pending_len = msg->len;
+        client->pending_off = 0;
+        client->head = (client->head + 1) % client->server->queue_size;
+        client->count--;
+    }
+}
+
+static void pubsub_client_cb(pzem_watch_t *watch, uint32_t events) {
+    pubsub_client_t *client = watch->data;
+    
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        pubsub_client_close(client);
+        return;
+    }
+    
+    if (events & EPOLLIN) {
+        // Клиенту писать нечего - вычитываем и проверяем, не закрыл ли он соединение
+        char discard[256];
+        ssize_t n;
+        while ((n = recv(watch->fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0) {
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            pubsub_client_close(client);
+            return;
+        }
+    }
+    
+    if (events & EPOLLOUT) {
+        if (pubsub_client_flush(client) != 0) {
+            pubsub_client_close(client);
+            return;
+        }
+    }
+    
+    pubsub_client_update_events(client);
+}
+
+static void pubsub_accept_cb(pzem_watch_t *watch, uint32_t events) {
+    (void)events;
+    pubsub_server_t *srv = watch->data;
+    
+    for (;;) {
+        int fd = accept4(watch->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                syslog(LOG_WARNING, "Subscriber accept failed on %s: %s", srv->path, strerror(errno));
+            }
+            return;
+        }
+        
+        pubsub_client_t *client = NULL;
+        for (int i = 0; i < srv->max_clients; i++) {
+            if (srv->clients[i].watch.fd < 0) {
+                client = &srv->clients[i];
+                break;
+            }
+        }
+        if (client == NULL) {
+            syslog(LOG_WARNING, "Too many subscribers on %s (max %d), connection refused", 
+                   srv->path, srv->max_clients);
+            close(fd);
+            continue;
+        }
+        
+        client->queue = calloc(srv->queue_size, sizeof(pubsub_msg_t));
+        if (client->queue == NULL) {
+            syslog(LOG_ERR, "Memory allocation failed for subscriber queue");
+            close(fd);
+            continue;
+        }
+        client->head = 0;
+        client->count = 0;
+        client->pending_len = 0;
+        client->pending_off = 0;
+        client->dropped = 0;
+        client->events = EPOLLIN;
+        client->watch.fd = fd;
+        if (scheduler_add_watch(srv->sched, &client->watch, client->events) != 0) {
+            syslog(LOG_ERR, "Failed to register subscriber: %s", strerror(errno));
+            close(fd);
+            client->watch.fd = -1;
+            free(client->queue);
+            client->queue = NULL;
+            continue;
+        }
+        srv->client_count++;
+#ifdef DEBUG
+        syslog(LOG_DEBUG, "Subscriber connected to %s (%d total)", srv->path, srv->client_count);
+#endif
+    }
+}
+
+// Создание слушающего сокета и регистрация в цикле событий
+pzem_result_t pubsub_init(pubsub_server_t *srv, pzem_scheduler_t *sched, const char *path,
+                          int max_clients, int queue_size) {
+    if (!srv || !sched || !path || max_clients < 1 || queue_size < 1) {
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    
+    memset(srv, 0, sizeof(*srv));
+    srv->listen.fd = -1;
+    srv->sched = sched;
+    srv->max_clients = max_clients;
+    srv->queue_size = (unsigned int)queue_size;
+    STRCPY_SAFE(srv->path, path);
+    
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        syslog(LOG_ERR, "Socket path too long: %s", path);
+        return PZEM_ERROR_INVALID_PARAM;
+    }
+    STRCPY_SAFE(addr.sun_path, path);
+    
+    srv->clients = calloc((size_t)max_clients, sizeof(pubsub_client_t));
+    if (srv->clients == NULL) {
+        syslog(LOG_ERR, "Memory allocation failed for subscribers");
+        return PZEM_ERROR_MEMORY;
+    }
+    for (int i = 0; i < max_clients; i++) {
+        srv->clients[i].watch.fd = -1;
+        srv->clients[i].watch.cb = pubsub_client_cb;
+        srv->clients[i].watch.data = &srv->clients[i];
+        srv->clients[i].server = srv;
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
+        pubsub_close(srv);
+        return PZEM_ERROR_IO;
+    }
+    
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        syslog(LOG_ERR, "Failed to listen on %s: %s", path, strerror(errno));
+        close(fd);
+        pubsub_close(srv);
+        return PZEM_ERROR_IO;
+    }
+    chmod(path, 0666);
+    
+    srv->listen.fd = fd;
+    srv->listen.cb = pubsub_accept_cb;
+    srv->listen.data = srv;
+    if (scheduler_add_watch(sched, &srv->listen, EPOLLIN) != 0) {
+        syslog(LOG_ERR, "Failed to register socket %s: %s", path, strerror(errno));
+        pubsub_close(srv);
+        return PZEM_ERROR_IO;
+    }
+    
+    return PZEM_SUCCESS;
+}
+
+// Рассылка строки всем подписчикам
+void pubsub_publish(pubsub_server_t *srv, const char *line, size_t len) {
+    if (!srv || !srv->clients || !line || srv->client_count == 0) return;
+    if (len > LOG_ENTRY_SIZE) len = LOG_ENTRY_SIZE;
+    
+    srv->published++;
+    for (int i = 0; i < srv->max_clients; i++) {
+        pubsub_client_t *client = &srv->clients[i];
+        if (client->watch.fd < 0) continue;
+        
+        // Очередь пуста - пробуем отправить сразу, без копирования
+        if (client->count == 0 && client->pending_off >= client->pending_len) {
+            ssize_t n = send(client->watch.fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n == (ssize_t)len) continue;
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                pubsub_client_close(client);
+                continue;
+            }
+            // Хвост строки дописываем, когда сокет станет доступен
+            size_t sent = n > 0 ? (size_t)n : 0;
+            memcpy(client->pending, line, len);
+            client->pending_len = len;
+            client->pending_off = sent;
+        } else {
+            if (client->count == srv->queue_size) {
+                // Переполнение: выбрасываем самую старую строку
+                client->head = (client->head + 1) % srv->queue_size;
+                client->count--;
+                client->dropped++;
+                srv->dropped++;
+            }
+            pubsub_msg_t *msg = &client->queue[(client->head + client->count) % srv->queue_size];
+            memcpy(msg->line, line, len);
+            msg->len = (uint16_t)len;
+            client->count++;
+        }
+        pubsub_client_update_events(client);
+    }
+}
+
+// Закрытие всех соединений и удаление сокета
+void pubsub_close(pubsub_server_t *srv) {
+    if (!srv) return;
+    
+    if (srv->clients) {
+        for (int i = 0; i < srv->max_clients; i++) {
+            pubsub_client_close(&srv->clients[i]);
+        }
+        free(srv->clients);
+        srv->clients = NULL;
+    }
+    
+    if (srv->listen.fd >= 0) {
+        scheduler_del_watch(srv->sched, &srv->listen);
+        close(srv->listen.fd);
+        srv->listen.fd = -1;
+        unlink(srv->path);
+    }
+}
@@ -0,0 +1,311 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Сжатые блоки лога: запись в поток бит и обратное чтение (формат в pzem_pzb.h).
+// Регистры PZEM - целые числа, поэтому вместо XOR от float, как в Gorilla,
+// значения кодируются разностью с предыдущим: шум в младших разрядах стоит 5-12 бит,
+// неизменившийся канал - один бит.
+
+#include "pzem_monitor.h"
+
+// Поток бит от старшего к младшему; новый байт обнуляется при первой записи в него
+static void put_bits(pzb_encoder_t *enc, uint64_t value, int n) {
+    uint8_t *data = enc->block + PZEM_PZB_HEADER_SIZE;
+    while (n > 0) {
+        size_t byte = enc->bits >> 3;
+        int used = (int)(enc->bits & 7);
+        int take = 8 - used < n ? 8 - used : n;
+        uint8_t chunk = (uint8_t)((value >> (n - take)) & ((1u << take) - 1));
+        if (used == 0) {
+            data[byte] = 0;
+        }
+        data[byte] |= (uint8_t)(chunk << (8 - used - take));
+        enc->bits += (size_t)take;
+        n -= take;
+    }
+}
+
+// Корзины чисел со знаком: k+1 единиц и ноль перед widths[k] битами,
+// count+1 единиц перед полной шириной. Ноль - один бит '0'
+typedef struct {
+    int widths[4];
+    int count;
+    int wide;
+} pzb_buckets_t;
+
+// Интервалы опроса дрожат на миллисекунды, пауза в логе по изменениям - секунды и минуты
+static const pzb_buckets_t time_buckets = {{7, 12, 20}, 3, 64};
+// Шум младших разрядов напряжения, частоты и углов
+static const pzb_buckets_t value_buckets = {{3, 5, 8, 16}, 4, 32};
+
+static void put_signed(pzb_encoder_t *enc, int64_t value, const pzb_buckets_t *buckets) {
+    if (value == 0) {
+        put_bits(enc, 0, 1);
+        return;
+    }
+    for (int k = 0; k < buckets->count; k++) {
+        int64_t half = 1LL << (buckets->widths[k] - 1);
+        if (value >= -half && value < half) {
+            put_bits(enc, (1u << (k + 2)) - 2, k + 2);
+            put_bits(enc, (uint64_t)value, buckets->widths[k]);
+            return;
+        }
+    }
+    put_bits(enc, (1u << (buckets->count + 1)) - 1, buckets->count + 1);
+    put_bits(enc, (uint64_t)value, buckets->wide);
+}
+
+static int state_code(char state) {
+    switch (state) {
+        case 'N': return 0;
+        case 'H': return 1;
+        case 'L': return 2;
+        default: return 3;
+    }
+}
+
+static uint8_t *put_le16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    return p + 2;
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+    return p + 8;
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Новый блок в памяти block (capacity байт вместе с заголовком)
+void pzb_begin(pzb_encoder_t *enc, uint8_t *block, size_t capacity, int slave_addr) {
+    if (!enc) return;
+    
+    memset(enc, 0, sizeof(*enc));
+    if (!block || capacity < PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES) return;
+    
+    enc->block = block;
+    enc->limit = capacity - PZEM_PZB_HEADER_SIZE;
+    if (enc->limit > PZEM_PZB_MAX_DATA) {
+        enc->limit = PZEM_PZB_MAX_DATA;
+    }
+    enc->slave_addr = slave_addr;
+    memset(enc->state, 'N', sizeof(enc->state));
+}
+
+// Добавление измерения. -1 если блок полон - его нужно закрыть и начать новый
+int pzb_add(pzb_encoder_t *enc, const pzem_data_t *data) {
+    if (!enc || !enc->block || !data) return -1;
+    if (enc->count >= 0xFFFF || (enc->bits + 7) / 8 + PZEM_PZB_RECORD_MAX_BYTES > enc->limit) return -1;
+    
+    long long t = data->sample.timestamp_ms;
+    if (enc->count == 0) {
+        enc->first_ms = t;
+    } else {
+        long long delta = t - enc->last_ms;
+        put_signed(enc, delta - enc->last_delta, &time_buckets);
+        enc->last_delta = delta;
+    }
+    enc->last_ms = t;
+    
+    if (data->status != enc->status || memcmp(data->state, enc->state, sizeof(enc->state)) != 0) {
+        put_bits(enc, 1, 1);
+        if (data->status >= 0 && data->status < 3) {
+            put_bits(enc, (uint64_t)data->status, 2);
+        } else {
+            put_bits(enc, 3, 2);
+            put_bits(enc, (uint64_t)data->status, 8);
+        }
+        for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+            put_bits(enc, (uint64_t)state_code(data->state[i]), 2);
+        }
+        enc->status = data->status;
+        memcpy(enc->state, data->state, sizeof(enc->state));
+    } else {
+        put_bits(enc, 0, 1);
+    }
+    
+    // При ошибке чтения значений нет, разности считаются от последнего удачного
+    if (data->status == 0) {
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            uint32_t value = pzem_channel_raw(&data->sample, i);
+            put_signed(enc, (int32_t)(value - enc->values[i]), &value_buckets);
+            enc->values[i] = value;
+        }
+    }
+    
+    enc->count++;
+    return 0;
+}
+
+// Текущий размер блока вместе с заголовком
+size_t pzb_size(const pzb_encoder_t *enc) {
+    if (!enc || !enc->block) return 0;
+    return PZEM_PZB_HEADER_SIZE + (enc->bits + 7) / 8;
+}
+
+// Закрытие блока: заголовок с числом измерений, границами времени и CRC.
+// Возвращает полный размер блока, 0 если блок пуст
+size_t pzb_finish(pzb_encoder_t *enc) {
+    if (!enc || !enc->block || enc->count == 0) {
+        if (enc) enc->block = NULL;
+        return 0;
+    }
+    
+    size_t size = (enc->bits + 7) / 8;
+    uint8_t *p = enc->block;
+    p = put_le16(p, PZEM_PZB_MAGIC);
+    *p++ = PZEM_PZB_VERSION;
+    *p++ = (uint8_t)enc->slave_addr;
+    p = put_le16(p, (uint16_t)enc->count);
+    p = put_le16(p, (uint16_t)size);
+    p = put_le64(p, (uint64_t)enc->first_ms);
+    p = put_le64(p, (uint64_t)enc->last_ms);
+    p = put_le16(p, pzem_pzb_crc16(enc->block + PZEM_PZB_HEADER_SIZE, (uint32_t)size));
+    put_le16(p, 0);
+    
+    enc->block = NULL;
+    return PZEM_PZB_HEADER_SIZE + size;
+}
+
+static int get_bits(pzb_decoder_t *dec, int n, uint64_t *out) {
+    if (dec->bit + (size_t)n > dec->size * 8) return -1;
+    
+    uint64_t value = 0;
+    while (n > 0) {
+        int used = (int)(dec->bit & 7);
+        int take = 8 - used < n ? 8 - used : n;
+        uint8_t byte = dec->data[dec->bit >> 3];
+        value = (value << take) | (uint64_t)((byte >> (8 - used - take)) & ((1u << take) - 1));
+        dec->bit += (size_t)take;
+        n -= take;
+    }
+    *out = value;
+    return 0;
+}
+
+static int get_signed(pzb_decoder_t *dec, const pzb_buckets_t *buckets, int64_t *out) {
+    uint64_t bit;
+    int prefix = 0;
+    
+    // Число единиц до нуля выбирает корзину
+    while (prefix <= buckets->count) {
+        if (get_bits(dec, 1, &bit) != 0) return -1;
+        if (bit == 0) break;
+        prefix++;
+    }
+    if (prefix == 0) {
+        *out = 0;
+        return 0;
+    }
+    
+    int n = prefix <= buckets->count ? buckets->widths[prefix - 1] : buckets->wide;
+    uint64_t value;
+    if (get_bits(dec, n, &value) != 0) return -1;
+    if (n < 64 && (value >> (n - 1)) & 1) {
+        value |= ~0ULL << n;
+    }
+    *out = (int64_t)value;
+    return 0;
+}
+
+// Проверка блока в начале buf. Возвращает полный размер блока, 0 если данных
+// еще не хватает (блок дописывается), -1 если это не блок или он поврежден
+long pzb_open(pzb_decoder_t *dec, const uint8_t *buf, size_t len) {
+    if (!dec || !buf) return -1;
+    if (len < PZEM_PZB_HEADER_SIZE) return 0;
+    if (get_le16(buf) != PZEM_PZB_MAGIC || buf[2] != PZEM_PZB_VERSION) return -1;
+    
+    size_t size = get_le16(buf + 6);
+    if (len < PZEM_PZB_HEADER_SIZE + size) return 0;
+    if (get_le16(buf + 24) != pzem_pzb_crc16(buf + PZEM_PZB_HEADER_SIZE, (uint32_t)size)) return -1;
+    
+    memset(dec, 0, sizeof(*dec));
+    dec->data = buf + PZEM_PZB_HEADER_SIZE;
+    dec->size = size;
+    dec->left = get_le16(buf + 4);
+    dec->slave_addr = buf[3];
+    dec->last_ms = (long long)get_le64(buf + 8);
+    memset(dec->state, 'N', sizeof(dec->state));
+    
+    return (long)(PZEM_PZB_HEADER_SIZE + size);
+}
+
+// Следующее измерение блока: 1 - прочитано, 0 - блок кончился, -1 - поврежденные данные.
+// При ошибке чтения в регистрах остаются последние удачные значения
+int pzb_next(pzb_decoder_t *dec, pzem_data_t *data) {
+    if (!dec || !data) return -1;
+    if (dec->left == 0) return 0;
+    
+    if (dec->index > 0) {
+        int64_t dod;
+        if (get_signed(dec, &time_buckets, &dod) != 0) return -1;
+        dec->last_delta += dod;
+        dec->last_ms += dec->last_delta;
+    }
+    
+    uint64_t changed;
+    if (get_bits(dec, 1, &changed) != 0) return -1;
+    if (changed) {
+        uint64_t value;
+        if (get_bits(dec, 2, &value) != 0) return -1;
+        if (value == 3 && get_bits(dec, 8, &value) != 0) return -1;
+        dec->status = (int)value;
+        for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+            if (get_bits(dec, 2, &value) != 0) return -1;
+            dec->state[i] = "NHL-"[value];
+        }
+    }
+    
+    if (dec->status == 0) {
+        for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+            int64_t diff;
+            if (get_signed(dec, &value_buckets, &diff) != 0) return -1;
+            dec->values[i] += (uint32_t)diff;
+        }
+    }
+    
+    memset(data, 0, sizeof(*data));
+    data->sample.timestamp_ms = dec->last_ms;
+    data->status = dec->status;
+    memcpy(data->state, dec->state, sizeof(data->state));
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        pzem_channel_set_raw(&data->sample, i, dec->values[i]);
+    }
+    
+    dec->index++;
+    dec->left--;
+    return 1;
+}
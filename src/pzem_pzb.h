@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PZEM_PZB_H
+#define PZEM_PZB_H
+
+// Сжатый лог измерений (log_format = compressed, файлы .pzb).
+// Файл - последовательность независимых блоков: каждый декодируется сам по себе,
+// поэтому оборванный хвост или битый блок не мешают читать остальные.
+// Заголовок самодостаточен и подключается во внешние программы без libmodbus.
+//
+// Данные блока - поток бит от старшего к младшему. Для каждого измерения:
+//   время      - только со второго измерения: delta-of-delta в мс
+//                (разность интервалов, для первого интервала - сам интервал);
+//   состояние  - '0' статус и состояния порогов как в прошлом измерении, иначе
+//                '1' + 2 бита статуса (3 - дальше 8 бит статуса) + 14 x 2 бита состояний
+//                (0 - N, 1 - H, 2 - L, 3 - другое);
+//   значения   - только при статусе 0: 17 каналов в порядке CSV, разность с последним
+//                удачным измерением в единицах регистра (по модулю 2^32). Перед первым
+//                измерением блока все значения считаются нулевыми.
+// Числа со знаком кодируются корзинами в дополнительном коде, '0' - ноль:
+//   время    '10' + 7 бит, '110' + 12, '1110' + 20, '1111' + 64;
+//   значения '10' + 3 бита, '110' + 5, '1110' + 8, '11110' + 16, '11111' + 32.
+
+#include <stdint.h>
+
+#define PZEM_PZB_MAGIC 0x4250u           // "PB"
+#define PZEM_PZB_VERSION 1
+#define PZEM_PZB_HEADER_SIZE 28
+#define PZEM_PZB_MAX_DATA 65535          // предел данных одного блока
+#define PZEM_PZB_RECORD_MAX_BYTES 96     // худший случай одного измерения в битовом потоке
+#define PZEM_PZB_CHANNELS 17
+#define PZEM_PZB_STATES 14
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t slave_addr;
+    uint16_t count;                      // измерений в блоке
+    uint16_t size;                       // байт данных после заголовка
+    int64_t first_ms;                    // время первого измерения, мс от эпохи
+    int64_t last_ms;                     // время последнего - для поиска без распаковки
+    uint16_t crc;                        // CRC-16/MODBUS данных блока
+    uint16_t reserved;
+} pzem_pzb_header_t;
+
+// CRC-16/MODBUS (полином 0xA001, начальное значение 0xFFFF)
+static inline uint16_t pzem_pzb_crc16(const uint8_t *data, uint32_t len) {
+    uint16_t crc = 0xFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+#endif
@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Сводки min/max/среднее и время в состояниях порогов по окнам rollup_periods (1м, 15м, 1ч).
+// Измерение обновляет только самое мелкое окно, закрытое окно сливается в окно следующего
+// уровня - работа на измерение не зависит от числа уровней и длины окон.
+// Строки уходят потоку записи в файлы pzem3_<имя>_<окно>_YYYY-MM-DD.csv
+
+#include "pzem_monitor.h"
+
+// Разбор "60, 900, 3600": число окон или -1
+int parse_rollup_periods(const char *value, int *periods, int max_count) {
+    if (!value || !periods || max_count <= 0) return -1;
+    
+    int count = 0;
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == ',' || *p == '\t') p++;
+        if (*p == '\0' || *p == '#') break;
+        
+        char *end;
+        long period = strtol(p, &end, 10);
+        if (end == p || period < 0) return -1;
+        if (period == 0) return 0;
+        if (count >= max_count) {
+            syslog(LOG_WARNING, "Too many rollup periods, only first %d used", max_count);
+            break;
+        }
+        periods[count++] = (int)period;
+        p = end;
+    }
+    return count;
+}
+
+// Метка окна в имени файла: 1m, 15m, 1h
+static void rollup_label(char *out, size_t size, int period_s) {
+    if (period_s % 3600 == 0) {
+        snprintf(out, size, "%dh", period_s / 3600);
+    } else if (period_s % 60 == 0) {
+        snprintf(out, size, "%dm", period_s / 60);
+    } else {
+        snprintf(out, size, "%ds", period_s);
+    }
+}
+
+// Буферы файлов сводок устройства, всегда CSV
+pzem_result_t rollup_init(pzem_device_t *dev, const pzem_config_t *config) {
+    if (!dev || !config) return PZEM_ERROR_INVALID_PARAM;
+    
+    memset(dev->rollup.win, 0, sizeof(dev->rollup.win));
+    dev->rollup.has_last = 0;
+    
+    // Строка сводки длиннее строки измерения: буфер вмещает несколько строк целиком
+    pzem_config_t buffer_config = *config;
+    if (buffer_config.log_buffer_bytes < ROLLUP_BUFFER_MIN_BYTES) {
+        buffer_config.log_buffer_bytes = ROLLUP_BUFFER_MIN_BYTES;
+    }
+    for (int k = 0; k < config->rollup_count; k++) {
+        char label[16];
+        char name[sizeof(dev->name) + sizeof(label)];
+        rollup_label(label, sizeof(label), config->rollup_periods[k]);
+        snprintf(name, sizeof(name), "%s_%s", dev->name, label);
+        
+        log_buffer_t *buffer = &dev->rollup.buffer[k];
+        if (init_log_buffer(buffer, &buffer_config, name) != PZEM_SUCCESS) {
+            syslog(LOG_ERR, "Failed to initialize rollup buffer for %s", name);
+            return PZEM_ERROR_MEMORY;
+        }
+        buffer->file_ext = "csv";
+        buffer->compressed = 0;
+        buffer->entry_max = ROLLUP_ENTRY_SIZE;
+    }
+    return PZEM_SUCCESS;
+}
+
+void rollup_free(pzem_device_t *dev, const pzem_config_t *config) {
+    if (!dev || !config) return;
+    
+    for (int k = 0; k < config->rollup_count; k++) {
+        free_log_buffer(&dev->rollup.buffer[k]);
+    }
+}
+
+// Начало окна длины period_ms, в которое попадает t. Окна выровнены по местному времени,
+// поэтому часовые и 15-минутные границы совпадают с часами и в поясах с получасовым сдвигом
+static long long rollup_window_start(long long t, long long period_ms) {
+    time_t sec = (time_t)(t / 1000);
+    struct tm tm_info;
+    localtime_r(&sec, &tm_info);
+    
+    long long local = t + tm_info.tm_gmtoff * 1000LL;
+    long long offset = local % period_ms;
+    if (offset < 0) offset += period_ms;
+    return t - offset;
+}
+
+static void rollup_window_open(pzem_rollup_window_t *w, long long start_ms) {
+    memset(w, 0, sizeof(*w));
+    w->open = 1;
+    w->start_ms = start_ms;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        w->min[i] = UINT32_MAX;
+    }
+}
+
+static void rollup_close(pzem_device_t *dev, int level);
+
+// Закрытое окно мелкого уровня в окно уровня level
+static void rollup_merge(pzem_device_t *dev, int level, const pzem_rollup_window_t *src) {
+    if (level >= global_config.rollup_count) return;
+    
+    pzem_rollup_window_t *w = &dev->rollup.win[level];
+    long long start = rollup_window_start(src->start_ms, global_config.rollup_periods[level] * 1000LL);
+    if (w->open && w->start_ms != start) {
+        rollup_close(dev, level);
+    }
+    if (!w->open) {
+        rollup_window_open(w, start);
+    }
+    
+    w->samples += src->samples;
+    w->errors += src->errors;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (src->min[i] < w->min[i]) w->min[i] = src->min[i];
+        if (src->max[i] > w->max[i]) w->max[i] = src->max[i];
+        w->sum[i] += src->sum[i];
+    }
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        for (int k = 0; k < 3; k++) {
+            w->state_ms[i][k] += src->state_ms[i][k];
+        }
+    }
+}
+
+// Строка закрытого окна в файл уровня, само окно уходит в следующий уровень
+static void rollup_close(pzem_device_t *dev, int level) {
+    pzem_rollup_window_t *w = &dev->rollup.win[level];
+    
+    char entry[ROLLUP_ENTRY_SIZE];
+    size_t len = format_rollup_entry(entry, sizeof(entry), w, global_config.rollup_periods[level]);
+    if (log_writer_submit(&log_writer, (int)(dev - devices), level + 1, w->start_ms, entry, len) != PZEM_SUCCESS) {
+#ifdef DEBUG
+        syslog(LOG_DEBUG, "Log queue full, rollup entry dropped");
+#endif
+    }
+    
+    rollup_merge(dev, level + 1, w);
+    w->open = 0;
+}
+
+static int state_slot(char state) {
+    switch (state) {
+        case 'H': return 1;
+        case 'L': return 2;
+        default: return 0;
+    }
+}
+
+// Прошлое удачное измерение держит свои состояния порогов до until
+static void rollup_hold_states(pzem_rollup_t *r, pzem_rollup_window_t *w, long long until) {
+    long long from = r->last_ms > w->start_ms ? r->last_ms : w->start_ms;
+    if (!r->has_last || until <= from) return;
+    
+    uint32_t dt = (uint32_t)(until - from);
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        w->state_ms[i][state_slot(r->last_state[i])] += dt;
+    }
+}
+
+// Каждое измерение, изменилось оно или нет
+void rollup_add(pzem_device_t *dev, const pzem_data_t *data) {
+    if (!dev || !data || global_config.rollup_count == 0) return;
+    
+    pzem_rollup_t *r = &dev->rollup;
+    pzem_rollup_window_t *w = &r->win[0];
+    long long t = data->sample.timestamp_ms;
+    long long period_ms = global_config.rollup_periods[0] * 1000LL;
+    
+    // Окно кончилось (или часы перевели назад) - закрываем, крупные уровни следом
+    if (w->open && (t >= w->start_ms + period_ms || t < w->start_ms)) {
+        rollup_hold_states(r, w, w->start_ms + period_ms);
+        rollup_close(dev, 0);
+    }
+    for (int level = 1; level < global_config.rollup_count; level++) {
+        pzem_rollup_window_t *up = &r->win[level];
+        if (up->open && t >= up->start_ms + global_config.rollup_periods[level] * 1000LL) {
+            rollup_close(dev, level);
+        }
+    }
+    if (!w->open) {
+        rollup_window_open(w, rollup_window_start(t, period_ms));
+    }
+    
+    rollup_hold_states(r, w, t);
+    if (data->status != 0) {
+        // Во время ошибки состояние порогов неизвестно
+        w->errors++;
+        r->has_last = 0;
+        return;
+    }
+    
+    w->samples++;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        uint32_t value = pzem_channel_raw(&data->sample, i);
+        if (value < w->min[i]) w->min[i] = value;
+        if (value > w->max[i]) w->max[i] = value;
+        w->sum[i] += value;
+    }
+    memcpy(r->last_state, data->state, sizeof(r->last_state));
+    r->last_ms = t;
+    r->has_last = 1;
+}
+
+// Остановка: открытые окна пишутся неполными снизу вверх, каждое доливается в уровень выше.
+// По samples читатель видит, что окно неполное
+void rollup_flush(pzem_device_t *dev) {
+    if (!dev) return;
+    
+    for (int level = 0; level < global_config.rollup_count; level++) {
+        if (dev->rollup.win[level].open) {
+            rollup_close(dev, level);
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Публикация каждого измерения в кольцо разделяемой памяти (формат в pzem_shm.h)
+
+#include "pzem_monitor.h"
+#include <sys/mman.h>
+
+pzem_shm_t shm_ring = {.hdr = NULL};
+
+// Создание сегмента; при перезапуске демона сегмент создается заново
+pzem_result_t pzem_shm_open(pzem_shm_t *shm, const char *name, int capacity) {
+    if (!shm || !name || capacity < 1) return PZEM_ERROR_INVALID_PARAM;
+    
+    memset(shm, 0, sizeof(*shm));
+    snprintf(shm->name, sizeof(shm->name), PZEM_SHM_NAME, name);
+    shm->size = sizeof(pzem_shm_header_t) + (size_t)capacity * sizeof(pzem_shm_record_t);
+    
+    shm_unlink(shm->name);
+    int fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create shared memory %s: %s", shm->name, strerror(errno));
+        return PZEM_ERROR_IO;
+    }
+    
+    if (ftruncate(fd, (off_t)shm->size) == -1) {
+        syslog(LOG_ERR, "Failed to size shared memory %s: %s", shm->name, strerror(errno));
+        close(fd);
+        shm_unlink(shm->name);
+        return PZEM_ERROR_IO;
+    }
+    
+    void *addr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to map shared memory %s: %s", shm->name, strerror(errno));
+        shm_unlink(shm->name);
+        return PZEM_ERROR_MEMORY;
+    }
+    
+    // Сегмент после ftruncate заполнен нулями: seq = 0 значит "еще не записано"
+    shm->hdr = addr;
+    shm->hdr->version = PZEM_SHM_VERSION;
+    shm->hdr->header_size = sizeof(pzem_shm_header_t);
+    shm->hdr->record_size = sizeof(pzem_shm_record_t);
+    shm->hdr->capacity = (uint32_t)capacity;
+    shm->hdr->created_ms = get_wall_time_ms();
+    atomic_store_explicit(&shm->hdr->write_index, 0, memory_order_relaxed);
+    // magic последним - читатель не увидит полузаполненный заголовок
+    atomic_thread_fence(memory_order_release);
+    shm->hdr->magic = PZEM_SHM_MAGIC;
+    
+    return PZEM_SUCCESS;
+}
+
+// Запись измерения в следующую ячейку кольца
+void pzem_shm_publish(pzem_shm_t *shm, int slave_addr, const pzem_data_t *data) {
+    if (!shm || !shm->hdr || !data) return;
+    
+    uint64_t index = shm->next;
+    pzem_shm_record_t *rec = &pzem_shm_records(shm->hdr)[index % shm->hdr->capacity];
+    
+    atomic_store_explicit(&rec->seq, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    rec->timestamp_ms = data->sample.timestamp_ms;
+    memcpy(rec->regs, data->sample.regs, sizeof(rec->regs));
+    memcpy(rec->state, data->state, sizeof(rec->state));
+    rec->slave_addr = (uint8_t)slave_addr;
+    rec->status = (uint8_t)data->status;
+    
+    atomic_store_explicit(&rec->seq, 2 * index + 2, memory_order_release);
+    shm->next = index + 1;
+    atomic_store_explicit(&shm->hdr->write_index, shm->next, memory_order_release);
+}
+
+void pzem_shm_close(pzem_shm_t *shm) {
+    if (!shm || !shm->hdr) return;
+    
+    munmap(shm->hdr, shm->size);
+    shm->hdr = NULL;
+    shm_unlink(shm->name);
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef PZEM_SHM_H
+#define PZEM_SHM_H
+
+// Кольцо последних измерений в разделяемой памяти (/dev/shm/pzem3_<config>).
+// Заголовок самодостаточен: его можно подключать во внешние программы без libmodbus.
+//
+// Писатель один (демон), читателей сколько угодно. Каждая запись защищена
+// счетчиком seq: во время записи он нечетный, после записи i-го измерения
+// равен 2*i+2. Читатель копирует запись и проверяет, что seq не изменился -
+// без блокировок и без системных вызовов.
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define PZEM_SHM_NAME "/pzem3_%s"
+#define PZEM_SHM_MAGIC 0x335A4D50u       // "PMZ3"
+#define PZEM_SHM_VERSION 1
+#define PZEM_SHM_REG_COUNT 20
+#define PZEM_SHM_STATE_COUNT 14
+
+// Заголовок сегмента, записи идут следом с отступа header_size
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t record_size;
+    uint32_t capacity;                   // число записей в кольце
+    int64_t created_ms;                  // время запуска демона - меняется при перезапуске
+    _Atomic uint64_t write_index;        // сколько измерений записано всего
+    uint8_t reserved[32];
+} pzem_shm_header_t;
+
+// Одно измерение: сырые регистры PZEM как есть
+typedef struct {
+    _Atomic uint64_t seq;
+    int64_t timestamp_ms;                // мс от эпохи
+    uint16_t regs[PZEM_SHM_REG_COUNT];
+    char state[PZEM_SHM_STATE_COUNT];    // H/L/N по каналам напряжения, тока, частоты и углов
+    uint8_t slave_addr;
+    uint8_t status;                      // 0 - OK, 1 - ошибка устройства, 2 - ошибка порта
+} pzem_shm_record_t;
+
+// Результат чтения записи
+typedef enum {
+    PZEM_SHM_OK = 0,
+    PZEM_SHM_NOT_YET = 1,                // измерение еще не записано
+    PZEM_SHM_OVERWRITTEN = 2             // читатель отстал, запись уже перезаписана
+} pzem_shm_status_t;
+
+static inline pzem_shm_record_t *pzem_shm_records(const pzem_shm_header_t *hdr) {
+    return (pzem_shm_record_t *)((char *)hdr + hdr->header_size);
+}
+
+// Номер следующего измерения; последнее записанное - на единицу меньше
+static inline uint64_t pzem_shm_write_index(const pzem_shm_header_t *hdr) {
+    return atomic_load_explicit(&((pzem_shm_header_t *)hdr)->write_index, memory_order_acquire);
+}
+
+// Копирование измерения с номером index
+static inline pzem_shm_status_t pzem_shm_read(const pzem_shm_header_t *hdr, uint64_t index,
+                                              pzem_shm_record_t *out) {
+    pzem_shm_record_t *rec = &pzem_shm_records(hdr)[index % hdr->capacity];
+    uint64_t expected = 2 * index + 2;
+    
+    for (;;) {
+        uint64_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq < expected - 1) return PZEM_SHM_NOT_YET;
+        if (seq > expected) return PZEM_SHM_OVERWRITTEN;
+        if (seq == expected - 1) continue;      // запись в процессе
+    
+        out->timestamp_ms = rec->timestamp_ms;
+        memcpy(out->regs, rec->regs, sizeof(out->regs));
+        memcpy(out->state, rec->state, sizeof(out->state));
+        out->slave_addr = rec->slave_addr;
+        out->status = rec->status;
+        atomic_thread_fence(memory_order_acquire);
+    
+        if (atomic_load_explicit(&rec->seq, memory_order_relaxed) == seq) {
+            atomic_store_explicit(&out->seq, seq, memory_order_relaxed);
+            return PZEM_SHM_OK;
+        }
+    }
+}
+
+// Декодирование регистров: 16-битные значения передаются с переставленными байтами
+static inline uint32_t pzem_shm_reg16(const pzem_shm_record_t *rec, int reg) {
+    uint16_t v = rec->regs[reg];
+    return (uint32_t)(((v & 0xFF) << 8) | (v >> 8));
+}
+
+// Мощность: младшее слово в регистре reg, старшее в reg + 1
+static inline uint32_t pzem_shm_reg32(const pzem_shm_record_t *rec, int reg) {
+    return ((uint32_t)rec->regs[reg + 1] << 16) | rec->regs[reg];
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef PZEM_WIRE_H
+#define PZEM_WIRE_H
+
+// Бинарная запись измерения (log_format / pubsub_format = binary).
+// Записи фиксированного размера идут подряд без разделителей, все поля little-endian.
+// Заголовок самодостаточен и подключается во внешние программы без libmodbus.
+
+#include <stdint.h>
+
+#define PZEM_WIRE_MAGIC 0x5A50u          // "PZ"
+#define PZEM_WIRE_VERSION 1
+#define PZEM_WIRE_REG_COUNT 20
+#define PZEM_WIRE_STATE_COUNT 14
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t slave_addr;
+    int64_t timestamp_ms;                // мс от эпохи
+    uint8_t status;                      // 0 - OK, 1 - ошибка устройства, 2 - ошибка порта
+    char state[PZEM_WIRE_STATE_COUNT];   // H/L/N по каналам напряжения, тока, частоты и углов
+    uint8_t reserved;
+    uint16_t regs[PZEM_WIRE_REG_COUNT];  // регистры PZEM в том виде, как их вернул Modbus
+} pzem_wire_record_t;
+
+#define PZEM_WIRE_RECORD_SIZE 68
+
+// 16-битные значения передаются прибором с переставленными байтами
+static inline uint32_t pzem_wire_reg16(const pzem_wire_record_t *rec, int reg) {
+    uint16_t v = rec->regs[reg];
+    return (uint32_t)(((v & 0xFF) << 8) | (v >> 8));
+}
+
+// Мощность: младшее слово в регистре reg, старшее в reg + 1
+static inline uint32_t pzem_wire_reg32(const pzem_wire_record_t *rec, int reg) {
+    return ((uint32_t)rec->regs[reg + 1] << 16) | rec->regs[reg];
+}
+
+#endif
@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Преобразование сжатого лога (.pzb) в CSV, как его пишет демон, и обратно.
+// Битые блоки пропускаются с поиском следующего заголовка, недописанный хвост
+// (демон остановлен посреди сброса) отбрасывается.
+
+#include "pzem_monitor.h"
+#include <getopt.h>
+
+#define CONVERT_DEFAULT_BLOCK 4096
+
+typedef struct {
+    unsigned long long records;
+    unsigned long long blocks;
+    unsigned long long bad_blocks;
+    unsigned long long skipped_lines;
+    unsigned long long sparse_lines;     // строки SDT лога с пустыми значениями
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+} convert_stats_t;
+
+static convert_stats_t stats;
+
+// Весь файл в память: дневной сжатый лог занимает единицы мегабайт
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    size_t capacity = 1 << 16, used = 0;
+    uint8_t *data = malloc(capacity);
+    while (data != NULL) {
+        if (used == capacity) {
+            uint8_t *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(data + used, 1, capacity - used, file);
+        if (n == 0) break;
+        used += n;
+    }
+    if (file != stdin) fclose(file);
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory reading %s\n", path);
+        return NULL;
+    }
+    
+    *len = used;
+    return data;
+}
+
+static int write_out(FILE *out, const void *data, size_t len) {
+    if (fwrite(data, 1, len, out) != len) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        return -1;
+    }
+    stats.bytes_out += len;
+    return 0;
+}
+
+// Сжатые блоки -> строки CSV
+static int decompress_file(const char *path, FILE *out) {
+    size_t len;
+    uint8_t *data = read_file(path, &len);
+    if (data == NULL) return -1;
+    stats.bytes_in += len;
+    
+    int rc = 0;
+    size_t offset = 0;
+    while (offset < len && rc == 0) {
+        pzb_decoder_t dec;
+        long size = pzb_open(&dec, data + offset, len - offset);
+        if (size == 0) {
+            fprintf(stderr, "%s: incomplete block at offset %zu ignored\n", path, offset);
+            break;
+        }
+        if (size < 0) {
+            // Ищем следующий заголовок: сигнатура и версия
+            stats.bad_blocks++;
+            fprintf(stderr, "%s: corrupted block at offset %zu skipped\n", path, offset);
+            do {
+                offset++;
+            } while (offset + 3 <= len && !(data[offset] == (PZEM_PZB_MAGIC & 0xFF) &&
+                     data[offset + 1] == (PZEM_PZB_MAGIC >> 8) && data[offset + 2] == PZEM_PZB_VERSION));
+            continue;
+        }
+        
+        pzem_data_t record;
+        int n;
+        while ((n = pzb_next(&dec, &record)) > 0) {
+            char line[LOG_ENTRY_SIZE];
+            size_t line_len = format_csv_entry(line, sizeof(line), &record, (time_t)(record.sample.timestamp_ms / 1000));
+            if (write_out(out, line, line_len) != 0) {
+                rc = -1;
+                break;
+            }
+            stats.records++;
+        }
+        if (n < 0) {
+            stats.bad_blocks++;
+            fprintf(stderr, "%s: block at offset %zu ends early\n", path, offset);
+        }
+        stats.blocks++;
+        offset += (size_t)size;
+    }
+    
+    free(data);
+    return rc;
+}
+
+// Строки CSV -> сжатые блоки до block_size байт
+static int compress_file(const char *path, FILE *out, size_t block_size, int slave_addr) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    uint8_t *block = malloc(block_size);
+    if (block == NULL) {
+        if (file != stdin) fclose(file);
+        return -1;
+    }
+    
+    int rc = 0;
+    pzb_encoder_t enc;
+    pzb_begin(&enc, block, block_size, slave_addr);
+    
+    char line[LOG_ENTRY_SIZE * 2];
+    while (rc == 0 && fgets(line, sizeof(line), file)) {
+        stats.bytes_in += strlen(line);
+        pzem_data_t record;
+        if (parse_csv_entry(line, &record) != 0) {
+            stats.skipped_lines++;
+            continue;
+        }
+        // В блоке у каждой записи все каналы, пустые значения SDT лога не передать
+        if (record.omit != 0) {
+            if (stats.sparse_lines++ == 0) {
+                fprintf(stderr, "%s: rows with empty values (log_mode = sdt) are skipped\n", path);
+            }
+            continue;
+        }
+        if (pzb_add(&enc, &record) != 0) {
+            size_t size = pzb_finish(&enc);
+            rc = write_out(out, block, size);
+            stats.blocks++;
+            pzb_begin(&enc, block, block_size, slave_addr);
+            pzb_add(&enc, &record);
+        }
+        stats.records++;
+    }
+    
+    size_t size = pzb_finish(&enc);
+    if (rc == 0 && size > 0) {
+        rc = write_out(out, block, size);
+        stats.blocks++;
+    }
+    
+    free(block);
+    if (file != stdin) fclose(file);
+    return rc;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] FILE...\n"
+           "Converts compressed logs (.pzb) to CSV, or CSV logs to .pzb with -z.\n"
+           "  -o, --output FILE   write to FILE instead of stdout\n"
+           "  -z, --compress      CSV -> compressed blocks\n"
+           "  -b, --block BYTES   block size limit for -z (default %d, %d-%d)\n"
+           "  -a, --addr N        slave address stored in blocks for -z (default 1)\n"
+           "  -v, --verbose       print statistics to stderr\n"
+           "FILE '-' reads standard input.\n",
+           prog, CONVERT_DEFAULT_BLOCK, PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES,
+           PZEM_PZB_HEADER_SIZE + PZEM_PZB_MAX_DATA);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"compress", no_argument, NULL, 'z'},
+        {"block", required_argument, NULL, 'b'},
+        {"addr", required_argument, NULL, 'a'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    const char *output = NULL;
+    int compress = 0, verbose = 0, slave_addr = 1;
+    long block_size = CONVERT_DEFAULT_BLOCK;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:zb:a:vh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'z': compress = 1; break;
+            case 'b': block_size = atol(optarg); break;
+            case 'a': slave_addr = atoi(optarg); break;
+            case 'v': verbose = 1; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (block_size < PZEM_PZB_HEADER_SIZE + PZEM_PZB_RECORD_MAX_BYTES ||
+        block_size > PZEM_PZB_HEADER_SIZE + PZEM_PZB_MAX_DATA) {
+        fprintf(stderr, "Invalid block size: %ld\n", block_size);
+        return 1;
+    }
+    if (slave_addr < 0 || slave_addr > 255) {
+        fprintf(stderr, "Invalid slave address: %d\n", slave_addr);
+        return 1;
+    }
+    
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, compress ? "wb" : "w")) == NULL) {
+        fprintf(stderr, "Cannot create %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    
+    int rc = 0;
+    for (int i = optind; i < argc && rc == 0; i++) {
+        rc = compress ? compress_file(argv[i], out, (size_t)block_size, slave_addr)
+                      : decompress_file(argv[i], out);
+    }
+    if (fflush(out) != 0 || (out != stdout && fclose(out) != 0)) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        rc = -1;
+    }
+    
+    if (verbose) {
+        unsigned long long csv = compress ? stats.bytes_in : stats.bytes_out;
+        unsigned long long pzb = compress ? stats.bytes_out : stats.bytes_in;
+        fprintf(stderr, "records=%llu blocks=%llu bad_blocks=%llu skipped_lines=%llu sparse_lines=%llu csv=%llu pzb=%llu",
+                stats.records, stats.blocks, stats.bad_blocks, stats.skipped_lines, stats.sparse_lines, csv, pzb);
+        if (pzb > 0 && stats.records > 0) {
+            fprintf(stderr, " ratio=%.1f bytes_per_record=%.1f", (double)csv / (double)pzb,
+                    (double)pzb / (double)stats.records);
+        }
+        fprintf(stderr, "\n");
+    }
+    
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,682 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Выборка измерений из дневных логов за интервал времени, с фильтрами и нужными колонками.
+// Файлы отображаются в память. Рядом с CSV логом лежит разреженный индекс <файл>.idx:
+// время и смещение каждой N-й строки. Начало интервала ищется двоичным поиском по индексу,
+// дальше читаются только строки интервала. Лог только дописывается, поэтому индекс
+// сегодняшнего файла не строится заново, а дописывается по новым строкам.
+// В .pzb индексом служат заголовки блоков (время первого и последнего измерения).
+// Файлы разбираются параллельно, вывод идет в порядке файлов в командной строке.
+
+#include "pzem_monitor.h"
+#include <getopt.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#define QUERY_DEFAULT_STRIDE 256
+#define QUERY_MAX_THREADS 16
+#define QUERY_MAX_FILTERS 16
+#define QUERY_INDEX_MAGIC 0x58495a50u    // "PZIX"
+#define QUERY_INDEX_VERSION 1
+#define QUERY_STATUS (-1)                // колонка и фильтр по статусу строки
+
+typedef enum {
+    QUERY_OP_LT,
+    QUERY_OP_LE,
+    QUERY_OP_GT,
+    QUERY_OP_GE,
+    QUERY_OP_EQ,
+    QUERY_OP_NE
+} query_op_t;
+
+// Условие "канал оператор значение", значение в единицах регистра
+typedef struct {
+    int channel;
+    query_op_t op;
+    long long value;
+} query_filter_t;
+
+// Файл индекса: заголовок и записи подряд, порядок байт платформы
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t stride;                     // строк между записями
+    uint64_t size;                       // проиндексировано байт лога, только целые строки
+    uint32_t count;                      // записей
+    uint32_t pending;                    // строк после последней записи
+} query_index_header_t;
+
+typedef struct {
+    int64_t time_ms;
+    uint64_t offset;
+} query_index_entry_t;
+
+typedef struct {
+    query_index_header_t header;
+    query_index_entry_t *entries;
+    uint32_t capacity;
+    int changed;
+} query_index_t;
+
+typedef enum {
+    QUERY_INDEX_REUSED,
+    QUERY_INDEX_UPDATED,
+    QUERY_INDEX_UNSAVED                  // построен, но записать рядом с логом не удалось
+} query_index_state_t;
+
+// Один файл: результат копится в памяти и выводится, когда дойдет очередь
+typedef struct {
+    const char *path;
+    char *out;
+    size_t len;
+    size_t capacity;
+    unsigned long long rows;
+    unsigned long long matched;
+    query_index_state_t index_state;
+    int failed;
+    int done;
+} query_job_t;
+
+static struct {
+    long long from_ms;
+    long long to_ms;
+    int columns[PZEM_CHANNEL_COUNT + 1];
+    int column_count;                    // 0 - строка лога целиком
+    query_filter_t filters[QUERY_MAX_FILTERS];
+    int filter_count;
+    int stride;
+    int write_index;
+} query = {
+    .from_ms = LLONG_MIN,
+    .to_ms = LLONG_MAX,
+    .stride = QUERY_DEFAULT_STRIDE,
+    .write_index = 1
+};
+
+static query_job_t *jobs;
+static int job_count;
+static atomic_int next_job;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+// Канал по имени как в JSON и метриках (voltage_A, power_C) или "status"
+static int find_column(const char *name, size_t len) {
+    if (len == 6 && strncmp(name, "status", 6) == 0) return QUERY_STATUS;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (strlen(pzem_channels[i].name) == len && strncmp(pzem_channels[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+    return PZEM_CHANNEL_COUNT;
+}
+
+// "voltage_A,current_B,status"
+static int parse_columns(const char *value) {
+    const char *p = value;
+    while (*p) {
+        size_t len = strcspn(p, ", ");
+        if (len > 0) {
+            int column = find_column(p, len);
+            if (column == PZEM_CHANNEL_COUNT) {
+                fprintf(stderr, "Unknown column: %.*s\n", (int)len, p);
+                return -1;
+            }
+            if (query.column_count == PZEM_CHANNEL_COUNT + 1) {
+                fprintf(stderr, "Too many columns\n");
+                return -1;
+            }
+            query.columns[query.column_count++] = column;
+        }
+        p += len;
+        p += strspn(p, ", ");
+    }
+    return query.column_count > 0 ? 0 : -1;
+}
+
+// "voltage_A>240", "current_B <= 0.5", "status!=0"
+static int parse_filter(const char *value) {
+    if (query.filter_count >= QUERY_MAX_FILTERS) {
+        fprintf(stderr, "Too many filters (max %d)\n", QUERY_MAX_FILTERS);
+        return -1;
+    }
+    
+    size_t name_len = strcspn(value, "<>=! ");
+    const char *p = value + name_len;
+    while (*p == ' ') p++;
+    
+    query_filter_t *f = &query.filters[query.filter_count];
+    if (strncmp(p, "<=", 2) == 0) { f->op = QUERY_OP_LE; p += 2; }
+    else if (strncmp(p, ">=", 2) == 0) { f->op = QUERY_OP_GE; p += 2; }
+    else if (strncmp(p, "!=", 2) == 0) { f->op = QUERY_OP_NE; p += 2; }
+    else if (strncmp(p, "==", 2) == 0) { f->op = QUERY_OP_EQ; p += 2; }
+    else if (*p == '<') { f->op = QUERY_OP_LT; p++; }
+    else if (*p == '>') { f->op = QUERY_OP_GT; p++; }
+    else if (*p == '=') { f->op = QUERY_OP_EQ; p++; }
+    else {
+        fprintf(stderr, "Invalid filter: %s\n", value);
+        return -1;
+    }
+    
+    f->channel = find_column(value, name_len);
+    if (f->channel == PZEM_CHANNEL_COUNT) {
+        fprintf(stderr, "Unknown column in filter: %s\n", value);
+        return -1;
+    }
+    
+    char *end;
+    double number = strtod(p, &end);
+    while (*end == ' ') end++;
+    if (end == p || *end != '\0') {
+        fprintf(stderr, "Invalid value in filter: %s\n", value);
+        return -1;
+    }
+    // Сравнение в целых единицах регистра, как сравнивает чувствительность демон
+    f->value = f->channel == QUERY_STATUS ? llround(number) : llround(number * pzem_channels[f->channel].scale);
+    query.filter_count++;
+    return 0;
+}
+
+// "YYYY-MM-DD", "YYYY-MM-DD HH:MM" или "YYYY-MM-DD HH:MM:SS" (или через 'T') по местному времени
+static int parse_time(const char *value, long long *ms) {
+    int year, mon, day, hour = 0, min = 0, sec = 0, len = 0;
+    int fields = sscanf(value, "%4d-%2d-%2d%n%*[ T]%2d:%2d%n:%2d%n", &year, &mon, &day, &len,
+                        &hour, &min, &len, &sec, &len);
+    if ((fields != 3 && fields != 5 && fields != 6) || value[len] != '\0') {
+        fprintf(stderr, "Invalid time: %s (expected YYYY-MM-DD [HH:MM[:SS]])\n", value);
+        return -1;
+    }
+    
+    struct tm tm_info = {
+        .tm_year = year - 1900,
+        .tm_mon = mon - 1,
+        .tm_mday = day,
+        .tm_hour = hour,
+        .tm_min = min,
+        .tm_sec = sec,
+        .tm_isdst = -1
+    };
+    *ms = (long long)mktime(&tm_info) * 1000LL;
+    return 0;
+}
+
+static int job_append(query_job_t *job, const char *data, size_t len) {
+    if (job->len + len > job->capacity) {
+        size_t capacity = job->capacity ? job->capacity : 1 << 16;
+        while (capacity < job->len + len) capacity *= 2;
+        char *grown = realloc(job->out, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "%s: out of memory\n", job->path);
+            return -1;
+        }
+        job->out = grown;
+        job->capacity = capacity;
+    }
+    memcpy(job->out + job->len, data, len);
+    job->len += len;
+    return 0;
+}
+
+// Строка с ошибкой чтения и пропущенный канал SDT значения не имеют и под условия не попадают
+static int filter_match(const query_filter_t *f, const pzem_data_t *data) {
+    long long value;
+    if (f->channel == QUERY_STATUS) {
+        value = data->status;
+    } else {
+        if (data->status != 0 || (data->omit & (1u << f->channel))) return 0;
+        value = pzem_channel_raw(&data->sample, f->channel);
+    }
+    
+    switch (f->op) {
+        case QUERY_OP_LT: return value < f->value;
+        case QUERY_OP_LE: return value <= f->value;
+        case QUERY_OP_GT: return value > f->value;
+        case QUERY_OP_GE: return value >= f->value;
+        case QUERY_OP_EQ: return value == f->value;
+        case QUERY_OP_NE: return value != f->value;
+    }
+    return 0;
+}
+
+// Измерение из интервала: условия и вывод. line - строка лога с '\n'
+static int query_row(query_job_t *job, const char *line, size_t len, const pzem_data_t *data) {
+    for (int i = 0; i < query.filter_count; i++) {
+        if (!filter_match(&query.filters[i], data)) return 0;
+    }
+    job->matched++;
+    
+    if (query.column_count == 0) {
+        return job_append(job, line, len);
+    }
+    
+    // "YYYY-MM-DD,HH:MM:SS" из строки лога, дальше выбранные колонки
+    char out[LOG_ENTRY_SIZE];
+    char *p = out;
+    memcpy(p, line, 19);
+    p += 19;
+    for (int i = 0; i < query.column_count; i++) {
+        int column = query.columns[i];
+        *p++ = ',';
+        if (column == QUERY_STATUS) {
+            p += sprintf(p, "%d", data->status);
+        } else if (data->status == 0 && !(data->omit & (1u << column))) {
+            p += format_channel_value(p, &data->sample, column);
+        }
+    }
+    *p++ = '\n';
+    return job_append(job, out, (size_t)(p - out));
+}
+
+// Строка из отображенного файла в буфер с '\0': разбор CSV рассчитан на C-строку
+static int copy_line(char *buf, size_t size, const char *p, const char *nl) {
+    size_t len = (size_t)(nl - p) + 1;
+    if (len >= size) return -1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return 0;
+}
+
+static int index_add(query_index_t *idx, int64_t time_ms, uint64_t offset) {
+    if (idx->header.count == idx->capacity) {
+        uint32_t capacity = idx->capacity ? idx->capacity * 2 : 256;
+        query_index_entry_t *grown = realloc(idx->entries, capacity * sizeof(*grown));
+        if (grown == NULL) return -1;
+        idx->entries = grown;
+        idx->capacity = capacity;
+    }
+    idx->entries[idx->header.count].time_ms = time_ms;
+    idx->entries[idx->header.count].offset = offset;
+    idx->header.count++;
+    return 0;
+}
+
+// Строка по записи индекса должна быть с тем же временем
+static int index_entry_valid(const query_index_entry_t *entry, const char *map, size_t size) {
+    if (entry->offset >= size) return 0;
+    
+    const char *p = map + entry->offset;
+    const char *nl = memchr(p, '\n', size - (size_t)entry->offset);
+    char line[LOG_ENTRY_SIZE * 2];
+    pzem_data_t data;
+    return nl != NULL && copy_line(line, sizeof(line), p, nl) == 0 &&
+           parse_csv_entry(line, &data) == 0 && data.sample.timestamp_ms == entry->time_ms;
+}
+
+// Индекс с диска подходит, если построен с тем же шагом, короче лога, кончается
+// на границе строки и последняя запись указывает на ту же строку - иначе файл подменили,
+// строим заново
+static void index_load(query_index_t *idx, const char *path, const char *map, size_t size) {
+    memset(idx, 0, sizeof(*idx));
+    idx->header.magic = QUERY_INDEX_MAGIC;
+    idx->header.version = QUERY_INDEX_VERSION;
+    idx->header.stride = (uint16_t)query.stride;
+    
+    char idx_path[PATH_MAX];
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    FILE *file = fopen(idx_path, "rb");
+    if (file == NULL) return;
+    
+    query_index_header_t header;
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == QUERY_INDEX_MAGIC && header.version == QUERY_INDEX_VERSION &&
+        header.stride == query.stride && header.size <= size &&
+        (header.size == 0 || map[header.size - 1] == '\n')) {
+        query_index_entry_t *entries = malloc((header.count ? header.count : 1) * sizeof(*entries));
+        if (entries != NULL && fread(entries, sizeof(*entries), header.count, file) == header.count &&
+            (header.count == 0 || index_entry_valid(&entries[header.count - 1], map, header.size))) {
+            idx->header = header;
+            idx->entries = entries;
+            idx->capacity = header.count;
+            entries = NULL;
+        }
+        free(entries);
+    }
+    fclose(file);
+}
+
+// Дописывание индекса по строкам после проиндексированной части.
+// Недописанная последняя строка (демон посреди записи) в индекс не попадает
+static int index_extend(query_index_t *idx, const char *map, size_t size) {
+    const char *p = map + idx->header.size;
+    const char *end = map + size;
+    const char *nl;
+    
+    while (p < end && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        if (idx->header.pending == 0) {
+            char line[LOG_ENTRY_SIZE * 2];
+            pzem_data_t data;
+            if (copy_line(line, sizeof(line), p, nl) != 0 || parse_csv_entry(line, &data) != 0) {
+                p = nl + 1;
+                continue;
+            }
+            if (index_add(idx, data.sample.timestamp_ms, (uint64_t)(p - map)) != 0) return -1;
+        }
+        if (++idx->header.pending == idx->header.stride) {
+            idx->header.pending = 0;
+        }
+        p = nl + 1;
+    }
+    
+    if ((size_t)(p - map) != idx->header.size) {
+        idx->header.size = (uint64_t)(p - map);
+        idx->changed = 1;
+    }
+    return 0;
+}
+
+// Запись через временный файл: параллельный запрос не увидит половину индекса
+static int index_save(const query_index_t *idx, const char *path) {
+    char idx_path[PATH_MAX], tmp_path[PATH_MAX];
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.idx.%d", path, (int)getpid());
+    
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) return -1;
+    
+    int ok = fwrite(&idx->header, sizeof(idx->header), 1, file) == 1 &&
+             fwrite(idx->entries, sizeof(*idx->entries), idx->header.count, file) == idx->header.count;
+    if (fclose(file) != 0 || !ok || rename(tmp_path, idx_path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int query_csv(query_job_t *job, const char *map, size_t size) {
+    query_index_t idx;
+    index_load(&idx, job->path, map, size);
+    if (index_extend(&idx, map, size) != 0) {
+        fprintf(stderr, "%s: out of memory building index\n", job->path);
+        free(idx.entries);
+        return -1;
+    }
+    job->index_state = QUERY_INDEX_REUSED;
+    if (idx.changed) {
+        job->index_state = query.write_index && index_save(&idx, job->path) == 0 ?
+                           QUERY_INDEX_UPDATED : QUERY_INDEX_UNSAVED;
+    }
+    
+    // Последняя запись индекса раньше начала интервала - с нее и читаем
+    uint32_t lo = 0, hi = idx.header.count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (idx.entries[mid].time_ms < query.from_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const char *p = map + (lo > 0 ? idx.entries[lo - 1].offset : 0);
+    const char *end = map + idx.header.size;
+    free(idx.entries);
+    
+    int rc = 0;
+    const char *nl;
+    while (rc == 0 && p < end && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        char line[LOG_ENTRY_SIZE * 2];
+        pzem_data_t data;
+        if (copy_line(line, sizeof(line), p, nl) == 0 && parse_csv_entry(line, &data) == 0) {
+            job->rows++;
+            if (data.sample.timestamp_ms >= query.to_ms) break;
+            if (data.sample.timestamp_ms >= query.from_ms) {
+                rc = query_row(job, line, (size_t)(nl - p) + 1, &data);
+            }
+        }
+        p = nl + 1;
+    }
+    return rc;
+}
+
+// Следующий заголовок блока после поврежденного места
+static size_t pzb_resync(const uint8_t *map, size_t size, size_t offset) {
+    do {
+        offset++;
+    } while (offset + 3 <= size && !(map[offset] == (PZEM_PZB_MAGIC & 0xFF) &&
+             map[offset + 1] == (PZEM_PZB_MAGIC >> 8) && map[offset + 2] == PZEM_PZB_VERSION));
+    return offset;
+}
+
+// Блоки вне интервала пропускаются по заголовку без распаковки
+static int query_pzb(query_job_t *job, const uint8_t *map, size_t size) {
+    int rc = 0;
+    size_t offset = 0;
+    
+    while (rc == 0 && offset + PZEM_PZB_HEADER_SIZE <= size) {
+        pzem_pzb_header_t header;
+        memcpy(&header, map + offset, sizeof(header));
+        if (header.magic != PZEM_PZB_MAGIC || header.version != PZEM_PZB_VERSION) {
+            offset = pzb_resync(map, size, offset);
+            continue;
+        }
+        size_t block = PZEM_PZB_HEADER_SIZE + (size_t)header.size;
+        if (offset + block > size) break;
+        if (header.last_ms < query.from_ms) {
+            offset += block;
+            continue;
+        }
+        if (header.first_ms >= query.to_ms) break;
+        
+        pzb_decoder_t dec;
+        if (pzb_open(&dec, map + offset, size - offset) <= 0) {
+            fprintf(stderr, "%s: corrupted block at offset %zu skipped\n", job->path, offset);
+            offset = pzb_resync(map, size, offset);
+            continue;
+        }
+        
+        pzem_data_t data;
+        while (rc == 0 && pzb_next(&dec, &data) > 0) {
+            job->rows++;
+            if (data.sample.timestamp_ms >= query.to_ms) break;
+            if (data.sample.timestamp_ms < query.from_ms) continue;
+            
+            char line[LOG_ENTRY_SIZE];
+            size_t len = format_csv_entry(line, sizeof(line), &data, (time_t)(data.sample.timestamp_ms / 1000));
+            rc = query_row(job, line, len, &data);
+        }
+        offset += block;
+    }
+    return rc;
+}
+
+static int query_file(query_job_t *job) {
+    int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", job->path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "Cannot stat %s: %s\n", job->path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", job->path, strerror(errno));
+        return -1;
+    }
+    
+    const char *ext = strrchr(job->path, '.');
+    int rc = ext && strcmp(ext, ".pzb") == 0 ? query_pzb(job, map, size) : query_csv(job, map, size);
+    munmap(map, size);
+    return rc;
+}
+
+static void *query_worker(void *arg) {
+    (void)arg;
+    int i;
+    while ((i = atomic_fetch_add(&next_job, 1)) < job_count) {
+        int failed = query_file(&jobs[i]) != 0;
+        
+        pthread_mutex_lock(&jobs_lock);
+        jobs[i].failed = failed;
+        jobs[i].done = 1;
+        pthread_cond_broadcast(&job_done);
+        pthread_mutex_unlock(&jobs_lock);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options] FILE...\n"
+           "Selects measurements from daily logs (CSV .log or compressed .pzb).\n"
+           "  -f, --from TIME       start of interval, 'YYYY-MM-DD [HH:MM[:SS]]' local time\n"
+           "  -t, --to TIME         end of interval (exclusive)\n"
+           "  -c, --columns LIST    comma separated channels (voltage_A ... power_C, status),\n"
+           "                        default - whole log line\n"
+           "  -w, --where COND      filter like 'voltage_A>240', repeatable (all must match)\n"
+           "  -j, --jobs N          parallel files (default - CPU count, max %d)\n"
+           "  -s, --stride N        index entry every N lines (default %d)\n"
+           "  -n, --no-index-write  do not store FILE.idx next to the log\n"
+           "  -v, --verbose         print statistics to stderr\n",
+           prog, QUERY_MAX_THREADS, QUERY_DEFAULT_STRIDE);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"columns", required_argument, NULL, 'c'},
+        {"where", required_argument, NULL, 'w'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"stride", required_argument, NULL, 's'},
+        {"no-index-write", no_argument, NULL, 'n'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int verbose = 0;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:c:w:j:s:nvh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'f': if (parse_time(optarg, &query.from_ms) != 0) return 1; break;
+            case 't': if (parse_time(optarg, &query.to_ms) != 0) return 1; break;
+            case 'c': if (parse_columns(optarg) != 0) return 1; break;
+            case 'w': if (parse_filter(optarg) != 0) return 1; break;
+            case 'j': threads = atoi(optarg); break;
+            case 's': query.stride = atoi(optarg); break;
+            case 'n': query.write_index = 0; break;
+            case 'v': verbose = 1; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (query.stride < 1 || query.stride > UINT16_MAX) {
+        fprintf(stderr, "Invalid stride: %d\n", query.stride);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > QUERY_MAX_THREADS) threads = QUERY_MAX_THREADS;
+    
+    job_count = argc - optind;
+    if (threads > job_count) threads = job_count;
+    jobs = calloc((size_t)job_count, sizeof(*jobs));
+    if (jobs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < job_count; i++) {
+        jobs[i].path = argv[optind + i];
+    }
+    
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    pthread_t workers[QUERY_MAX_THREADS];
+    int started_threads = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, query_worker, NULL) != 0) break;
+        started_threads++;
+    }
+    if (started_threads == 0) {
+        query_worker(NULL);
+    }
+    
+    if (query.column_count > 0) {
+        printf("date,time");
+        for (int i = 0; i < query.column_count; i++) {
+            printf(",%s", query.columns[i] == QUERY_STATUS ? "status" : pzem_channels[query.columns[i]].name);
+        }
+        printf("\n");
+    }
+    
+    // Вывод по порядку файлов, пока остальные еще разбираются
+    int rc = 0;
+    unsigned long long rows = 0, matched = 0;
+    int index_updated = 0, index_unsaved = 0;
+    for (int i = 0; i < job_count; i++) {
+        pthread_mutex_lock(&jobs_lock);
+        while (!jobs[i].done) {
+            pthread_cond_wait(&job_done, &jobs_lock);
+        }
+        pthread_mutex_unlock(&jobs_lock);
+        
+        query_job_t *job = &jobs[i];
+        if (job->len > 0 && fwrite(job->out, 1, job->len, stdout) != job->len) {
+            fprintf(stderr, "Write failed: %s\n", strerror(errno));
+            rc = -1;
+        }
+        free(job->out);
+        job->out = NULL;
+        
+        if (job->failed) rc = -1;
+        rows += job->rows;
+        matched += job->matched;
+        index_updated += job->index_state == QUERY_INDEX_UPDATED;
+        index_unsaved += job->index_state == QUERY_INDEX_UNSAVED;
+    }
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        rc = -1;
+    }
+    
+    if (verbose) {
+        struct timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        double elapsed_ms = (finished.tv_sec - started.tv_sec) * 1000.0 +
+                            (finished.tv_nsec - started.tv_nsec) / 1e6;
+        fprintf(stderr, "files=%d threads=%d rows_read=%llu rows_matched=%llu index_updated=%d index_unsaved=%d time_ms=%.1f\n",
+                job_count, started_threads ? started_threads : 1, rows, matched, index_updated, index_unsaved, elapsed_ms);
+    }
+    
+    free(jobs);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,683 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Пересчет сводок по архиву дневных логов с новыми порогами: pzem3-reaggregate.
+// Состояния H/L/N заново считаются той же update_threshold_states(), что и в демоне,
+// время в состояниях и min/avg/max собираются в окна как сводки rollup_periods и пишутся
+// одним файлом в формате сводок. Файлы раздаются потокам из общей очереди, каждый поток
+// отображает свой файл в память и считает его окна отдельно, в конце окна сливаются.
+// Окно делит сутки, поэтому дневные файлы почти не делят окон между собой.
+
+#include "pzem_monitor.h"
+#include <getopt.h>
+#include <limits.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#define REAGG_DEFAULT_PERIOD 3600
+#define REAGG_MAX_THREADS 16
+
+// Результат одного файла
+typedef struct {
+    const char *path;
+    pzem_rollup_window_t *win;
+    size_t count;
+    size_t capacity;
+    unsigned long long rows;
+    unsigned long long errors;
+    long long first_ms;                  // первая строка файла
+    int has_tail;                        // последняя строка удачная, ее состояния держатся дальше
+    long long tail_ms;
+    char tail_state[PZEM_STATE_COUNT];
+    int failed;
+} reagg_job_t;
+
+// Разобранные измерения файла
+typedef struct {
+    pzem_data_t *rows;
+    size_t count;
+    size_t capacity;
+} reagg_rows_t;
+
+static struct {
+    long long period_ms;
+    long long max_gap_ms;                // 0 - состояние держится до следующей строки
+    pzem_config_t config;
+    pzem_channel_limits_t limits[PZEM_CHANNEL_COUNT];
+} reagg = {
+    .period_ms = REAGG_DEFAULT_PERIOD * 1000LL
+};
+
+static reagg_job_t *jobs;
+static int job_count;
+static atomic_int next_job;
+
+// Ключи порогов из конфигурации демона, остальные ключи пропускаются
+static const struct {
+    const char *key;
+    size_t offset;
+} threshold_keys[] = {
+    {"voltage_high_alarm", offsetof(pzem_config_t, voltage_high_alarm)},
+    {"voltage_high_warning", offsetof(pzem_config_t, voltage_high_warning)},
+    {"voltage_low_warning", offsetof(pzem_config_t, voltage_low_warning)},
+    {"voltage_low_alarm", offsetof(pzem_config_t, voltage_low_alarm)},
+    {"current_high_alarm", offsetof(pzem_config_t, current_high_alarm)},
+    {"current_high_warning", offsetof(pzem_config_t, current_high_warning)},
+    {"current_low_warning", offsetof(pzem_config_t, current_low_warning)},
+    {"current_low_alarm", offsetof(pzem_config_t, current_low_alarm)},
+    {"frequency_high_alarm", offsetof(pzem_config_t, frequency_high_alarm)},
+    {"frequency_high_warning", offsetof(pzem_config_t, frequency_high_warning)},
+    {"frequency_low_warning", offsetof(pzem_config_t, frequency_low_warning)},
+    {"frequency_low_alarm", offsetof(pzem_config_t, frequency_low_alarm)},
+    {"angleV_high_alarm", offsetof(pzem_config_t, angleV_high_alarm)},
+    {"angleV_high_warning", offsetof(pzem_config_t, angleV_high_warning)},
+    {"angleV_low_warning", offsetof(pzem_config_t, angleV_low_warning)},
+    {"angleV_low_alarm", offsetof(pzem_config_t, angleV_low_alarm)},
+    {"angleI_high_alarm", offsetof(pzem_config_t, angleI_high_alarm)},
+    {"angleI_high_warning", offsetof(pzem_config_t, angleI_high_warning)},
+    {"angleI_low_warning", offsetof(pzem_config_t, angleI_low_warning)},
+    {"angleI_low_alarm", offsetof(pzem_config_t, angleI_low_alarm)}
+};
+
+// Пороги из файла конфигурации в формате демона (pzem3_<имя>.conf)
+static int load_thresholds(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        
+        char key[64], value[64];
+        if (sscanf(line, "%63[^ =] = %63[^\n]", key, value) != 2) continue;
+        for (size_t i = 0; i < sizeof(threshold_keys) / sizeof(threshold_keys[0]); i++) {
+            if (strcmp(key, threshold_keys[i].key) == 0) {
+                *(float *)((char *)&reagg.config + threshold_keys[i].offset) = (float)atof(value);
+                break;
+            }
+        }
+    }
+    fclose(file);
+    
+    if (validate_thresholds(&reagg.config) != PZEM_SUCCESS) {
+        return -1;
+    }
+    build_channel_limits(&reagg.config, reagg.limits);
+    return 0;
+}
+
+// Начало окна по местному времени, как у сводок демона
+static long long window_start(long long t) {
+    time_t sec = (time_t)(t / 1000);
+    struct tm tm_info;
+    localtime_r(&sec, &tm_info);
+    
+    long long offset = (t + tm_info.tm_gmtoff * 1000LL) % reagg.period_ms;
+    if (offset < 0) offset += reagg.period_ms;
+    return t - offset;
+}
+
+// Окно, в которое попадает t. Строки идут по времени, поэтому обычно это последнее окно
+static pzem_rollup_window_t *job_window(reagg_job_t *job, long long t) {
+    long long start = window_start(t);
+    
+    for (size_t i = job->count; i-- > 0;) {
+        if (job->win[i].start_ms == start) return &job->win[i];
+        if (job->win[i].start_ms < start) break;
+    }
+    
+    if (job->count == job->capacity) {
+        size_t capacity = job->capacity ? job->capacity * 2 : 64;
+        pzem_rollup_window_t *grown = realloc(job->win, capacity * sizeof(*grown));
+        if (grown == NULL) return NULL;
+        job->win = grown;
+        job->capacity = capacity;
+    }
+    pzem_rollup_window_t *w = &job->win[job->count++];
+    memset(w, 0, sizeof(*w));
+    w->open = 1;
+    w->start_ms = start;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        w->min[i] = UINT32_MAX;
+    }
+    return w;
+}
+
+static int state_slot(char state) {
+    switch (state) {
+        case 'H': return 1;
+        case 'L': return 2;
+        default: return 0;
+    }
+}
+
+// Состояния измерения держатся с from до until, время делится по окнам
+static int hold_states(reagg_job_t *job, const char *state, long long from, long long until) {
+    while (from < until) {
+        pzem_rollup_window_t *w = job_window(job, from);
+        if (w == NULL) return -1;
+        
+        long long end = w->start_ms + reagg.period_ms;
+        uint32_t dt = (uint32_t)((until < end ? until : end) - from);
+        for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+            w->state_ms[i][state_slot(state[i])] += dt;
+        }
+        from += dt;
+    }
+    return 0;
+}
+
+static int rows_add(reagg_rows_t *rows, const pzem_data_t *data) {
+    if (rows->count == rows->capacity) {
+        size_t capacity = rows->capacity ? rows->capacity * 2 : 4096;
+        pzem_data_t *grown = realloc(rows->rows, capacity * sizeof(*grown));
+        if (grown == NULL) return -1;
+        rows->rows = grown;
+        rows->capacity = capacity;
+    }
+    rows->rows[rows->count++] = *data;
+    return 0;
+}
+
+// CSV лог: переводы строк ищет memchr (в libc он векторный), поля разбирает
+// тот же parse_csv_entry, что и у остальных утилит
+static int read_csv(reagg_job_t *job, const char *map, size_t size, reagg_rows_t *rows) {
+    const char *p = map;
+    const char *end = map + size;
+    const char *nl;
+    
+    while (p < end && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        char line[LOG_ENTRY_SIZE * 2];
+        size_t len = (size_t)(nl - p) + 1;
+        pzem_data_t data;
+        if (len < sizeof(line)) {
+            memcpy(line, p, len);
+            line[len] = '\0';
+            if (parse_csv_entry(line, &data) == 0 && rows_add(rows, &data) != 0) {
+                fprintf(stderr, "%s: out of memory\n", job->path);
+                return -1;
+            }
+        }
+        p = nl + 1;
+    }
+    return 0;
+}
+
+static int read_pzb(reagg_job_t *job, const uint8_t *map, size_t size, reagg_rows_t *rows) {
+    size_t offset = 0;
+    while (offset < size) {
+        pzb_decoder_t dec;
+        long block = pzb_open(&dec, map + offset, size - offset);
+        if (block == 0) break;
+        if (block < 0) {
+            fprintf(stderr, "%s: corrupted block at offset %zu skipped\n", job->path, offset);
+            do {
+                offset++;
+            } while (offset + 3 <= size && !(map[offset] == (PZEM_PZB_MAGIC & 0xFF) &&
+                     map[offset + 1] == (PZEM_PZB_MAGIC >> 8) && map[offset + 2] == PZEM_PZB_VERSION));
+            continue;
+        }
+        
+        pzem_data_t data;
+        while (pzb_next(&dec, &data) > 0) {
+            if (rows_add(rows, &data) != 0) {
+                fprintf(stderr, "%s: out of memory\n", job->path);
+                return -1;
+            }
+        }
+        offset += (size_t)block;
+    }
+    return 0;
+}
+
+// Пустые значения SDT лога восстанавливаются как в графике: прямая между соседними
+// записанными значениями канала, после последнего держится оно
+static void fill_gaps(reagg_rows_t *rows) {
+    for (int c = 0; c < PZEM_CHANNEL_COUNT; c++) {
+        uint32_t bit = 1u << c;
+        long prev = -1;
+        for (size_t i = 0; i <= rows->count; i++) {
+            pzem_data_t *row = i < rows->count ? &rows->rows[i] : NULL;
+            if (row != NULL && (row->status != 0 || (row->omit & bit))) continue;
+            
+            size_t first = prev >= 0 ? (size_t)prev + 1 : 0;
+            for (size_t j = first; j < i; j++) {
+                pzem_data_t *gap = &rows->rows[j];
+                if (gap->status != 0) continue;
+                
+                long long value;
+                if (prev < 0 && row == NULL) break;
+                if (prev < 0) {
+                    value = pzem_channel_raw(&row->sample, c);
+                } else if (row == NULL) {
+                    value = pzem_channel_raw(&rows->rows[prev].sample, c);
+                } else {
+                    const pzem_data_t *a = &rows->rows[prev];
+                    long long v0 = pzem_channel_raw(&a->sample, c);
+                    long long v1 = pzem_channel_raw(&row->sample, c);
+                    long long t0 = a->sample.timestamp_ms, t1 = row->sample.timestamp_ms;
+                    value = t1 > t0 ? llround(v0 + (double)(v1 - v0) * (double)(gap->sample.timestamp_ms - t0) / (double)(t1 - t0)) : v0;
+                }
+                pzem_channel_set_raw(&gap->sample, c, (uint32_t)value);
+                gap->omit &= ~bit;
+            }
+            prev = (long)i;
+        }
+    }
+}
+
+// Полночь после t по местному времени: дальше последняя строка дня не держится
+static long long next_midnight(long long t) {
+    time_t sec = (time_t)(t / 1000);
+    struct tm tm_info;
+    localtime_r(&sec, &tm_info);
+    tm_info.tm_mday++;
+    tm_info.tm_hour = tm_info.tm_min = tm_info.tm_sec = 0;
+    tm_info.tm_isdst = -1;
+    return (long long)mktime(&tm_info) * 1000LL;
+}
+
+// Измерения файла в окна. Гистерезис начинается с N в начале каждого файла:
+// до первого выхода за *_alarm состояние не зависит от прошлого дня
+static int aggregate(reagg_job_t *job, const reagg_rows_t *rows) {
+    char state[PZEM_STATE_COUNT];
+    memset(state, 'N', sizeof(state));
+    int has_last = 0;
+    long long last_ms = 0;
+    
+    for (size_t i = 0; i < rows->count; i++) {
+        pzem_data_t data = rows->rows[i];
+        long long t = data.sample.timestamp_ms;
+        if (job->rows++ == 0) job->first_ms = t;
+        
+        if (has_last && t > last_ms) {
+            long long until = reagg.max_gap_ms > 0 && t - last_ms > reagg.max_gap_ms ? last_ms + reagg.max_gap_ms : t;
+            if (hold_states(job, state, last_ms, until) != 0) return -1;
+        }
+        
+        pzem_rollup_window_t *w = job_window(job, t);
+        if (w == NULL) return -1;
+        if (data.status != 0) {
+            // Во время ошибки состояние порогов неизвестно
+            w->errors++;
+            job->errors++;
+            has_last = 0;
+            continue;
+        }
+        
+        memcpy(data.state, state, sizeof(state));
+        update_threshold_states(&data, reagg.limits);
+        memcpy(state, data.state, sizeof(state));
+        
+        w->samples++;
+        for (int c = 0; c < PZEM_CHANNEL_COUNT; c++) {
+            uint32_t value = pzem_channel_raw(&data.sample, c);
+            if (value < w->min[c]) w->min[c] = value;
+            if (value > w->max[c]) w->max[c] = value;
+            w->sum[c] += value;
+        }
+        last_ms = t;
+        has_last = 1;
+    }
+    
+    // Докуда держать последнюю строку, видно только по следующему файлу
+    job->has_tail = has_last;
+    job->tail_ms = last_ms;
+    memcpy(job->tail_state, state, sizeof(state));
+    return 0;
+}
+
+// Последняя строка файла держится до первой строки следующего файла, но не дальше
+// полуночи. Последняя строка последнего файла не держится: неизвестно, работал ли демон дальше
+static int hold_tail(reagg_job_t *job, const reagg_job_t *next) {
+    if (!job->has_tail || next == NULL || next->rows == 0) return 0;
+    
+    long long until = next_midnight(job->tail_ms);
+    if (next->first_ms < until) until = next->first_ms;
+    if (reagg.max_gap_ms > 0 && until - job->tail_ms > reagg.max_gap_ms) until = job->tail_ms + reagg.max_gap_ms;
+    return hold_states(job, job->tail_state, job->tail_ms, until);
+}
+
+static int process_file(reagg_job_t *job) {
+    int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", job->path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", job->path, strerror(errno));
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    
+    reagg_rows_t rows = {0};
+    const char *ext = strrchr(job->path, '.');
+    int rc = ext && strcmp(ext, ".pzb") == 0 ? read_pzb(job, map, size, &rows) : read_csv(job, map, size, &rows);
+    munmap(map, size);
+    
+    if (rc == 0) {
+        fill_gaps(&rows);
+        rc = aggregate(job, &rows);
+        if (rc != 0) fprintf(stderr, "%s: out of memory\n", job->path);
+    }
+    free(rows.rows);
+    return rc;
+}
+
+static void *reagg_worker(void *arg) {
+    (void)arg;
+    int i;
+    while ((i = atomic_fetch_add(&next_job, 1)) < job_count) {
+        jobs[i].failed = process_file(&jobs[i]) != 0;
+    }
+    return NULL;
+}
+
+// Окно, закрытое в другом файле (тот же час в двух файлах), сливается как в демоне
+static void window_merge(pzem_rollup_window_t *w, const pzem_rollup_window_t *src) {
+    w->samples += src->samples;
+    w->errors += src->errors;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (src->min[i] < w->min[i]) w->min[i] = src->min[i];
+        if (src->max[i] > w->max[i]) w->max[i] = src->max[i];
+        w->sum[i] += src->sum[i];
+    }
+    for (int i = 0; i < PZEM_STATE_COUNT; i++) {
+        for (int k = 0; k < 3; k++) {
+            w->state_ms[i][k] += src->state_ms[i][k];
+        }
+    }
+}
+
+static int window_cmp(const void *a, const void *b) {
+    long long x = ((const pzem_rollup_window_t *)a)->start_ms;
+    long long y = ((const pzem_rollup_window_t *)b)->start_ms;
+    return (x > y) - (x < y);
+}
+
+// Имя лога "pzem3_<имя>_YYYY-MM-DD.log": длина префикса до даты или 0
+static size_t log_name_prefix(const char *file) {
+    const char *ext = strrchr(file, '.');
+    if (strncmp(file, "pzem3_", 6) != 0 || ext == NULL ||
+        (strcmp(ext, ".log") != 0 && strcmp(ext, ".pzb") != 0)) {
+        return 0;
+    }
+    size_t len = (size_t)(ext - file);
+    if (len < 6 + 11) return 0;
+    
+    const char *date = file + len - 10;
+    int year, mon, day;
+    if (date[-1] != '_' || sscanf(date, "%4d-%2d-%2d", &year, &mon, &day) != 3) return 0;
+    return (size_t)(date - file);
+}
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Логи каталога в порядке дат. Все файлы должны быть одного устройства:
+// name задает его явно, иначе в каталоге должно быть одно имя
+static int add_directory(const char *dir, const char *name, char ***paths, int *count) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    
+    char prefix[NAME_MAX + 1] = "";
+    if (name != NULL) {
+        snprintf(prefix, sizeof(prefix), "pzem3_%s_", name);
+    }
+    
+    int first = *count, rc = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = log_name_prefix(entry->d_name);
+        if (len == 0) continue;
+        if (prefix[0] == '\0') {
+            snprintf(prefix, sizeof(prefix), "%.*s", (int)len, entry->d_name);
+        } else if (strlen(prefix) != len || strncmp(prefix, entry->d_name, len) != 0) {
+            if (name == NULL) {
+                fprintf(stderr, "%s: logs of several devices (%s*, %.*s*), select one with -n\n",
+                        dir, prefix, (int)len, entry->d_name);
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+        
+        char **grown = realloc(*paths, (size_t)(*count + 1) * sizeof(char *));
+        size_t path_len = strlen(dir) + strlen(entry->d_name) + 2;
+        char *path = malloc(path_len);
+        if (grown == NULL || path == NULL) {
+            free(path);
+            if (grown != NULL) *paths = grown;
+            fprintf(stderr, "Out of memory\n");
+            rc = -1;
+            break;
+        }
+        snprintf(path, path_len, "%s/%s", dir, entry->d_name);
+        *paths = grown;
+        (*paths)[(*count)++] = path;
+    }
+    closedir(d);
+    
+    qsort(*paths + first, (size_t)(*count - first), sizeof(char *), path_cmp);
+    return rc;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s -c CONFIG [options] FILE|DIR...\n"
+           "Recomputes threshold states and window statistics over archived logs\n"
+           "(CSV .log or compressed .pzb) and writes them in the rollup file format.\n"
+           "  -c, --config FILE    thresholds (*_alarm, *_warning) in pzem3 config format\n"
+           "  -p, --period SEC     window length, divides a day (default %d)\n"
+           "  -g, --max-gap SEC    hold a state at most SEC after its line (default - until next line)\n"
+           "  -n, --name NAME      device name for DIR (pzem3_NAME_YYYY-MM-DD.log)\n"
+           "  -o, --output FILE    write to FILE instead of stdout\n"
+           "  -j, --jobs N         worker threads (default - CPU count, max %d)\n"
+           "  -v, --verbose        print statistics to stderr\n",
+           prog, REAGG_DEFAULT_PERIOD, REAGG_MAX_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"config", required_argument, NULL, 'c'},
+        {"period", required_argument, NULL, 'p'},
+        {"max-gap", required_argument, NULL, 'g'},
+        {"name", required_argument, NULL, 'n'},
+        {"output", required_argument, NULL, 'o'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    const char *config = NULL, *name = NULL, *output = NULL;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int period = REAGG_DEFAULT_PERIOD, verbose = 0;
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:p:g:n:o:j:vh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': config = optarg; break;
+            case 'p': period = atoi(optarg); break;
+            case 'g': reagg.max_gap_ms = atoll(optarg) * 1000LL; break;
+            case 'n': name = optarg; break;
+            case 'o': output = optarg; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'v': verbose = 1; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (config == NULL || optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (period < 10 || 86400 % period != 0) {
+        fprintf(stderr, "Invalid period: %d (must be at least 10 s and divide a day)\n", period);
+        return 1;
+    }
+    reagg.period_ms = period * 1000LL;
+    
+    // Ошибки порогов validate_thresholds пишет в syslog, дублируем их в stderr
+    openlog("pzem3-reaggregate", LOG_PERROR, LOG_USER);
+    if (load_thresholds(config) != 0) {
+        return 1;
+    }
+    
+    char **paths = NULL;
+    int path_count = 0;
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (add_directory(argv[i], name, &paths, &path_count) != 0) return 1;
+            continue;
+        }
+        char **grown = realloc(paths, (size_t)(path_count + 1) * sizeof(char *));
+        if (grown == NULL || (grown[path_count] = strdup(argv[i])) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        paths = grown;
+        path_count++;
+    }
+    if (path_count == 0) {
+        fprintf(stderr, "No log files found\n");
+        return 1;
+    }
+    
+    job_count = path_count;
+    jobs = calloc((size_t)job_count, sizeof(*jobs));
+    if (jobs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < job_count; i++) {
+        jobs[i].path = paths[i];
+    }
+    
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    if (threads < 1) threads = 1;
+    if (threads > REAGG_MAX_THREADS) threads = REAGG_MAX_THREADS;
+    if (threads > job_count) threads = job_count;
+    pthread_t workers[REAGG_MAX_THREADS];
+    int started_threads = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, reagg_worker, NULL) != 0) break;
+        started_threads++;
+    }
+    if (started_threads == 0) {
+        reagg_worker(NULL);
+    }
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    // Окна всех файлов по времени, одинаковые сливаются
+    int rc = 0;
+    size_t total = 0;
+    unsigned long long rows = 0, errors = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (hold_tail(&jobs[i], i + 1 < job_count ? &jobs[i + 1] : NULL) != 0) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].failed) rc = -1;
+        total += jobs[i].count;
+        rows += jobs[i].rows;
+        errors += jobs[i].errors;
+    }
+    pzem_rollup_window_t *all = malloc((total ? total : 1) * sizeof(*all));
+    if (all == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    size_t n = 0;
+    for (int i = 0; i < job_count; i++) {
+        memcpy(all + n, jobs[i].win, jobs[i].count * sizeof(*all));
+        n += jobs[i].count;
+        free(jobs[i].win);
+    }
+    qsort(all, n, sizeof(*all), window_cmp);
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (merged > 0 && all[merged - 1].start_ms == all[i].start_ms) {
+            window_merge(&all[merged - 1], &all[i]);
+        } else {
+            all[merged++] = all[i];
+        }
+    }
+    
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "Cannot create %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    for (size_t i = 0; i < merged; i++) {
+        char entry[ROLLUP_ENTRY_SIZE];
+        size_t len = format_rollup_entry(entry, sizeof(entry), &all[i], period);
+        if (fwrite(entry, 1, len, out) != len) break;
+    }
+    if (fflush(out) != 0 || ferror(out) || (out != stdout && fclose(out) != 0)) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        rc = -1;
+    }
+    
+    if (verbose) {
+        struct timespec finished;
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        double elapsed_ms = (finished.tv_sec - started.tv_sec) * 1000.0 +
+                            (finished.tv_nsec - started.tv_nsec) / 1e6;
+        fprintf(stderr, "files=%d threads=%d rows=%llu errors=%llu windows=%zu time_ms=%.1f rows_per_s=%.0f\n",
+                job_count, started_threads ? started_threads : 1, rows, errors, merged, elapsed_ms,
+                elapsed_ms > 0 ? rows * 1000.0 / elapsed_ms : 0.0);
+    }
+    
+    free(all);
+    for (int i = 0; i < path_count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(jobs);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,674 @@
+/*
+Copyright (c) 2010, 2011 the Friendika Project
+All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+// Виртуальный PZEM-6L24 для тестов и бенчмарков без оборудования.
+// Отвечает на чтение входных регистров (0x04) 0x0000-0x0013 с тем же порядком байт,
+// что и настоящий счетчик, одновременно через псевдотерминал (Modbus RTU)
+// и Modbus TCP на localhost. Формы сигналов, задержка ответа, ошибки CRC
+// и пропадания ответов задаются ключами или файлом сценария.
+
+#define _GNU_SOURCE
+#include "pzem_monitor.h"
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define SIM_MAX_CONNS 16
+#define SIM_FRAME_MAX 300
+#define SIM_RTU_REQUEST_LEN 8
+#define SIM_RTU_GAP_US 5000          // пауза между кадрами RTU
+#define SIM_DEFAULT_PTY "/tmp/pzem3_sim"
+#define SIM_DEFAULT_TCP_PORT 1502
+
+typedef enum {
+    WAVE_CONST = 0,
+    WAVE_SINE,
+    WAVE_SQUARE,
+    WAVE_RAMP,
+    WAVE_STEP,
+    WAVE_NOISE
+} wave_shape_t;
+
+// Сигнал канала: base + amplitude * форма(t / period)
+typedef struct {
+    wave_shape_t shape;
+    double base;
+    double amplitude;
+    double period;
+} wave_t;
+
+// Конечная точка: псевдотерминал или TCP соединение, один отложенный ответ
+typedef struct {
+    int fd;
+    int tcp;
+    uint8_t in[SIM_FRAME_MAX];
+    size_t in_len;
+    long long last_rx_us;
+    uint8_t out[SIM_FRAME_MAX];
+    size_t out_len;
+    long long due_us;                // 0 - ответа в ожидании нет
+} sim_endpoint_t;
+
+typedef struct {
+    char pty_link[256];
+    int tcp_port;
+    int slaves[256];
+    wave_t waves[PZEM_CHANNEL_COUNT];
+    int latency_ms;
+    int jitter_ms;
+    int baudrate;                    // время передачи кадра RTU, 0 - мгновенно
+    double crc_error_rate;
+    double drop_rate;
+    int dropout_period_s;            // периодическое пропадание всех ответов
+    int dropout_duration_s;
+    int verbose;
+} sim_config_t;
+
+static const char *wave_names[] = {"const", "sine", "square", "ramp", "step", "noise"};
+
+static sim_config_t sim = {
+    .pty_link = SIM_DEFAULT_PTY,
+    .tcp_port = SIM_DEFAULT_TCP_PORT,
+};
+
+static sim_endpoint_t endpoints[SIM_MAX_CONNS + 1];
+static int listen_fd = -1;
+static long long start_us;
+static volatile sig_atomic_t running = 1;
+
+static struct {
+    unsigned long long requests;
+    unsigned long long responses;
+    unsigned long long exceptions;
+    unsigned long long dropped;
+    unsigned long long crc_errors;
+    unsigned long long bad_frames;
+} stats;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static double random_unit(void) {
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+// Значения по умолчанию: сеть 230 В / 50 Гц с медленно меняющейся нагрузкой
+static void default_waves(wave_t *waves) {
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        wave_t *w = &waves[i];
+        switch (pzem_channels[i].group) {
+            case PZEM_GROUP_VOLTAGE:   *w = (wave_t){WAVE_SINE, 230.0, 4.0, 60.0}; break;
+            case PZEM_GROUP_CURRENT:   *w = (wave_t){WAVE_SINE, 5.0, 2.0, 300.0}; break;
+            case PZEM_GROUP_FREQUENCY: *w = (wave_t){WAVE_NOISE, 50.0, 0.02, 0.0}; break;
+            case PZEM_GROUP_ANGLEI:    *w = (wave_t){WAVE_NOISE, 10.0, 2.0, 0.0}; break;
+            case PZEM_GROUP_POWER:     *w = (wave_t){WAVE_SINE, 1100.0, 450.0, 300.0}; break;
+            default: break;
+        }
+    }
+    waves[PZEM_CH_ANGLEV_B] = (wave_t){WAVE_CONST, 120.0, 0.0, 0.0};
+    waves[PZEM_CH_ANGLEV_C] = (wave_t){WAVE_CONST, 240.0, 0.0, 0.0};
+}
+
+static double wave_value(const wave_t *w, double t) {
+    double x = w->period > 0 ? t / w->period : 0.0;
+    switch (w->shape) {
+        case WAVE_SINE:   return w->base + w->amplitude * sin(2.0 * M_PI * x);
+        case WAVE_SQUARE: return w->base + (x - floor(x) < 0.5 ? w->amplitude : -w->amplitude);
+        case WAVE_RAMP:   return w->base + w->amplitude * (x - floor(x));
+        case WAVE_STEP:   return w->base + (t >= w->period ? w->amplitude : 0.0);
+        case WAVE_NOISE:  return w->base + w->amplitude * (2.0 * random_unit() - 1.0);
+        default:          return w->base;
+    }
+}
+
+// Регистры устройства на момент t, порядок байт как у счетчика:
+// 16-битные значения с переставленными байтами, 32-битные - младшее слово первым
+static void fill_registers(uint16_t *regs, int slave, double t) {
+    memset(regs, 0, PZEM_REG_COUNT * sizeof(uint16_t));
+    
+    // Периодические сигналы устройств шины немного сдвинуты, чтобы различаться;
+    // ступенька срабатывает у всех в заданный момент
+    double shift = slave * 7.0;
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        const pzem_channel_t *ch = &pzem_channels[i];
+        const wave_t *wave = &sim.waves[i];
+        double value = wave_value(wave, wave->shape == WAVE_STEP ? t : t + shift) * ch->scale;
+        uint32_t raw = value <= 0 ? 0 : (uint32_t)(value + 0.5);
+    
+        if (ch->wide) {
+            regs[ch->reg] = (uint16_t)(raw & 0xFFFF);
+            regs[ch->reg + 1] = (uint16_t)(raw >> 16);
+        } else {
+            if (raw > 0xFFFF) raw = 0xFFFF;
+            regs[ch->reg] = (uint16_t)(((raw & 0xFF) << 8) | (raw >> 8));
+        }
+    }
+}
+
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static int in_dropout(double t) {
+    if (sim.dropout_period_s <= 0 || sim.dropout_duration_s <= 0) return 0;
+    return fmod(t, sim.dropout_period_s) >= sim.dropout_period_s - sim.dropout_duration_s;
+}
+
+// PDU ответа на запрос, возвращает длину или 0 если отвечать не нужно
+static size_t handle_pdu(uint8_t *out, int slave, const uint8_t *pdu) {
+    if (slave <= 0 || slave > 255 || !sim.slaves[slave]) return 0;
+    stats.requests++;
+    
+    uint8_t function = pdu[0];
+    unsigned int start = ((unsigned int)pdu[1] << 8) | pdu[2];
+    unsigned int count = ((unsigned int)pdu[3] << 8) | pdu[4];
+    
+    if (function != 0x04) {
+        out[0] = function | 0x80;
+        out[1] = 0x01;           // неподдерживаемая функция
+        stats.exceptions++;
+        return 2;
+    }
+    if (count == 0 || start + count > PZEM_REG_COUNT) {
+        out[0] = function | 0x80;
+        out[1] = 0x02;           // недопустимый адрес
+        stats.exceptions++;
+        return 2;
+    }
+    
+    uint16_t regs[PZEM_REG_COUNT];
+    fill_registers(regs, slave, (now_us() - start_us) / 1e6);
+    
+    out[0] = function;
+    out[1] = (uint8_t)(count * 2);
+    for (unsigned int i = 0; i < count; i++) {
+        out[2 + 2 * i] = (uint8_t)(regs[start + i] >> 8);
+        out[3 + 2 * i] = (uint8_t)regs[start + i];
+    }
+    return 2 + count * 2;
+}
+
+// Постановка ответа с учетом сбоев и задержки
+static void queue_response(sim_endpoint_t *ep, size_t len) {
+    double t = (now_us() - start_us) / 1e6;
+    if (in_dropout(t) || random_unit() < sim.drop_rate) {
+        stats.dropped++;
+        return;
+    }
+    if (random_unit() < sim.crc_error_rate) {
+        // RTU - испорченная CRC. В TCP контрольной суммы нет: портим счетчик байт ответа,
+        // он не сходится с числом запрошенных регистров и libmodbus отвергает кадр.
+        // Длину MBAP не трогаем, иначе поток TCP рассинхронизируется
+        if (ep->tcp) {
+            ep->out[8] ^= 0x5A;
+        } else {
+            ep->out[len - 1] ^= 0x5A;
+        }
+        stats.crc_errors++;
+    }
+    
+    long long delay_us = sim.latency_ms * 1000LL;
+    if (sim.jitter_ms > 0) {
+        delay_us += (long long)(random_unit() * sim.jitter_ms * 1000.0);
+    }
+    if (!ep->tcp && sim.baudrate > 0) {
+        // 11 бит на байт: старт, 8 данных, четность/стоп
+        delay_us += (long long)len * 11 * 1000000LL / sim.baudrate;
+    }
+    ep->out_len = len;
+    ep->due_us = now_us() + delay_us;
+    stats.responses++;
+}
+
+static void send_response(sim_endpoint_t *ep) {
+    size_t off = 0;
+    while (off < ep->out_len) {
+        ssize_t n = write(ep->fd, ep->out + off, ep->out_len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += (size_t)n;
+    }
+    ep->out_len = 0;
+    ep->due_us = 0;
+}
+
+// RTU: кадры запроса фиксированной длины, при ошибке CRC сдвигаемся на байт
+static void process_rtu(sim_endpoint_t *ep) {
+    while (ep->in_len >= SIM_RTU_REQUEST_LEN) {
+        uint16_t crc = (uint16_t)(ep->in[6] | (ep->in[7] << 8));
+        if (crc16(ep->in, 6) != crc) {
+            stats.bad_frames++;
+            memmove(ep->in, ep->in + 1, --ep->in_len);
+            continue;
+        }
+    
+        // Адрес 0 - широковещательный, без ответа; пока ответ не ушел, устройство занято
+        size_t len = ep->due_us == 0 ? handle_pdu(ep->out + 1, ep->in[0], ep->in + 1) : 0;
+        if (len > 0) {
+            ep->out[0] = ep->in[0];
+            uint16_t out_crc = crc16(ep->out, len + 1);
+            ep->out[len + 1] = (uint8_t)out_crc;
+            ep->out[len + 2] = (uint8_t)(out_crc >> 8);
+            queue_response(ep, len + 3);
+        }
+        ep->in_len -= SIM_RTU_REQUEST_LEN;
+        memmove(ep->in, ep->in + SIM_RTU_REQUEST_LEN, ep->in_len);
+    }
+}
+
+// TCP: заголовок MBAP (транзакция, протокол, длина, устройство) и PDU
+static void process_tcp(sim_endpoint_t *ep) {
+    while (ep->in_len >= 7) {
+        size_t length = ((size_t)ep->in[4] << 8) | ep->in[5];
+        if (length < 2 || length > SIM_FRAME_MAX - 6) {
+            stats.bad_frames++;
+            ep->in_len = 0;
+            return;
+        }
+        if (ep->in_len < 6 + length) return;
+    
+        if (length >= 6 && ep->due_us == 0) {
+            size_t len = handle_pdu(ep->out + 7, ep->in[6], ep->in + 7);
+            if (len > 0) {
+                memcpy(ep->out, ep->in, 4);
+                ep->out[4] = (uint8_t)((len + 1) >> 8);
+                ep->out[5] = (uint8_t)(len + 1);
+                ep->out[6] = ep->in[6];
+                queue_response(ep, len + 7);
+            }
+        } else {
+            stats.bad_frames++;
+        }
+        ep->in_len -= 6 + length;
+        memmove(ep->in, ep->in + 6 + length, ep->in_len);
+    }
+}
+
+static void endpoint_close(sim_endpoint_t *ep) {
+    if (ep->fd >= 0) close(ep->fd);
+    memset(ep, 0, sizeof(*ep));
+    ep->fd = -1;
+}
+
+static void endpoint_read(sim_endpoint_t *ep) {
+    long long now = now_us();
+    // Пауза на линии RTU завершает незаконченный кадр
+    if (!ep->tcp && ep->in_len > 0 && now - ep->last_rx_us > SIM_RTU_GAP_US) {
+        stats.bad_frames++;
+        ep->in_len = 0;
+    }
+    
+    ssize_t n = read(ep->fd, ep->in + ep->in_len, sizeof(ep->in) - ep->in_len);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            if (ep->tcp) {
+                endpoint_close(ep);
+            } else {
+                // Клиент закрыл порт - пустой pty, ждем следующего открытия
+                usleep(10000);
+            }
+        }
+        return;
+    }
+    ep->in_len += (size_t)n;
+    ep->last_rx_us = now;
+    
+    if (ep->tcp) {
+        process_tcp(ep);
+    } else {
+        process_rtu(ep);
+    }
+    if (ep->in_len == sizeof(ep->in)) {
+        ep->in_len = 0;
+    }
+}
+
+// Псевдотерминал с постоянной ссылкой для поля device конфигурации
+static int open_pty(const char *link) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+        fprintf(stderr, "Cannot create pseudo-terminal: %s\n", strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    
+    const char *slave_name = ptsname(fd);
+    // Держим сторону устройства открытой, иначе чтение мастера дает EIO между подключениями
+    int slave_fd = open(slave_name, O_RDWR | O_NOCTTY);
+    if (slave_fd >= 0) {
+        struct termios tio;
+        if (tcgetattr(slave_fd, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(slave_fd, TCSANOW, &tio);
+        }
+    }
+    
+    unlink(link);
+    if (symlink(slave_name, link) != 0) {
+        fprintf(stderr, "Cannot create link %s -> %s: %s\n", link, slave_name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    printf("RTU: %s -> %s (device = %s@9600)\n", link, slave_name, link);
+    return fd;
+}
+
+static int open_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        fprintf(stderr, "Cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    printf("TCP: 127.0.0.1:%d (device = 127.0.0.1:%d)\n", port, port);
+    return fd;
+}
+
+static void accept_tcp(void) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    
+    for (int i = 1; i <= SIM_MAX_CONNS; i++) {
+        if (endpoints[i].fd < 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            endpoints[i].fd = fd;
+            endpoints[i].tcp = 1;
+            return;
+        }
+    }
+    close(fd);
+}
+
+// Список адресов "1-3,5"
+static int parse_slaves(const char *list) {
+    memset(sim.slaves, 0, sizeof(sim.slaves));
+    int count = 0;
+    const char *p = list;
+    
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return -1;
+        }
+        if (first < 1 || last > 247 || first > last) return -1;
+        for (long a = first; a <= last; a++) {
+            count += !sim.slaves[a];
+            sim.slaves[a] = 1;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return -1;
+    }
+    return count;
+}
+
+// Строка "shape base [amplitude [period]]"
+static int parse_wave(const char *value, wave_t *wave) {
+    char shape[16];
+    wave_t w = {WAVE_CONST, 0.0, 0.0, 0.0};
+    int n = sscanf(value, "%15s %lf %lf %lf", shape, &w.base, &w.amplitude, &w.period);
+    if (n < 2) return -1;
+    
+    for (size_t i = 0; i < sizeof(wave_names) / sizeof(wave_names[0]); i++) {
+        if (strcmp(shape, wave_names[i]) == 0) {
+            w.shape = (wave_shape_t)i;
+            *wave = w;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int set_option(const char *key, const char *value) {
+    for (int i = 0; i < PZEM_CHANNEL_COUNT; i++) {
+        if (strcmp(key, pzem_channels[i].name) == 0) {
+            return parse_wave(value, &sim.waves[i]);
+        }
+    }
+    
+    if (strcmp(key, "slaves") == 0) {
+        return parse_slaves(value) > 0 ? 0 : -1;
+    } else if (strcmp(key, "latency_ms") == 0) {
+        sim.latency_ms = atoi(value);
+    } else if (strcmp(key, "jitter_ms") == 0) {
+        sim.jitter_ms = atoi(value);
+    } else if (strcmp(key, "baudrate") == 0) {
+        sim.baudrate = atoi(value);
+    } else if (strcmp(key, "crc_error_rate") == 0) {
+        sim.crc_error_rate = atof(value);
+    } else if (strcmp(key, "drop_rate") == 0) {
+        sim.drop_rate = atof(value);
+    } else if (strcmp(key, "dropout") == 0) {
+        if (sscanf(value, "%d %d", &sim.dropout_period_s, &sim.dropout_duration_s) != 2) return -1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Файл сценария в формате конфигурации: "ключ = значение", комментарии '#'
+static int load_script(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open script %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    char line[256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+    
+        char key[64];
+        char value[192];
+        if (sscanf(line, " %63[^= \t] = %191[^\n]", key, value) != 2) continue;
+        if (set_option(key, value) != 0) {
+            fprintf(stderr, "%s:%d: invalid setting '%s'\n", path, line_no, key);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -p, --pty PATH         link to the RTU pseudo-terminal (default %s, '-' to disable)\n"
+           "  -t, --tcp PORT         Modbus TCP port on 127.0.0.1 (default %d, 0 to disable)\n"
+           "  -s, --slaves LIST      slave addresses, e.g. 1-3,5 (default 1)\n"
+           "  -f, --script FILE      waveforms and faults, same keys as below\n"
+           "  -l, --latency MS       response delay\n"
+           "  -j, --jitter MS        random extra delay up to MS\n"
+           "  -b, --baud RATE        add RTU frame transmission time at RATE\n"
+           "  -c, --crc-errors RATE  share of responses with a broken CRC (0-1)\n"
+           "  -d, --drop RATE        share of requests left unanswered (0-1)\n"
+           "  -D, --dropout P:D      no responses for D seconds every P seconds\n"
+           "  -r, --seed N           random seed\n"
+           "  -v, --verbose          print statistics every 10 seconds\n"
+           "Script lines: <channel> = const|sine|square|ramp|step|noise base [amplitude [period_s]]\n",
+           prog, SIM_DEFAULT_PTY, SIM_DEFAULT_TCP_PORT);
+}
+
+static void print_stats(void) {
+    printf("requests=%llu responses=%llu exceptions=%llu dropped=%llu crc_errors=%llu bad_frames=%llu\n",
+           stats.requests, stats.responses, stats.exceptions, stats.dropped, stats.crc_errors, stats.bad_frames);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"pty", required_argument, NULL, 'p'},
+        {"tcp", required_argument, NULL, 't'},
+        {"slaves", required_argument, NULL, 's'},
+        {"script", required_argument, NULL, 'f'},
+        {"latency", required_argument, NULL, 'l'},
+        {"jitter", required_argument, NULL, 'j'},
+        {"baud", required_argument, NULL, 'b'},
+        {"crc-errors", required_argument, NULL, 'c'},
+        {"drop", required_argument, NULL, 'd'},
+        {"dropout", required_argument, NULL, 'D'},
+        {"seed", required_argument, NULL, 'r'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    default_waves(sim.waves);
+    parse_slaves("1");
+    srand((unsigned int)time(NULL));
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:t:s:f:l:j:b:c:d:D:r:vh", options, NULL)) != -1) {
+        int rc = 0;
+        switch (opt) {
+            case 'p': STRCPY_SAFE(sim.pty_link, optarg); break;
+            case 't': sim.tcp_port = atoi(optarg); break;
+            case 's': rc = parse_slaves(optarg) > 0 ? 0 : -1; break;
+            case 'f': rc = load_script(optarg); break;
+            case 'l': sim.latency_ms = atoi(optarg); break;
+            case 'j': sim.jitter_ms = atoi(optarg); break;
+            case 'b': sim.baudrate = atoi(optarg); break;
+            case 'c': sim.crc_error_rate = atof(optarg); break;
+            case 'd': sim.drop_rate = atof(optarg); break;
+            case 'D': rc = sscanf(optarg, "%d:%d", &sim.dropout_period_s, &sim.dropout_duration_s) == 2 ? 0 : -1; break;
+            case 'r': srand((unsigned int)atoi(optarg)); break;
+            case 'v': sim.verbose = 1; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "Invalid value for -%c: %s\n", opt, optarg);
+            return 1;
+        }
+    }
+    
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    for (int i = 0; i <= SIM_MAX_CONNS; i++) {
+        endpoints[i].fd = -1;
+    }
+    if (strcmp(sim.pty_link, "-") != 0) {
+        endpoints[0].fd = open_pty(sim.pty_link);
+        if (endpoints[0].fd < 0) return 1;
+    }
+    if (sim.tcp_port > 0) {
+        listen_fd = open_tcp(sim.tcp_port);
+        if (listen_fd < 0) return 1;
+    }
+    fflush(stdout);
+    
+    start_us = now_us();
+    long long next_stats_us = start_us + 10000000LL;
+    
+    while (running) {
+        struct pollfd fds[SIM_MAX_CONNS + 2];
+        sim_endpoint_t *owners[SIM_MAX_CONNS + 2];
+        int nfds = 0;
+        long long now = now_us();
+        long long wake = now + 100000;
+    
+        for (int i = 0; i <= SIM_MAX_CONNS; i++) {
+            sim_endpoint_t *ep = &endpoints[i];
+            if (ep->fd < 0) continue;
+            if (ep->due_us && ep->due_us < wake) wake = ep->due_us;
+            fds[nfds] = (struct pollfd){.fd = ep->fd, .events = POLLIN};
+            owners[nfds++] = ep;
+        }
+        if (listen_fd >= 0) {
+            fds[nfds] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+            owners[nfds++] = NULL;
+        }
+    
+        int timeout_ms = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+        int n = poll(fds, (nfds_t)nfds, timeout_ms);
+        if (n < 0 && errno != EINTR) break;
+    
+        for (int i = 0; i < nfds && n > 0; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (owners[i] == NULL) {
+                accept_tcp();
+            } else {
+                endpoint_read(owners[i]);
+            }
+        }
+    
+        now = now_us();
+        for (int i = 0; i <= SIM_MAX_CONNS; i++) {
+            sim_endpoint_t *ep = &endpoints[i];
+            if (ep->fd >= 0 && ep->due_us && ep->due_us <= now) {
+                send_response(ep);
+            }
+        }
+    
+        if (sim.verbose && now >= next_stats_us) {
+            print_stats();
+            next_stats_us = now + 10000000LL;
+        }
+    }
+    
+    print_stats();
+    if (endpoints[0].fd >= 0) unlink(sim.pty_link);
+    return 0;
+}